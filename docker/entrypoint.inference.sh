@@ -9,10 +9,61 @@ MODEL_DIR="${MODEL_DIR:-/data/models}"
 ROLLOUT_DIR="${ROLLOUT_DIR:-/data/rollouts}"
 ROLLOUT_SIZE="${ROLLOUT_SIZE:-2048}"
 DEVICE="${DEVICE:-cuda}"
+SHARDS="${SHARDS:-1}"
+CAPTURE_FILE="${CAPTURE_FILE:-}"
+LATENCY_MODE="${LATENCY_MODE:-0}"
+NET_CPUS="${NET_CPUS:-}"
+TORCH_CPUS="${TORCH_CPUS:-}"
+FLOW_CONTROL_MS="${FLOW_CONTROL_MS:-0}"
+UNIX_SOCKET="${UNIX_SOCKET:-}"
+GROUPED_HEROES="${GROUPED_HEROES:-0}"
+PIPELINE_DEPTH="${PIPELINE_DEPTH:-0}"
+DEADLINE_MS="${DEADLINE_MS:-0}"
+IDLE_TIMEOUT_SEC="${IDLE_TIMEOUT_SEC:-0}"
+IDLE_POLICY="${IDLE_POLICY:-flush}"
 
 echo "=== FateAnother Inference Server ==="
 echo "  Port: ${PORT}, Action: ${ACTION_PORT}, Device: ${DEVICE}"
 echo "  Model: ${MODEL_DIR}, Rollout: ${ROLLOUT_DIR}, Size: ${ROLLOUT_SIZE}"
+echo "  Shards: ${SHARDS}"
+
+EXTRA_ARGS=()
+if [ -n "${CAPTURE_FILE}" ]; then
+    echo "  Capture: ${CAPTURE_FILE}"
+    EXTRA_ARGS+=(--capture "${CAPTURE_FILE}")
+fi
+if [ "${LATENCY_MODE}" = "1" ]; then
+    echo "  Latency mode: net CPUs ${NET_CPUS:-auto}, torch CPUs ${TORCH_CPUS:-auto}"
+    EXTRA_ARGS+=(--latency-mode)
+    [ -n "${NET_CPUS}" ] && EXTRA_ARGS+=(--net-cpus "${NET_CPUS}")
+    [ -n "${TORCH_CPUS}" ] && EXTRA_ARGS+=(--torch-cpus "${TORCH_CPUS}")
+    # Idle OpenMP workers sleep instead of spinning (read when libgomp loads)
+    export OMP_WAIT_POLICY="${OMP_WAIT_POLICY:-PASSIVE}"
+fi
+if [ "${FLOW_CONTROL_MS}" != "0" ]; then
+    echo "  Flow control: queueing target ${FLOW_CONTROL_MS} ms"
+    EXTRA_ARGS+=(--flow-control "${FLOW_CONTROL_MS}")
+fi
+if [ -n "${UNIX_SOCKET}" ]; then
+    echo "  AF_UNIX datagram socket: ${UNIX_SOCKET} (instead of UDP)"
+    EXTRA_ARGS+=(--unix "${UNIX_SOCKET}")
+fi
+if [ "${GROUPED_HEROES}" = "1" ]; then
+    echo "  Grouped 12-hero forward"
+    EXTRA_ARGS+=(--grouped-heroes)
+fi
+if [ "${PIPELINE_DEPTH}" != "0" ]; then
+    echo "  Pipelined stages: ${PIPELINE_DEPTH} batches in flight per shard"
+    EXTRA_ARGS+=(--pipeline "${PIPELINE_DEPTH}")
+fi
+if [ "${DEADLINE_MS}" != "0" ]; then
+    echo "  Deadline: ${DEADLINE_MS} ms per STATE, last ACTION held past it"
+    EXTRA_ARGS+=(--deadline-ms "${DEADLINE_MS}")
+fi
+if [ "${IDLE_TIMEOUT_SEC}" != "0" ]; then
+    echo "  Idle eviction: ${IDLE_TIMEOUT_SEC}s without packets, ${IDLE_POLICY} partial episodes"
+    EXTRA_ARGS+=(--idle-timeout "${IDLE_TIMEOUT_SEC}" --idle-policy "${IDLE_POLICY}")
+fi
 
 # Wait for trainer to create initial per-hero models
 echo "Waiting for per-hero models (H000.pt ...)..."
@@ -27,4 +78,6 @@ exec fate_inference_server \
     --device "${DEVICE}" \
     --model-dir "${MODEL_DIR}" \
     --rollout-dir "${ROLLOUT_DIR}" \
-    --rollout-size "${ROLLOUT_SIZE}"
+    --rollout-size "${ROLLOUT_SIZE}" \
+    --shards "${SHARDS}" \
+    ${EXTRA_ARGS[@]+"${EXTRA_ARGS[@]}"}
@@ -19,12 +19,24 @@ export MESA_GL_VERSION_OVERRIDE=3.3
 export INFERENCE_HOST="${INFERENCE_HOST:-127.0.0.1}"
 export INFERENCE_PORT="${INFERENCE_PORT:-7777}"
 export RL_RECV_PORT="${RL_RECV_PORT:-7778}"
+export RL_PROTO_VERSION="${RL_PROTO_VERSION:-1}"   # 2 = instance/episode id header
+export RL_INSTANCE_ID="${RL_INSTANCE_ID:-${RL_RECV_PORT}}"
+export RL_DELTA_STATE="${RL_DELTA_STATE:-0}"       # 1 = delta-encoded STATE
+export RL_VIS_ENCODING="${RL_VIS_ENCODING:-raw}"   # raw | bits | rle
+export RL_FRAGMENT_SIZE="${RL_FRAGMENT_SIZE:-0}"   # >0 = split datagrams above this size (e.g. 1400 off-host)
+export RL_COMPACT_ACTIONS="${RL_COMPACT_ACTIONS:-0}" # 1 = quantized, changed-units-only ACTIONs
 
 # Wine registry로 환경변수 전달 (.NET은 Linux env를 직접 못 읽음)
 wine reg add "HKCU\\Environment" /v WC3_SPEED_MULTIPLIER /t REG_SZ /d "${WC3_SPEED_MULTIPLIER:-1}" /f 2>/dev/null
 wine reg add "HKCU\\Environment" /v INFERENCE_HOST /t REG_SZ /d "${INFERENCE_HOST}" /f 2>/dev/null
 wine reg add "HKCU\\Environment" /v INFERENCE_PORT /t REG_SZ /d "${INFERENCE_PORT}" /f 2>/dev/null
 wine reg add "HKCU\\Environment" /v RL_RECV_PORT /t REG_SZ /d "${RL_RECV_PORT}" /f 2>/dev/null
+wine reg add "HKCU\\Environment" /v RL_PROTO_VERSION /t REG_SZ /d "${RL_PROTO_VERSION}" /f 2>/dev/null
+wine reg add "HKCU\\Environment" /v RL_INSTANCE_ID /t REG_SZ /d "${RL_INSTANCE_ID}" /f 2>/dev/null
+wine reg add "HKCU\\Environment" /v RL_DELTA_STATE /t REG_SZ /d "${RL_DELTA_STATE}" /f 2>/dev/null
+wine reg add "HKCU\\Environment" /v RL_VIS_ENCODING /t REG_SZ /d "${RL_VIS_ENCODING}" /f 2>/dev/null
+wine reg add "HKCU\\Environment" /v RL_FRAGMENT_SIZE /t REG_SZ /d "${RL_FRAGMENT_SIZE}" /f 2>/dev/null
+wine reg add "HKCU\\Environment" /v RL_COMPACT_ACTIONS /t REG_SZ /d "${RL_COMPACT_ACTIONS}" /f 2>/dev/null
 wineserver --wait 2>/dev/null || true
 
 echo "=== FateAnother RL WC3 Container ==="
@@ -32,6 +44,7 @@ echo "  Map: ${MAP_PATH}"
 echo "  Speed: ${SPEED:-1x (default)}"
 echo "  Inference: ${INFERENCE_HOST}:${INFERENCE_PORT} (UDP)"
 echo "  Recv port: ${RL_RECV_PORT} (UDP)"
+echo "  Protocol: v${RL_PROTO_VERSION} (instance ${RL_INSTANCE_ID}, delta ${RL_DELTA_STATE}, vis ${RL_VIS_ENCODING}, fragment ${RL_FRAGMENT_SIZE}, compact actions ${RL_COMPACT_ACTIONS})"
 echo "  DISPLAY: ${DISPLAY}"
 echo ""
 
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "protocol.h"
+
+// ============================================================
+// MSG_ACTION_COMPACT body encoding (layout in protocol.h), shared
+// by the dispatcher and the tools. Sender and receiver both record
+// every action set they send / decode in an ActionHistory; a body
+// names the acknowledged set it was encoded against.
+// ============================================================
+
+inline int8_t quantize_move(float v) {
+    return static_cast<int8_t>(std::lround(std::max(-1.0f, std::min(1.0f, v)) * MOVE_QUANT_SCALE));
+}
+
+inline int16_t quantize_point(float v) {
+    return static_cast<int16_t>(std::lround(std::max(-1.0f, std::min(1.0f, v)) * POINT_QUANT_SCALE));
+}
+
+inline CompactUnitAction compact_unit_action(const UnitAction& ua) {
+    CompactUnitAction ca;
+    ca.move_x        = quantize_move(ua.move_x);
+    ca.move_y        = quantize_move(ua.move_y);
+    ca.point_x       = quantize_point(ua.point_x);
+    ca.point_y       = quantize_point(ua.point_y);
+    ca.skill         = ua.skill;
+    ca.unit_target   = ua.unit_target;
+    ca.skill_levelup = ua.skill_levelup;
+    ca.stat_upgrade  = ua.stat_upgrade;
+    ca.attribute     = ua.attribute;
+    ca.item_buy      = ua.item_buy;
+    ca.item_use      = ua.item_use;
+    ca.seal_use      = ua.seal_use;
+    ca.faire_send    = ua.faire_send;
+    ca.faire_request = ua.faire_request;
+    ca.faire_respond = ua.faire_respond;
+    return ca;
+}
+
+inline UnitAction expand_unit_action(const CompactUnitAction& ca, int idx) {
+    UnitAction ua{};
+    ua.idx           = static_cast<uint8_t>(idx);
+    ua.move_x        = ca.move_x / MOVE_QUANT_SCALE;
+    ua.move_y        = ca.move_y / MOVE_QUANT_SCALE;
+    ua.point_x       = ca.point_x / POINT_QUANT_SCALE;
+    ua.point_y       = ca.point_y / POINT_QUANT_SCALE;
+    ua.skill         = ca.skill;
+    ua.unit_target   = ca.unit_target;
+    ua.skill_levelup = ca.skill_levelup;
+    ua.stat_upgrade  = ca.stat_upgrade;
+    ua.attribute     = ca.attribute;
+    ua.item_buy      = ca.item_buy;
+    ua.item_use      = ca.item_use;
+    ua.seal_use      = ca.seal_use;
+    ua.faire_send    = ca.faire_send;
+    ua.faire_request = ca.faire_request;
+    ua.faire_respond = ca.faire_respond;
+    return ua;
+}
+
+using CompactActionSet = std::array<CompactUnitAction, MAX_UNITS>;
+
+// ============================================================
+// Last ACTION_HISTORY action sets by tick (ring, like KeyframeStore)
+// ============================================================
+struct ActionHistory {
+    struct Entry {
+        uint32_t tick = 0;
+        bool     valid = false;
+        CompactActionSet units;
+    };
+    std::array<Entry, ACTION_HISTORY> entries;
+    size_t next = 0;  // ring position of the oldest slot
+
+    const Entry* find(uint32_t tick) const {
+        if (tick == 0) return nullptr;
+        for (const auto& e : entries)
+            if (e.valid && e.tick == tick) return &e;
+        return nullptr;
+    }
+
+    void push(uint32_t tick, const CompactActionSet& units) {
+        Entry& e = entries[next];
+        next = (next + 1) % entries.size();
+        e.tick = tick;
+        e.valid = true;
+        e.units = units;
+    }
+};
+
+/// Write base_tick + unit_mask + the units that differ from base
+/// (all of them without a base) to out, which holds at least
+/// COMPACT_ACTION_MAX_BODY bytes. Returns the body size.
+inline size_t write_compact_action_body(uint8_t* out, const CompactActionSet& units,
+                                        const ActionHistory::Entry* base) {
+    const uint32_t base_tick = base ? base->tick : 0;
+    uint16_t mask = 0;
+    size_t offset = sizeof(base_tick) + sizeof(mask);
+    for (int i = 0; i < MAX_UNITS; ++i) {
+        if (base && std::memcmp(&units[i], &base->units[i], sizeof(CompactUnitAction)) == 0)
+            continue;
+        mask |= static_cast<uint16_t>(1u << i);
+        std::memcpy(out + offset, &units[i], sizeof(CompactUnitAction));
+        offset += sizeof(CompactUnitAction);
+    }
+    std::memcpy(out, &base_tick, sizeof(base_tick));
+    std::memcpy(out + sizeof(base_tick), &mask, sizeof(mask));
+    return offset;
+}
+
+/// Rebuild the full action set from a body. Returns false if the body
+/// is truncated or its base is not in history.
+inline bool read_compact_action_body(const uint8_t* body, size_t len,
+                                     const ActionHistory& history, CompactActionSet& units) {
+    uint32_t base_tick;
+    uint16_t mask;
+    if (len < sizeof(base_tick) + sizeof(mask)) return false;
+    std::memcpy(&base_tick, body, sizeof(base_tick));
+    std::memcpy(&mask, body + sizeof(base_tick), sizeof(mask));
+
+    const ActionHistory::Entry* base = nullptr;
+    if (base_tick != 0 && !(base = history.find(base_tick))) return false;
+
+    size_t offset = sizeof(base_tick) + sizeof(mask);
+    for (int i = 0; i < MAX_UNITS; ++i) {
+        if ((mask >> i) & 1) {
+            if (offset + sizeof(CompactUnitAction) > len) return false;
+            std::memcpy(&units[i], body + offset, sizeof(CompactUnitAction));
+            offset += sizeof(CompactUnitAction);
+        } else if (base) {
+            units[i] = base->units[i];
+        } else {
+            return false;  // no base: every unit must be present
+        }
+    }
+    return true;
+}
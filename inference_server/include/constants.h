@@ -31,6 +31,33 @@ constexpr float MAP_MIN_Y = -2592.f;
 constexpr float MAP_MAX_Y =  6176.f;
 constexpr float CELL_SIZE  = 350.f;
 
+// ============================================================
+// Portal definitions (entrance <-> exit, bidirectional)
+// ============================================================
+struct PortalDef {
+    float x, y;     // center of entrance rect
+    float ex, ey;   // center of exit rect
+};
+inline constexpr PortalDef PORTALS[] = {
+    // Fuyuki <-> Ryudou Temple
+    {-7328.f, 2128.f,  -2048.f, 7296.f},
+    // Fuyuki <-> Tohsaka Mansion
+    {-2288.f, -512.f,  -8000.f, -5376.f},
+    // Fuyuki <-> Matou Mansion
+    {-2800.f, -208.f,  -3328.f, -8256.f},
+    // Fuyuki <-> Einzbern Castle
+    {-6816.f, -1568.f,  6288.f, -6208.f},
+    // Fuyuki <-> Emiya Mansion
+    {-5920.f, 4800.f,  -6912.f, 7488.f},
+    // Fuyuki <-> School
+    {-3856.f, 1152.f,   3072.f, 7360.f},
+    // Fuyuki <-> Church
+    { 6816.f,  -80.f,   7232.f, 9984.f},
+    // Internal warp
+    { 2576.f, 5031.f,   2125.f, 5155.f},
+};
+constexpr int NUM_PORTALS = sizeof(PORTALS) / sizeof(PORTALS[0]);
+
 // ============================================================
 // Hero IDs (12 heroes, matches Python HERO_IDS)
 // ============================================================
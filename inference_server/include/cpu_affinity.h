@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// ============================================================
+// CPU affinity helpers for --latency-mode.
+// Linux: sched_getaffinity / pthread_setaffinity_np and the sysfs
+// topology. Elsewhere pinning is reported as unsupported and the
+// CPU list is 0 .. hardware_concurrency-1.
+// ============================================================
+
+/// Parse "0,2-3,6" into a sorted, de-duplicated CPU list.
+/// Throws std::runtime_error on malformed input.
+std::vector<int> parse_cpu_list(const std::string& spec);
+
+/// Compact form of a CPU list ("0-2,6"), "none" when empty.
+std::string cpu_list_string(const std::vector<int>& cpus);
+
+/// CPUs this process may run on (respects cgroup/cpuset limits, e.g.
+/// a docker --cpuset-cpus; a CFS quota like cpus: 2 is not visible here).
+std::vector<int> allowed_cpus();
+
+/// Restrict the calling thread to cpus. Threads it creates afterwards
+/// inherit the mask. Returns false if unsupported or rejected.
+bool pin_current_thread(const std::vector<int>& cpus);
+
+/// "core C, package P" from sysfs ("" if unknown).
+std::string cpu_topology(int cpu);
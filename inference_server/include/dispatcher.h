@@ -0,0 +1,417 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <torch/torch.h>
+
+#include "protocol.h"
+#include "compact_action.h"
+#include "constants.h"
+#include "instance_id.h"
+#include "latency_histogram.h"
+#include "udp_server.h"
+#include "shm_server.h"
+#include "spsc_queue.h"
+#include "packet_capture.h"
+#include "event_loop.h"
+#include "inference_engine.h"
+#include "reward_calc.h"
+#include "rollout_writer.h"
+#include "state_encoder.h"
+
+// ============================================================
+// Per-instance state tracking
+// ============================================================
+struct InstanceState {
+    // Incarnation of this instance, new on creation and on every episode
+    // reset. A step still in flight for an older one gets no ACTION.
+    // (The LSTM hidden states live with the inference stage: Dispatcher::hidden_)
+    uint64_t generation = 0;
+
+    // Previous state for reward computation
+    UnitState prev_units[MAX_UNITS];
+    GlobalState prev_global{};
+    bool has_prev = false;
+
+    // Reward calculator per instance
+    RewardCalc reward_calc;
+
+    // Last tick seen
+    uint32_t last_tick = 0;
+
+    // Recent full STATEs for delta reconstruction
+    KeyframeStore keyframes;
+
+    // Protocol version and v2 episode id of the latest STATE
+    uint8_t  proto_version = PROTO_VERSION;
+    uint32_t episode_id = 0;
+
+    // Pre-resolved ACTION reply address
+    // (v1: source IP + --action-port, v2: sender endpoint,
+    // AF_UNIX: the sender's socket path)
+    SockAddr reply_addr{};
+    bool has_reply_addr = false;
+
+    // Shared-memory slot (>= 0: reply through ShmServer, not UDP)
+    int shm_slot = -1;
+
+    // Compact ACTIONs (STATE_ACTION_ACK): the client's newest decoded
+    // ACTION and the action sets recently sent, to encode against
+    bool compact_actions = false;
+    uint32_t acked_action_tick = 0;
+    ActionHistory sent_actions;
+
+    // Latest ACTION sent, re-sent for a STATE shed past its deadline
+    UnitAction last_actions[MAX_UNITS];
+    bool has_last_action = false;
+
+    // Flow control: STATEs received / processed and their queueing
+    // delay in the current window, and the interval last advertised
+    std::chrono::steady_clock::time_point flow_window_start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point flow_sent{};
+    uint32_t flow_received = 0;
+    uint32_t flow_processed = 0;
+    uint32_t flow_queue_samples = 0;
+    int64_t  flow_queue_ns = 0;
+    uint16_t state_interval_ms = 0;
+
+    // Last time we received a packet from this instance (for timeout detection)
+    std::chrono::steady_clock::time_point last_recv_time = std::chrono::steady_clock::now();
+};
+
+// ============================================================
+// Per-instance latency over one stats window (Dispatcher::take_latency).
+// Measured from Datagram::rx_ns, the kernel receive timestamp.
+// ============================================================
+struct InstanceLatency {
+    LatencyHistogram queue;      // receive -> start of processing the STATE
+    LatencyHistogram process;    // start of processing -> ACTION queued
+    LatencyHistogram to_action;  // receive -> ACTION handed to the kernel
+    uint64_t superseded = 0;     // STATEs dropped in Phase 1 for a newer one
+    uint64_t deadline_misses = 0;  // STATEs shed past --deadline-ms (last ACTION re-sent)
+};
+
+// ============================================================
+// Optional per-stage timing of the STATE pipeline (fate_replay).
+// One sample per processed STATE per stage, in microseconds.
+// ============================================================
+enum PipelineStage {
+    STAGE_PARSE = 0,   // parse_packet (incl. delta reconstruction)
+    STAGE_ENCODE,      // encode
+    STAGE_MASKS,       // encode_masks
+    STAGE_REWARD,      // RewardCalc::compute
+    STAGE_INFER,       // infer_batch, the batch's time split over its STATEs
+    STAGE_STORE,       // RolloutWriter::store x 12
+    STAGE_ACTION,      // write_action_packet
+    NUM_PIPELINE_STAGES
+};
+
+inline const char* pipeline_stage_name(int stage) {
+    static const char* names[NUM_PIPELINE_STAGES] = {
+        "parse", "encode", "masks", "reward", "infer", "store", "action"};
+    return names[stage];
+}
+
+struct StageTimings {
+    std::array<std::vector<float>, NUM_PIPELINE_STAGES> us;
+};
+
+// ============================================================
+// Threaded pipeline (--pipeline): the shard's receive thread runs
+// NET (receive, parse/encode, ACTION replies); the INFER and
+// ROLLOUT stages get a thread each. Occupancy per stage is kept
+// cumulatively and read by the stats timer.
+// ============================================================
+enum PipeStage {
+    PIPE_NET = 0,
+    PIPE_INFER,
+    PIPE_ROLLOUT,
+    NUM_PIPE_STAGES
+};
+
+inline const char* pipe_stage_name(int stage) {
+    static const char* names[NUM_PIPE_STAGES] = {"net", "infer", "rollout"};
+    return names[stage];
+}
+
+struct PipeStageCounters {
+    std::atomic<uint64_t> busy_ns{0};      // time spent on batches
+    std::atomic<uint64_t> batches{0};      // batches handled
+    std::atomic<uint64_t> queue_depth{0};  // input queue depth at each pop, summed
+};
+
+// ============================================================
+// Dispatcher: one receive shard.
+// Owns one socket's share of the instances (plus the shared-memory
+// clients, if given a ShmServer) and runs the classify → DONE → STATE
+// pipeline for every received batch. With a PacketCapture, every
+// received batch is also appended to the capture file.
+// The engine and rollout writer are shared across shards.
+// Without a UdpServer (fate_replay) process() still runs the whole
+// pipeline; ACTIONs for UDP instances are built and discarded.
+// With start_pipeline, inference and rollout storage run on two
+// threads of their own, batches handed over through SpscQueues.
+// ============================================================
+class Dispatcher {
+public:
+    Dispatcher(int shard_id,
+               UdpServer* server,
+               InferenceEngine& engine,
+               RolloutWriter& writer,
+               torch::Device device,
+               ShmServer* shm = nullptr,
+               PacketCapture* capture = nullptr);
+    ~Dispatcher();
+
+    // Non-copyable
+    Dispatcher(const Dispatcher&) = delete;
+    Dispatcher& operator=(const Dispatcher&) = delete;
+
+    /// Receive loop: drain the socket (and shm rings), process, block in
+    /// loop.wait() when idle. busy_poll_us > 0 spins for that long before blocking.
+    void run(EventLoop& loop, int busy_poll_us);
+
+    /// Phase 1-3 for one received batch, then flush queued ACTIONs.
+    /// Runs every pipeline stage in turn on the calling thread.
+    void process(const std::vector<Datagram>& packets);
+
+    /// Run inference and rollout storage on their own threads, with up to
+    /// depth batches in flight (call before run; Linux only, throws
+    /// std::runtime_error elsewhere).
+    void start_pipeline(int depth);
+
+    bool pipelined() const { return !batch_pool_.empty(); }
+
+    int shard_id() const { return shard_id_; }
+
+    /// Record per-stage latencies of every processed STATE (nullptr = off).
+    void set_stage_timings(StageTimings* timings) { timings_ = timings; }
+
+    /// Send MSG_FLOW_CONTROL to instances whose STATEs are superseded or
+    /// queued longer than target_queue_ms (0 = off).
+    void set_flow_control(int target_queue_ms) { flow_target_ms_ = target_queue_ms; }
+
+    /// Latency budget per STATE, receive to ACTION (0 = off). Pending
+    /// STATEs are served earliest deadline first; a STATE that cannot make
+    /// its deadline gets the instance's last ACTION again instead of an
+    /// inference (a full STATE is still parsed, so its keyframe is stored).
+    void set_deadline(int budget_ms) { deadline_ns_ = static_cast<int64_t>(budget_ms) * 1000000; }
+
+    /// Evict instances that sent nothing for timeout_sec (0 = never): their
+    /// partial episode is flushed to the rollouts (or dropped, discard) and
+    /// all their state released. Checked once a second from run()'s loop.
+    void set_idle_eviction(int timeout_sec, bool discard) {
+        idle_timeout_ = std::chrono::seconds(timeout_sec);
+        idle_discard_ = discard;
+    }
+
+    /// Merge this shard's per-instance latency since the last call into
+    /// out and start a new window (safe from another thread).
+    void take_latency(std::unordered_map<InstanceId, InstanceLatency>& out);
+
+    // Counters (read from other threads for stats logging)
+    std::atomic<uint64_t> total_packets{0};
+    std::atomic<uint64_t> total_inferences{0};      // hero rows inferred
+    std::atomic<uint64_t> total_forwards{0};        // model forwards (per hero, or grouped, per batch)
+    std::atomic<uint64_t> total_skipped{0};
+    std::atomic<uint64_t> active_instances{0};
+    std::atomic<uint64_t> total_dones{0};           // DONEs applied (one per episode)
+    std::atomic<uint64_t> total_duplicate_dones{0}; // retransmissions, acknowledged only
+    std::atomic<uint64_t> total_compact_actions{0}; // MSG_ACTION_COMPACT sent
+    std::atomic<uint64_t> total_compact_bytes{0};   // their bodies (full: 360 bytes)
+    std::atomic<uint64_t> total_flow_updates{0};    // MSG_FLOW_CONTROL sent
+    std::atomic<uint64_t> total_deadline_misses{0}; // STATEs shed, last ACTION held
+    std::atomic<uint64_t> total_evicted{0};         // idle instances evicted
+    std::atomic<uint64_t> total_reclaimed_bytes{0}; // their memory (instance, LSTM, rollout buffer)
+    std::array<PipeStageCounters, NUM_PIPE_STAGES> pipe_stages;  // --pipeline only
+
+private:
+    int shard_id_;
+    UdpServer* server_;
+    InferenceEngine& engine_;
+    RolloutWriter& writer_;
+    torch::Device device_;
+    ShmServer* shm_;
+    PacketCapture* capture_;
+    StageTimings* timings_ = nullptr;
+    int flow_target_ms_ = 0;
+    int64_t deadline_ns_ = 0;
+    double step_cost_ns_ = 0;  // EWMA of start -> ACTION queued per step of a batch
+
+    /// Queue an ACTION for tick (compact against the acknowledged set
+    /// when the client supports it) and remember it as the last one.
+    void send_action(InstanceState& inst, uint8_t version, const PacketHeaderExt& ext,
+                     uint32_t tick, const UnitAction actions[MAX_UNITS]);
+
+    /// Deadline miss: answer the STATE with inst's last ACTION instead of
+    /// processing it. False if there is none for this episode yet.
+    bool hold_last_action(InstanceId inst_id, const PacketHeader& hdr,
+                          const PacketHeaderExt& ext, uint32_t superseded);
+    std::vector<InstanceId> deadline_missed_;  // this batch, for latency_
+    std::chrono::seconds idle_timeout_{0};
+    bool idle_discard_ = false;
+
+    /// Timer: evict idle instances (see set_idle_eviction).
+    void evict_idle();
+
+    /// Reply buffer for inst (shm ring, UDP send queue or offline scratch).
+    uint8_t* reserve_reply(const InstanceState& inst, size_t len);
+
+    /// Point inst's replies at addr, moving its hold on an AF_UNIX peer.
+    void set_reply_addr(InstanceState& inst, const SockAddr& addr);
+
+    /// New episode on a live instance: fresh state, same reply address
+    /// (and so the same AF_UNIX peer hold).
+    static void reset_instance(InstanceState& inst);
+
+    // AF_UNIX peers of instances that ended in this batch, released once
+    // every STATE of the batch has taken its own hold
+    std::vector<SockAddr> ended_peers_;
+
+    /// Account one processed STATE; once per window, adjust and send the
+    /// instance's STATE interval.
+    void update_flow_control(InstanceState& inst, uint8_t version, const PacketHeaderExt& ext,
+                             uint32_t tick, uint32_t superseded, int64_t queue_ns);
+
+    // ACTION target when there is no UdpServer
+    std::vector<uint8_t> action_scratch_;
+
+    // Phase 3 work item: one instance's STATE from parsing to its ACTION.
+    // Every step of a batch is encoded first, then each hero model runs
+    // once over all of them (infer_pending), then the replies are built
+    // and the transitions stored. A step carries everything the later
+    // stages need, so they never touch InstanceState.
+    struct PendingStep {
+        InstanceId inst_id;
+        uint64_t generation;     // InstanceState::generation when encoded
+        bool reset_hidden;       // new instance / new episode: fresh LSTM state
+        uint32_t superseded;
+        int64_t rx_ns;
+        int64_t start_ns;
+        PacketHeader header;
+        PacketHeaderExt ext;
+        GlobalState global;
+        UnitState units[MAX_UNITS];
+        std::vector<Event> events;
+        EncodedObs obs;
+        MaskSet masks;
+        std::array<float, MAX_UNITS> rewards;
+        bool has_prev;           // previous state, for the transition
+        UnitState prev_units[MAX_UNITS];
+        GlobalState prev_global;
+        std::array<torch::Tensor, MAX_UNITS> input_hx_h;  // hx before inference (CPU)
+        std::array<torch::Tensor, MAX_UNITS> input_hx_c;
+        std::array<InferenceEngine::InferResult, MAX_UNITS> results;
+    };
+
+    // Rollout episode end (DONE, a new episode without one, or eviction)
+    struct EpisodeEnd {
+        InstanceId inst_id;
+        std::array<float, MAX_UNITS> terminal_rewards;
+        bool discard = false;  // idle eviction: drop the partial episode
+        bool evicted = false;  // idle eviction: its rollout buffer counts as reclaimed
+    };
+
+    // Unit of work passed between the stages. Episode ends precede the
+    // batch's steps (they were received first or end the episode a step
+    // replaces).
+    struct StageBatch {
+        std::vector<PendingStep> steps;
+        std::vector<EpisodeEnd> episode_ends;
+        std::vector<InstanceId> forget;   // instances erased: drop their LSTM state
+        std::vector<InstanceId> evicted;  // idle instances: same, counted as reclaimed
+
+        void clear() {
+            steps.clear();
+            episode_ends.clear();
+            forget.clear();
+            evicted.clear();
+        }
+        bool empty() const {
+            return steps.empty() && episode_ends.empty() && forget.empty() && evicted.empty();
+        }
+    };
+
+    /// NET: Phases 1, 2 and 3a into batch. DONE-ACKs are queued, not flushed.
+    void encode_stage(const std::vector<Datagram>& packets, StageBatch& batch);
+
+    /// INFER: Phase 3b (LSTM states in hidden_).
+    void infer_stage(StageBatch& batch);
+
+    /// NET: the ACTIONs (and flow control), flush, latency samples.
+    void reply_stage(StageBatch& batch);
+
+    /// ROLLOUT: episode ends, then the steps' transitions.
+    void rollout_stage(StageBatch& batch);
+
+    StageBatch batch_;    // process()
+    StageBatch evicted_;  // evict_idle's episode ends, until a stage thread takes them
+
+    // LSTM hidden states per instance and hero (keyed by hero_id string),
+    // owned by the inference stage
+    struct HiddenState {
+        std::unordered_map<std::string, torch::Tensor> hx_h;  // (1, 1, 256)
+        std::unordered_map<std::string, torch::Tensor> hx_c;
+    };
+    std::unordered_map<InstanceId, HiddenState> hidden_;
+    std::vector<HiddenState*> step_hidden_;  // per step of the batch being inferred
+    uint64_t next_generation_ = 0;
+
+    // (step, unit) rows per hero model, rebuilt for every batch
+    std::unordered_map<std::string, std::vector<std::pair<size_t, int>>> hero_rows_;
+
+    /// One infer_batch per hero over every unit of steps (or a single
+    /// infer_grouped when the engine is in grouped mode); fills results
+    /// and advances the instances' LSTM states.
+    void infer_pending(std::vector<PendingStep>& steps);
+
+    /// infer_pending's grouped path. False (nothing changed) if a hero
+    /// has no grouped model or the forward fails.
+    bool infer_grouped_pending(std::vector<PendingStep>& steps);
+
+    // --pipeline: a fixed pool of batches cycles
+    // NET -> to_infer_ -> INFER -> to_reply_ -> NET -> to_rollout_ -> ROLLOUT -> to_free_ -> NET.
+    // Every queue holds the whole pool, so a push never fails.
+    std::vector<std::unique_ptr<StageBatch>> batch_pool_;
+    std::unique_ptr<SpscQueue<StageBatch*>> to_infer_, to_reply_, to_rollout_, to_free_;
+    std::thread infer_thread_, rollout_thread_;
+    std::atomic<bool> pipe_stop_{false};
+    int reply_efd_ = -1;  // eventfd: INFER rings NET's event loop per finished batch
+
+    void run_pipelined(EventLoop& loop, int busy_poll_us);
+    void drain_replies();
+    void stage_thread(PipeStage stage, SpscQueue<StageBatch*>& in, SpscQueue<StageBatch*>& out);
+
+    // Latency of the STATEs in the current batch, recorded after the flush
+    struct LatencySample {
+        InstanceId inst_id;
+        int64_t rx_ns;
+        int64_t start_ns;
+        int64_t queued_ns;
+        uint32_t superseded;
+    };
+    std::vector<LatencySample> latency_samples_;
+    std::mutex latency_mutex_;
+    std::unordered_map<InstanceId, InstanceLatency> latency_;  // guarded by latency_mutex_
+
+    // Per-instance state (this shard's share)
+    std::unordered_map<InstanceId, InstanceState> instances_;
+
+    // Last DONE applied per instance (kept after the instance is erased)
+    // so retransmitted DONEs are acknowledged but not applied twice
+    struct DoneRecord {
+        uint32_t episode_id;
+        uint32_t tick;
+        std::chrono::steady_clock::time_point at;  // dropped by evict_idle
+    };
+    std::unordered_map<InstanceId, DoneRecord> last_done_;
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include "udp_server.h"
+
+// ============================================================
+// EventLoop: readiness-based wait on the UDP socket plus
+// periodic timers (model reload, rollout dump, stats) and extra
+// readers (shared-memory doorbell / handshake socket).
+//
+// Linux: epoll + one timerfd per timer.
+// Other: select() with deadline timers computed in user space.
+// ============================================================
+class EventLoop {
+public:
+    using Callback = std::function<void()>;
+    using Clock = std::chrono::steady_clock;
+
+    explicit EventLoop(socket_t sock);
+    ~EventLoop();
+
+    // Non-copyable
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    /// Register a periodic timer. First expiry is one interval from now.
+    void add_timer(std::chrono::milliseconds interval, Callback cb);
+
+    /// Register an extra descriptor; cb runs from wait() whenever it is readable.
+    void add_reader(int fd, Callback cb);
+
+    /// Block until the socket is readable or a timer fires, running any
+    /// due timer callbacks. timeout < 0 waits indefinitely, 0 only polls.
+    /// Returns true if the socket is readable.
+    bool wait(std::chrono::milliseconds timeout = std::chrono::milliseconds(-1));
+
+private:
+    struct Timer {
+        std::chrono::milliseconds interval;
+        Callback cb;
+        Clock::time_point deadline;  // non-Linux only
+        int fd;                      // timerfd (Linux only)
+    };
+
+    struct Reader {
+        int fd;
+        Callback cb;
+    };
+
+    socket_t sock_;
+    std::vector<Timer> timers_;
+    std::vector<Reader> readers_;
+
+#ifdef __linux__
+    int epfd_;
+#endif
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <torch/torch.h>
+#include <torch/script.h>
+
+#include "constants.h"
+
+// ============================================================
+// GroupedHeroModel: all 12 per-hero FateModelExport models as one.
+//
+// The heroes share one architecture, so every layer's weights are
+// stacked over a hero dimension: Linear layers run as one bmm over
+// (hero, rows), the grid convolutions as grouped convolutions
+// (groups = heroes) and the LSTM cell step is written out on the
+// stacked gates. Rows are grouped by hero and padded to the largest
+// group, so 12 agents of K games are one forward of a few large
+// kernels instead of 12 chains of small ones.
+// ============================================================
+
+// Linear layer stacked over heroes: w (H, in, out), b (H, 1, out)
+struct StackedLinear {
+    torch::Tensor w;
+    torch::Tensor b;
+};
+
+class GroupedHeroModel {
+public:
+    /// models: one loaded FateModelExport module per hero, in hero_ids()
+    /// order. Throws std::runtime_error if a parameter is missing or the
+    /// heroes' shapes differ.
+    GroupedHeroModel(const std::vector<torch::jit::script::Module>& models, torch::Device device);
+
+    /// Forward N rows; hero[n] is the hero index of row n. Returns the
+    /// FateModelExport output tuple as a vector, in row order, with two
+    /// differences: logits are not masked (the sampler masks them) and
+    /// move/point logstd are per row, (N, 2).
+    std::vector<torch::Tensor> forward(
+        const std::vector<int>& hero,
+        const torch::Tensor& self_vec,      // (N, 77)
+        const torch::Tensor& ally_vec,      // (N, 5, 37)
+        const torch::Tensor& enemy_vec,     // (N, 6, 43)
+        const torch::Tensor& global_vec,    // (N, 6)
+        const torch::Tensor& grid,          // (N, C, 25, 48)
+        const torch::Tensor& hx_h,          // (1, N, 256)
+        const torch::Tensor& hx_c           // (1, N, 256)
+    ) const;
+
+private:
+    StackedLinear self1_, self2_;  // self_enc.net.0 / .2
+    StackedLinear ally_, enemy_;   // ally_enc.net.0, enemy_enc.net.0
+    StackedLinear global_;         // global_fc.0
+    StackedLinear grid_fc_;        // grid_enc.fc
+    StackedLinear pre_lstm_;       // pre_lstm.0
+    StackedLinear lstm_ih_;        // weight_ih_l0, bias_ih_l0 + bias_hh_l0
+    torch::Tensor lstm_hh_;        // weight_hh_l0, (H, 256, 1024)
+    StackedLinear heads_;          // 11 discrete heads, move_mean, point_mean, value_head.0
+    StackedLinear value_out_;      // value_head.2
+
+    // grid_enc.conv.0 / .2 as grouped convolutions: (H * out, in, 3, 3)
+    torch::Tensor conv1_w_, conv1_b_, conv2_w_, conv2_b_;
+
+    torch::Tensor move_logstd_, point_logstd_;  // (H, 2), clamped
+    torch::Device device_;
+};
@@ -4,41 +4,70 @@
 #include <unordered_map>
 #include <filesystem>
 #include <chrono>
+#include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <utility>
+#include <vector>
 
 #include <torch/torch.h>
 #include <torch/script.h>
 
 #include "constants.h"
+#include "grouped_model.h"
 
 class InferenceEngine {
 public:
+    /// One row of a batch. actions/log_prob/value are on the CPU,
+    /// new_h/new_c on the model device.
     struct InferResult {
-        std::unordered_map<std::string, torch::Tensor> actions;  // sampled discrete + continuous
-        torch::Tensor log_prob;   // scalar
-        torch::Tensor value;      // scalar
+        std::unordered_map<std::string, torch::Tensor> actions;  // sampled discrete (1,) + continuous (1, 2)
+        torch::Tensor log_prob;   // (1,)
+        torch::Tensor value;      // (1,)
         torch::Tensor new_h;      // (1, 1, 256)
         torch::Tensor new_c;      // (1, 1, 256)
     };
 
     /// model_dir: directory containing per-hero .pt files (H000.pt, H001.pt, ...)
     /// device: torch::kCPU or torch::kCUDA
-    InferenceEngine(const std::string& model_dir, torch::Device device);
+    /// grouped: also keep the 12 models' weights stacked for infer_grouped
+    ///          (rebuilt on every reload, once all 12 are loaded)
+    InferenceEngine(const std::string& model_dir, torch::Device device, bool grouped = false);
 
-    /// Run inference for a single hero using its dedicated model.
-    InferResult infer_hero(
+    /// Run one hero's dedicated model on B rows (that hero in B games)
+    /// in a single forward; returns one result per row.
+    /// Thread-safe: may be called from several shards while maybe_reload()
+    /// swaps models.
+    std::vector<InferResult> infer_batch(
         const std::string& hero_id,
-        torch::Tensor self_vec,      // (1, 77)
-        torch::Tensor ally_vec,      // (1, 5, 37)
-        torch::Tensor enemy_vec,     // (1, 6, 43)
-        torch::Tensor global_vec,    // (1, 6)
-        torch::Tensor grid,          // (1, 3, 25, 48)
-        torch::Tensor hx_h,         // (1, 1, 256)
-        torch::Tensor hx_c,         // (1, 1, 256)
+        torch::Tensor self_vec,      // (B, 77)
+        torch::Tensor ally_vec,      // (B, 5, 37)
+        torch::Tensor enemy_vec,     // (B, 6, 43)
+        torch::Tensor global_vec,    // (B, 6)
+        torch::Tensor grid,          // (B, 3, 25, 48)
+        torch::Tensor hx_h,         // (1, B, 256)
+        torch::Tensor hx_c,         // (1, B, 256)
+        const std::unordered_map<std::string, torch::Tensor>& masks  // (B, head_size)
+    );
+
+    /// Run every hero's rows in one GroupedHeroModel forward; hero[n] is
+    /// the hero_ids() index of row n. Same shapes as infer_batch with
+    /// B = N rows of any heroes. Throws if !grouped_ready().
+    std::vector<InferResult> infer_grouped(
+        const std::vector<int>& hero,
+        torch::Tensor self_vec,
+        torch::Tensor ally_vec,
+        torch::Tensor enemy_vec,
+        torch::Tensor global_vec,
+        torch::Tensor grid,
+        torch::Tensor hx_h,
+        torch::Tensor hx_c,
         const std::unordered_map<std::string, torch::Tensor>& masks
     );
 
+    /// Grouped mode is on and the stacked weights are built.
+    bool grouped_ready() const;
+
     /// Check per-hero .pt files for changes and reload if updated.
     void maybe_reload();
 
@@ -52,15 +81,29 @@ private:
     // Per-hero models: hero_id → TorchScript module
     std::unordered_map<std::string, torch::jit::script::Module> hero_models_;
     std::unordered_map<std::string, std::filesystem::file_time_type> model_times_;
+    mutable std::shared_mutex models_mutex_;  // guards hero_models_ / model_times_ / grouped_
     std::string model_dir_;
     torch::Device device_;
 
+    // Grouped mode: all 12 models stacked (nullptr until all are loaded)
+    bool grouped_mode_;
+    std::shared_ptr<const GroupedHeroModel> grouped_;
+
     /// Try to load all hero .pt files. Returns number of models loaded.
     int load_hero_models();
 
     /// Try to load a single hero model. Returns true on success.
     bool load_hero_model(const std::string& hero_id);
 
+    /// Restack grouped_ from the loaded models (grouped mode only).
+    void rebuild_grouped();
+
+    /// Forward outputs (FateModelExport tuple order) -> per-row results.
+    std::vector<InferResult> sample_rows(
+        const std::vector<torch::Tensor>& elements,
+        const std::unordered_map<std::string, torch::Tensor>& masks,
+        int64_t batch);
+
     /// Sample from categorical distribution with mask applied.
     std::pair<torch::Tensor, torch::Tensor> sample_categorical(
         torch::Tensor logits, torch::Tensor mask);
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// ============================================================
+// Compact instance identifier used as the key for all per-instance
+// maps (dispatcher, rollout buffers). Strings only appear in logs.
+//
+//   bits 63..32: source IPv4 address (host byte order),
+//                0 for shared-memory clients
+//   bits 31..0 : local id within that host (0 = whole host),
+//                shared-memory slot + 1 when the address is 0,
+//                AF_UNIX peer number + 1 for v1 clients on --unix
+// ============================================================
+using InstanceId = uint64_t;
+
+inline InstanceId make_instance_id(uint32_t ip_host_order, uint32_t local_id = 0) {
+    return (static_cast<uint64_t>(ip_host_order) << 32) | local_id;
+}
+
+/// Shared-memory slot (0-based) -> instance id
+inline InstanceId make_shm_instance_id(int slot) {
+    return make_instance_id(0, static_cast<uint32_t>(slot) + 1);
+}
+
+/// "a.b.c.d", "a.b.c.d#local_id" or "shm#slot" (logging only)
+inline std::string instance_id_str(InstanceId id) {
+    uint32_t ip = static_cast<uint32_t>(id >> 32);
+    uint32_t local = static_cast<uint32_t>(id);
+    if (ip == 0 && local != 0) return "shm#" + std::to_string(local - 1);
+    std::string s = std::to_string((ip >> 24) & 0xFF) + "."
+                  + std::to_string((ip >> 16) & 0xFF) + "."
+                  + std::to_string((ip >> 8) & 0xFF) + "."
+                  + std::to_string(ip & 0xFF);
+    if (local != 0) s += "#" + std::to_string(local);
+    return s;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// ============================================================
+// LatencyHistogram: fixed-memory log-linear histogram (ns).
+// Each power of two is split into LAT_SUB_BUCKETS linear buckets,
+// so any recorded value is known to within 1/16 (~6%) whatever
+// its magnitude. Values up to 2^LAT_MAX_BITS ns (~68 s); larger
+// ones land in the last bucket. ~2 KB, no allocation on record().
+// ============================================================
+constexpr int LAT_SUB_BITS    = 4;
+constexpr int LAT_SUB_BUCKETS = 1 << LAT_SUB_BITS;
+constexpr int LAT_MAX_BITS    = 36;
+constexpr int LAT_NUM_BUCKETS = (LAT_MAX_BITS - LAT_SUB_BITS + 1) * LAT_SUB_BUCKETS;
+
+class LatencyHistogram {
+public:
+    void record(uint64_t ns) {
+        ++counts_[bucket_of(ns)];
+        ++count_;
+        if (ns > max_) max_ = ns;
+    }
+
+    /// Value at quantile q (0..1): midpoint of the bucket holding it,
+    /// capped at the largest recorded value. 0 when empty.
+    uint64_t percentile(double q) const {
+        if (count_ == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(count_ - 1)) + 1;
+        uint64_t seen = 0;
+        for (int b = 0; b < LAT_NUM_BUCKETS; ++b) {
+            seen += counts_[b];
+            if (seen >= rank) {
+                uint64_t lo = bucket_low(b);
+                uint64_t mid = lo + (bucket_low(b + 1) - lo) / 2;
+                return mid < max_ ? mid : max_;
+            }
+        }
+        return max_;
+    }
+
+    void merge(const LatencyHistogram& o) {
+        for (int b = 0; b < LAT_NUM_BUCKETS; ++b) counts_[b] += o.counts_[b];
+        count_ += o.count_;
+        if (o.max_ > max_) max_ = o.max_;
+    }
+
+    uint64_t count() const { return count_; }
+    uint64_t max() const { return max_; }
+
+private:
+    static int msb(uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+        return 63 - __builtin_clzll(v);
+#else
+        int m = 0;
+        while (v >>= 1) ++m;
+        return m;
+#endif
+    }
+
+    static int bucket_of(uint64_t v) {
+        if (v < static_cast<uint64_t>(LAT_SUB_BUCKETS)) return static_cast<int>(v);
+        if (v >> LAT_MAX_BITS) return LAT_NUM_BUCKETS - 1;
+        // Top LAT_SUB_BITS+1 bits: group by exponent, linear within it
+        const int m = msb(v);
+        const int shift = m - LAT_SUB_BITS;
+        return (shift + 1) * LAT_SUB_BUCKETS
+             + static_cast<int>((v >> shift) - LAT_SUB_BUCKETS);
+    }
+
+    static uint64_t bucket_low(int b) {
+        if (b < LAT_SUB_BUCKETS) return static_cast<uint64_t>(b);
+        const int group = b / LAT_SUB_BUCKETS;
+        const uint64_t sub = static_cast<uint64_t>(b % LAT_SUB_BUCKETS);
+        return (LAT_SUB_BUCKETS + sub) << (group - 1);
+    }
+
+    std::array<uint32_t, LAT_NUM_BUCKETS> counts_{};
+    uint64_t count_ = 0;
+    uint64_t max_ = 0;
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "udp_server.h"
+
+// ============================================================
+// Capture file format (--capture, read back by fate_replay)
+//
+// CaptureFileHeader, then one record per received datagram:
+//   CaptureRecordHeader (24 bytes) + len raw bytes
+// Little-endian, no padding between records. Timestamps are
+// CLOCK_REALTIME nanoseconds taken when the batch was received.
+// ============================================================
+
+constexpr uint32_t CAPTURE_MAGIC   = 0x50414346;  // "FCAP"
+constexpr uint16_t CAPTURE_VERSION = 1;
+
+#pragma pack(push, 1)
+
+struct CaptureFileHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_header_size;  // sizeof(CaptureRecordHeader)
+};
+
+struct CaptureRecordHeader {
+    uint64_t timestamp_ns;   // receive time, ns since the Unix epoch
+    uint32_t ip;             // source IPv4, network byte order (0 for shm)
+    uint16_t port;           // source port, host byte order
+    int16_t  shm_slot;       // >= 0: received over shared memory
+    uint32_t len;            // payload bytes that follow
+    uint32_t reserved;
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(CaptureFileHeader) == 8, "CaptureFileHeader must be 8 bytes");
+static_assert(sizeof(CaptureRecordHeader) == 24, "CaptureRecordHeader must be 24 bytes");
+
+// ============================================================
+// PacketCapture: appends every received datagram to a capture file.
+//
+// Receive threads only memcpy into an in-memory buffer (one lock per
+// batch); a background thread swaps buffers and does large fwrite()s.
+// If the writer falls behind by more than CAPTURE_MAX_PENDING bytes,
+// further batches are dropped (and counted) instead of stalling the
+// hot loop.
+// ============================================================
+class PacketCapture {
+public:
+    /// Opens (truncates) path and starts the writer thread. Throws on error.
+    explicit PacketCapture(const std::string& path);
+    ~PacketCapture();
+
+    // Non-copyable
+    PacketCapture(const PacketCapture&) = delete;
+    PacketCapture& operator=(const PacketCapture&) = delete;
+
+    /// Append one received batch (all records share one timestamp).
+    void record(const std::vector<Datagram>& packets);
+
+    uint64_t records() const { return records_; }
+    uint64_t bytes_written() const { return bytes_written_; }
+    uint64_t dropped() const { return dropped_; }
+
+    /// Buffered bytes before the writer is woken early / before dropping
+    static constexpr size_t CAPTURE_WAKE_BYTES  = 1 << 20;
+    static constexpr size_t CAPTURE_MAX_PENDING = 64 << 20;
+
+private:
+    void writer_loop();
+
+    std::string path_;
+    std::FILE* file_ = nullptr;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<uint8_t> pending_;   // filled by receive threads
+    bool stop_ = false;
+    std::thread writer_;
+
+    std::atomic<uint64_t> records_{0};
+    std::atomic<uint64_t> bytes_written_{0};
+    std::atomic<uint64_t> dropped_{0};
+};
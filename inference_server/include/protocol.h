@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 // Binary protocol for FateAnother RL communication
@@ -12,12 +13,18 @@
 // Packet Header (8 bytes)
 // ============================================================
 constexpr uint16_t MAGIC = 0xFA7E;
-constexpr uint8_t  PROTO_VERSION = 1;
+constexpr uint8_t  PROTO_VERSION    = 1;   // instance = source IP, replies to --action-port
+constexpr uint8_t  PROTO_VERSION_V2 = 2;   // + PacketHeaderExt, replies to sender endpoint
 
 enum MsgType : uint8_t {
     MSG_STATE  = 1,
     MSG_ACTION = 2,
     MSG_DONE   = 3,
+    MSG_STATE_DELTA = 4,   // STATE encoded against an earlier keyframe (see below)
+    MSG_DONE_ACK = 5,      // server -> client: DONE received (see below)
+    MSG_FRAGMENT = 6,      // one piece of a larger datagram (see below)
+    MSG_ACTION_COMPACT = 7, // server -> client: ACTION, changed units only (see below)
+    MSG_FLOW_CONTROL = 8,   // server -> client: desired STATE interval (see below)
 };
 
 struct PacketHeader {
@@ -28,6 +35,24 @@ struct PacketHeader {
 };
 static_assert(sizeof(PacketHeader) == 8, "PacketHeader must be 8 bytes");
 
+// ============================================================
+// v2 Header Extension (8 bytes)
+// Follows PacketHeader when version == 2; the message body that
+// comes after it is identical to v1. Lets one server multiplex
+// many WC3 processes on the same host.
+// ============================================================
+struct PacketHeaderExt {
+    uint32_t instance_id;  // client-chosen, unique per host, stable across episodes (non-zero)
+    uint32_t episode_id;   // changes for every new episode of that instance
+};
+static_assert(sizeof(PacketHeaderExt) == 8, "PacketHeaderExt must be 8 bytes");
+
+struct PacketHeaderV2 {
+    PacketHeader    base;
+    PacketHeaderExt ext;
+};
+static_assert(sizeof(PacketHeaderV2) == 16, "PacketHeaderV2 must be 16 bytes");
+
 // ============================================================
 // Skill Slot (14 bytes)
 // ============================================================
@@ -193,7 +218,8 @@ constexpr int GRID_W      = 48;
 constexpr int GRID_H      = 25;
 constexpr int GRID_CELLS  = GRID_W * GRID_H;  // 1200
 
-// Fixed portion of state packet (before variable-length events and grids)
+// Fixed portion of state packet (before variable-length events and grids).
+// v1 layout; in v2 a PacketHeaderExt sits between header and global.
 struct StatePacketFixed {
     PacketHeader header;            // 8
     GlobalState  global;            // 28
@@ -203,12 +229,60 @@ struct StatePacketFixed {
 
 // Full state packet is parsed incrementally:
 //   StatePacketFixed + Event[num_events]
-//   + uint8_t has_pathability
-//   + (if has_pathability) uint8_t pathability[1200]
-//   + uint8_t visibility_t0[1200]
-//   + uint8_t visibility_t1[1200]
+//   + uint8_t grid_flags (GridFlags; 0/1 = old has_pathability byte)
+//   + (if GRID_HAS_PATHABILITY) uint8_t pathability[1200]
+//   + visibility_t0 (encoding per grid_flags)
+//   + visibility_t1
 //   + uint8_t num_creeps
 //   + CreepState creeps[num_creeps]
+//   + (if STATE_ACTION_ACK) uint32_t acked_action_tick
+
+// Visibility grid encodings (cell c = y * GRID_W + x):
+//   default         uint8_t cells[1200], 0 or 1
+//   GRID_VIS_BITS   uint8_t bits[150], bit (c & 7) of byte (c >> 3)
+//   GRID_VIS_RLE    uint16_t num_runs + uint8_t runs[num_runs],
+//                   run = (value << 7) | (length - 1), length 1-128
+enum GridFlags : uint8_t {
+    GRID_HAS_PATHABILITY = 1 << 0,
+    GRID_VIS_BITS        = 1 << 1,
+    GRID_VIS_RLE         = 1 << 2,
+    STATE_ACTION_ACK     = 1 << 7,  // client takes MSG_ACTION_COMPACT (see below)
+};
+constexpr int VIS_PACKED_BYTES = GRID_CELLS / 8;  // 150
+
+// ============================================================
+// Delta State Packet (msg_type = MSG_STATE_DELTA, variable length)
+// Carries only the DELTA_CHUNK-byte chunks of GlobalState + units
+// that differ from an earlier full STATE (the keyframe), and the
+// grids/creeps only when they changed:
+//   header (+ext)
+//   + uint32_t base_tick                     keyframe tick
+//   + uint8_t  chunk_mask[DELTA_MASK_BYTES]  bit i set: chunk i follows
+//   + changed chunks (last chunk of the block may be short)
+//   + uint8_t num_events + Event[num_events]
+//   + uint8_t grid_flags (+ pathability[1200])
+//   + uint8_t delta_flags (DeltaFlags)
+//   + (DELTA_VIS_T0) visibility_t0 (encoding per grid_flags)
+//   + (DELTA_VIS_T1) visibility_t1
+//   + (DELTA_CREEPS) uint8_t num_creeps + CreepState creeps[num_creeps]
+//   + (STATE_ACTION_ACK) uint32_t acked_action_tick
+// Omitted sections are taken from the keyframe. Clients encode only
+// against a keyframe the server answered with an ACTION (same tick)
+// and send a fresh full STATE periodically.
+// ============================================================
+constexpr size_t STATE_BLOCK_SIZE = sizeof(GlobalState) + sizeof(UnitState) * MAX_UNITS;  // 2800
+constexpr size_t DELTA_CHUNK      = 16;
+constexpr size_t DELTA_NUM_CHUNKS = (STATE_BLOCK_SIZE + DELTA_CHUNK - 1) / DELTA_CHUNK;
+constexpr size_t DELTA_MASK_BYTES = (DELTA_NUM_CHUNKS + 7) / 8;
+constexpr int    KEYFRAME_HISTORY = 8;    // keyframes kept per instance
+static_assert(sizeof(PacketHeader) + STATE_BLOCK_SIZE + 1 == sizeof(StatePacketFixed),
+              "STATE_BLOCK_SIZE must match the StatePacketFixed body");
+
+enum DeltaFlags : uint8_t {
+    DELTA_VIS_T0 = 1 << 0,
+    DELTA_VIS_T1 = 1 << 1,
+    DELTA_CREEPS = 1 << 2,
+};
 
 // ============================================================
 // Unit Action (28 bytes)
@@ -244,9 +318,65 @@ struct ActionPacket {
 };
 static_assert(sizeof(ActionPacket) == 368, "ActionPacket must be 368 bytes");
 
+// v2 Action Packet (376 bytes): same actions behind a PacketHeaderV2
+struct ActionPacketV2 {
+    PacketHeaderV2 header;           // 16
+    UnitAction     actions[MAX_UNITS];
+};
+static_assert(sizeof(ActionPacketV2) == 376, "ActionPacketV2 must be 376 bytes");
+
+// ============================================================
+// Compact Action Packet (msg_type = MSG_ACTION_COMPACT, variable length)
+// Sent instead of ActionPacket to clients whose STATE carries
+// STATE_ACTION_ACK; acked_action_tick is the newest ACTION the client
+// has decoded (0 = none). Units whose quantized action equals that
+// ACTION's are left out:
+//   header (+ext)
+//   + uint32_t base_tick    the acked ACTION omitted units repeat (0 = all units follow)
+//   + uint16_t unit_mask    bit i set: unit i follows
+//   + CompactUnitAction[popcount(unit_mask)], ascending unit index
+// Both ends keep the last ACTION_HISTORY decoded action sets; a
+// client drops a compact ACTION whose base it no longer has.
+// ============================================================
+constexpr int   ACTION_HISTORY   = 8;
+constexpr float MOVE_QUANT_SCALE  = 127.0f;    // move_x/y: int8
+constexpr float POINT_QUANT_SCALE = 32767.0f;  // point_x/y: int16
+
+struct CompactUnitAction {
+    int8_t   move_x;            // round(move * 127)
+    int8_t   move_y;
+    int16_t  point_x;           // round(point * 32767)
+    int16_t  point_y;
+    uint8_t  skill;             // discrete heads as in UnitAction
+    uint8_t  unit_target;
+    uint8_t  skill_levelup;
+    uint8_t  stat_upgrade;
+    uint8_t  attribute;
+    uint8_t  item_buy;
+    uint8_t  item_use;
+    uint8_t  seal_use;
+    uint8_t  faire_send;
+    uint8_t  faire_request;
+    uint8_t  faire_respond;
+};
+static_assert(sizeof(CompactUnitAction) == 17, "CompactUnitAction must be 17 bytes");
+
+constexpr size_t COMPACT_ACTION_MAX_BODY =
+    sizeof(uint32_t) + sizeof(uint16_t) + sizeof(CompactUnitAction) * MAX_UNITS;  // 210
+
 // ============================================================
 // Done Packet (16 bytes)
 // ============================================================
+struct DoneBody {
+    uint8_t  winner;        // 0=team0, 1=team1, 2=draw
+    uint8_t  reason;        // 1=team_wipe, 2=timeout, 3=score
+    int16_t  score_team0;
+    int16_t  score_team1;
+    uint8_t  _pad[2];
+};
+static_assert(sizeof(DoneBody) == 8, "DoneBody must be 8 bytes");
+
+// v1 layout; v2 inserts PacketHeaderExt between header and the DoneBody fields
 struct DonePacket {
     PacketHeader header;    // 8
     uint8_t  winner;        // 0=team0, 1=team1, 2=draw
@@ -257,8 +387,63 @@ struct DonePacket {
 };
 static_assert(sizeof(DonePacket) == 16, "DonePacket must be 16 bytes");
 
+// ============================================================
+// DONE-ACK (header only: 8 bytes v1, 16 bytes v2)
+// The DONE's own header with msg_type = MSG_DONE_ACK, sent back for
+// every DONE received (retransmissions included) to the same address
+// as ACTIONs. Clients retransmit DONE until the ACK for its tick (and
+// v2 instance/episode) arrives; the server applies each episode's
+// DONE once and only acknowledges the duplicates.
+// ============================================================
+
+// ============================================================
+// Flow Control (header + 4 bytes, msg_type = MSG_FLOW_CONTROL)
+// Sent by a server running --flow-control to an instance whose STATEs
+// it is not keeping up with (superseded by a newer one before being
+// processed, or queued longer than the target). The client sends at
+// most one STATE per state_interval_ms of wall time; without a refresh
+// within ttl_ms it goes back to one per tick. 0 = one per tick.
+// Same address and header (tick = the STATE it answers) as ACTIONs.
+// ============================================================
+struct FlowControlBody {
+    uint16_t state_interval_ms;
+    uint16_t ttl_ms;
+};
+static_assert(sizeof(FlowControlBody) == 4, "FlowControlBody must be 4 bytes");
+
+// ============================================================
+// Fragment (24-byte header + payload)
+// A datagram longer than the sender's fragment size (link MTU, or
+// more than one UDP packet holds) goes out as MSG_FRAGMENTs. UdpServer
+// reassembles them before the dispatcher sees anything, so the
+// reassembled bytes are an ordinary packet of any type and version.
+// Fragments of one datagram share msg_id (unique per sender socket)
+// and may arrive in any order; incomplete datagrams time out.
+// ============================================================
+struct FragmentHeader {
+    PacketHeader header;    // msg_type = MSG_FRAGMENT, tick = the datagram's tick
+    uint32_t msg_id;
+    uint32_t total_len;     // reassembled datagram length
+    uint32_t offset;        // position of this payload in the datagram
+    uint16_t index;         // 0 .. count-1
+    uint16_t count;
+};
+static_assert(sizeof(FragmentHeader) == 24, "FragmentHeader must be 24 bytes");
+
 #pragma pack(pop)
 
+// ============================================================
+// Helper: header validation / size (v1 or v2)
+// ============================================================
+inline bool is_supported_version(uint8_t version) {
+    return version == PROTO_VERSION || version == PROTO_VERSION_V2;
+}
+
+/// Bytes before the message body: 8 (v1) or 16 (v2).
+inline size_t header_size(const PacketHeader& h) {
+    return h.version == PROTO_VERSION_V2 ? sizeof(PacketHeaderV2) : sizeof(PacketHeader);
+}
+
 // ============================================================
 // Helper: extract mask bit
 // ============================================================
@@ -1,7 +1,6 @@
 #pragma once
 
 #include <array>
-#include <map>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -14,6 +13,7 @@
 #include "state_encoder.h"
 #include "constants.h"
 #include "protocol.h"
+#include "instance_id.h"
 
 class RolloutWriter {
 public:
@@ -21,7 +21,7 @@ public:
 
     /// Store a single transition for one agent in one instance.
     /// FATE v2 extra parameters are optional (default empty/null/0) for backward compatibility.
-    void store(const std::string& instance_id,
+    void store(InstanceId instance_id,
                int agent_idx,
                const torch::Tensor& self_vec,      // (77,)
                const torch::Tensor& ally_vec,       // (5, 37)
@@ -46,11 +46,18 @@ public:
 
     /// Mark last transition as done=true and add terminal rewards.
     /// Must be called BEFORE flush_episode().
-    void mark_last_done(const std::string& instance_id,
+    void mark_last_done(InstanceId instance_id,
                         const std::array<float, MAX_UNITS>& terminal_rewards);
 
     /// Flush all agent buffers for a completed episode.
-    void flush_episode(const std::string& instance_id);
+    void flush_episode(InstanceId instance_id);
+
+    /// Drop an instance's buffered transitions without writing them
+    /// (idle eviction). Returns the bytes released (estimate).
+    size_t discard_episode(InstanceId instance_id);
+
+    /// Bytes held by an instance's buffered transitions (estimate).
+    size_t buffered_bytes(InstanceId instance_id);
 
     /// Dump accumulated transitions to .pt files if buffer exceeds min_transitions.
     void maybe_dump(int min_transitions);
@@ -114,7 +121,7 @@ private:
     };
 
     // instance_id -> per-agent (12) -> list of transitions
-    std::map<std::string, std::array<std::vector<Transition>, MAX_UNITS>> buffers_;
+    std::unordered_map<InstanceId, std::array<std::vector<Transition>, MAX_UNITS>> buffers_;
 
     // Completed episodes ready for dumping (aggregated across agents)
     std::vector<CompletedEpisode> completed_;
@@ -123,6 +130,10 @@ private:
     int dump_count_;
     std::mutex mutex_;
 
+    /// Memory held by one transition (struct + tensor storage).
+    static size_t transition_bytes(const Transition& t);
+    static size_t trajectories_bytes(const std::array<std::vector<Transition>, MAX_UNITS>& agents);
+
     /// Helper: stack a field across agents and timesteps into (T, 12, ...) tensor.
     torch::Tensor stack_field(const CompletedEpisode& ep, int T,
                               std::function<torch::Tensor(const Transition&)> getter,
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// ============================================================
+// Shared-memory transport layout (server <-> co-located clients)
+//
+// One memfd segment holds a ShmSegmentHeader followed by num_slots
+// ShmSlots. Each slot is a pair of single-producer/single-consumer
+// rings carrying the same packets as the UDP protocol:
+//   to_server: STATE / DONE  (client produces, server consumes)
+//   to_client: ACTION        (server produces, client consumes)
+//
+// Clients connect to the server's AF_UNIX socket and receive a
+// ShmHello plus three fds via SCM_RIGHTS:
+//   [0] segment memfd, [1] server doorbell, [2] client doorbell
+// Doorbells are eventfds. A producer only rings one after a commit
+// when the consumer has announced it is about to sleep, so the hot
+// path (both sides polling) makes no syscalls.
+//
+// Records are 8-byte aligned: uint32_t len, uint32_t pad, payload.
+// A record never wraps; a SHM_WRAP length sends the reader back to
+// offset 0. Readers see payloads in place (zero copy) until they
+// release them.
+// ============================================================
+
+constexpr uint32_t SHM_MAGIC       = 0xFA7E5E61;
+constexpr uint32_t SHM_VERSION     = 1;
+constexpr size_t   SHM_RING_BYTES  = 64 * 1024;   // per direction, per slot
+constexpr size_t   SHM_RECORD_HDR  = 8;
+constexpr uint32_t SHM_WRAP        = 0xFFFFFFFF;
+constexpr uint32_t SHM_NO_SLOT     = 0xFFFFFFFF;  // ShmHello.slot when the server is full
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared rings need lock-free atomics");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared rings need lock-free atomics");
+
+struct ShmRing {
+    alignas(64) std::atomic<uint64_t> head;              // bytes published (producer)
+    alignas(64) std::atomic<uint64_t> tail;              // bytes released (consumer)
+    alignas(64) std::atomic<uint32_t> consumer_waiting;  // 1 = ring the doorbell on commit
+    alignas(64) uint8_t data[SHM_RING_BYTES];
+};
+
+struct ShmSlot {
+    ShmRing to_server;
+    ShmRing to_client;
+};
+
+struct alignas(64) ShmSegmentHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_slots;
+    uint32_t ring_bytes;
+};
+
+/// Handshake reply sent with the fds
+struct ShmHello {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot;          // SHM_NO_SLOT if no slot is free
+    uint32_t num_slots;
+    uint64_t segment_size;
+};
+
+inline size_t shm_segment_size(uint32_t num_slots) {
+    return sizeof(ShmSegmentHeader) + static_cast<size_t>(num_slots) * sizeof(ShmSlot);
+}
+
+inline ShmSlot* shm_slot(void* base, uint32_t index) {
+    return reinterpret_cast<ShmSlot*>(static_cast<uint8_t*>(base) + sizeof(ShmSegmentHeader)) + index;
+}
+
+inline size_t shm_record_size(size_t len) {
+    return (SHM_RECORD_HDR + len + 7) & ~static_cast<size_t>(7);
+}
+
+// ============================================================
+// Producer side of one ring (process-local cursor)
+// ============================================================
+class ShmProducer {
+public:
+    ShmProducer() = default;
+    explicit ShmProducer(ShmRing* ring)
+        : ring_(ring), pos_(ring->head.load(std::memory_order_relaxed)) {}
+
+    /// Space for one record of len bytes, or nullptr if the ring is full.
+    /// Nothing is visible to the consumer until commit().
+    uint8_t* reserve(size_t len) {
+        const size_t rec = shm_record_size(len);
+        const size_t idx = pos_ % SHM_RING_BYTES;
+        const size_t contiguous = SHM_RING_BYTES - idx;
+        const size_t skip = rec > contiguous ? contiguous : 0;
+        if (rec > SHM_RING_BYTES) return nullptr;
+
+        uint64_t tail = ring_->tail.load(std::memory_order_acquire);
+        if (pos_ + skip + rec - tail > SHM_RING_BYTES) return nullptr;
+
+        if (skip) {
+            std::memcpy(ring_->data + idx, &SHM_WRAP, sizeof(SHM_WRAP));
+            pos_ += skip;
+        }
+        uint8_t* rec_ptr = ring_->data + pos_ % SHM_RING_BYTES;
+        uint32_t len32 = static_cast<uint32_t>(len);
+        std::memcpy(rec_ptr, &len32, sizeof(len32));
+        pos_ += rec;
+        return rec_ptr + SHM_RECORD_HDR;
+    }
+
+    /// Publish everything reserved so far.
+    /// Returns true if the consumer is asleep and wants a doorbell.
+    bool commit() {
+        ring_->head.store(pos_, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return ring_->consumer_waiting.load(std::memory_order_relaxed) != 0;
+    }
+
+private:
+    ShmRing* ring_ = nullptr;
+    uint64_t pos_ = 0;
+};
+
+// ============================================================
+// Consumer side of one ring (process-local cursor)
+// ============================================================
+class ShmConsumer {
+public:
+    ShmConsumer() = default;
+    explicit ShmConsumer(ShmRing* ring)
+        : ring_(ring), pos_(ring->tail.load(std::memory_order_relaxed)) {}
+
+    /// Next record in place, or nullptr if the ring is empty.
+    /// The payload stays valid until release().
+    const uint8_t* peek(size_t& len) {
+        uint64_t head = ring_->head.load(std::memory_order_acquire);
+        if (pos_ == head) return nullptr;
+
+        size_t idx = pos_ % SHM_RING_BYTES;
+        uint32_t len32;
+        std::memcpy(&len32, ring_->data + idx, sizeof(len32));
+        if (len32 == SHM_WRAP) {
+            pos_ += SHM_RING_BYTES - idx;
+            if (pos_ == head) return nullptr;
+            idx = 0;
+            std::memcpy(&len32, ring_->data, sizeof(len32));
+        }
+        len = len32;
+        const uint8_t* payload = ring_->data + idx + SHM_RECORD_HDR;
+        pos_ += shm_record_size(len32);
+        return payload;
+    }
+
+    /// Hand everything peeked so far back to the producer.
+    void release() {
+        ring_->tail.store(pos_, std::memory_order_release);
+    }
+
+    /// Announce that the consumer is about to sleep on its doorbell.
+    /// Returns true if data arrived meanwhile (do not sleep).
+    bool prepare_wait() {
+        ring_->consumer_waiting.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return ring_->head.load(std::memory_order_acquire) != pos_;
+    }
+
+    void end_wait() {
+        ring_->consumer_waiting.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    ShmRing* ring_ = nullptr;
+    uint64_t pos_ = 0;
+};
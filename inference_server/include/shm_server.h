@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "shm_ring.h"
+#include "udp_server.h"
+
+// ============================================================
+// ShmServer: shared-memory transport for co-located games.
+// Same role as UdpServer (receive STATE/DONE, send ACTION), but
+// over per-client SPSC ring pairs in one memfd segment, handed out
+// through an AF_UNIX handshake socket (layout in shm_ring.h).
+//
+// Received Datagrams point straight into the rings (shm_slot >= 0)
+// and stay valid until the next recv_all(); ACTIONs are written in
+// place by reserve_send() and published by flush_sends().
+//
+// Linux only (memfd, eventfd, SCM_RIGHTS); elsewhere the
+// constructor throws.
+// ============================================================
+class ShmServer {
+public:
+    /// socket_path: AF_UNIX path clients connect to.
+    /// num_slots:   maximum concurrently attached clients.
+    ShmServer(const std::string& socket_path, int num_slots);
+    ~ShmServer();
+
+    // Non-copyable
+    ShmServer(const ShmServer&) = delete;
+    ShmServer& operator=(const ShmServer&) = delete;
+
+    /// Release the previous batch and collect every pending record.
+    const std::vector<Datagram>& recv_all();
+
+    /// Space for one ACTION to the given slot (nullptr if the client's
+    /// ring is full or the slot is detached).
+    uint8_t* reserve_send(int slot, size_t len);
+
+    /// Publish reserved ACTIONs and ring doorbells of sleeping clients.
+    /// Returns the number of records published.
+    size_t flush_sends();
+
+    /// Before blocking: ask clients to ring the doorbell on their next
+    /// commit. Returns true if data is already pending (don't block).
+    bool prepare_wait();
+    void end_wait();
+
+    /// EventLoop readers: handshake socket and server doorbell
+    int listen_fd() const { return listen_fd_; }
+    int doorbell_fd() const { return doorbell_fd_; }
+
+    /// listen_fd readable: attach new clients
+    void accept_clients();
+    /// doorbell_fd readable: clear it (recv_all does the work)
+    void drain_doorbell();
+    /// Detach clients whose handshake connection closed
+    void reap_clients();
+
+    int active_clients() const;
+    uint64_t dropped_sends() const { return dropped_sends_; }
+
+private:
+    struct Client {
+        bool        active = false;
+        int         conn_fd = -1;       // handshake connection (EOF = gone)
+        int         doorbell_fd = -1;   // client's eventfd
+        ShmConsumer in;                 // to_server ring
+        ShmProducer out;                // to_client ring
+        size_t      pending = 0;        // records reserved since the last flush
+    };
+
+    void detach(int slot);
+
+    std::string socket_path_;
+    int num_slots_;
+    int listen_fd_ = -1;
+    int memfd_ = -1;
+    int doorbell_fd_ = -1;
+    void* base_ = nullptr;
+    size_t size_ = 0;
+
+    std::vector<Client> clients_;
+    std::vector<Datagram> received_;
+    uint64_t dropped_sends_ = 0;
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// ============================================================
+// SpscQueue: bounded single-producer/single-consumer queue
+// between two threads of the same process (the in-process
+// counterpart of ShmRing).
+//
+// push/pop are lock-free: the producer owns head, the consumer
+// owns tail, each on its own cache line. A consumer that finds the
+// queue empty can sleep in pop_wait(); like the shm doorbells, the
+// producer only takes the mutex to wake it when it has announced
+// that it is about to sleep, so a busy pipeline makes no syscalls.
+// ============================================================
+template <typename T>
+class SpscQueue {
+public:
+    /// capacity is rounded up to a power of two
+    explicit SpscQueue(size_t capacity) {
+        size_t n = 1;
+        while (n < capacity) n <<= 1;
+        slots_.resize(n);
+        mask_ = n - 1;
+    }
+
+    // Non-copyable
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    size_t capacity() const { return slots_.size(); }
+
+    /// Items currently queued (approximate from a third thread)
+    size_t size() const {
+        return static_cast<size_t>(head_.load(std::memory_order_acquire)
+                                 - tail_.load(std::memory_order_acquire));
+    }
+
+    /// Producer only. False if the queue is full.
+    bool push(T item) {
+        const uint64_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) == slots_.size()) return false;
+        slots_[head & mask_] = std::move(item);
+        head_.store(head + 1, std::memory_order_release);
+
+        // Pairs with the fence in pop_wait: either the consumer sees the
+        // item before sleeping or we see it waiting
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (consumer_waiting_.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cv_.notify_one();
+        }
+        return true;
+    }
+
+    /// Consumer only. False if the queue is empty.
+    bool pop(T& out) {
+        const uint64_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire)) return false;
+        out = std::move(slots_[tail & mask_]);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Consumer only. pop, sleeping up to timeout while the queue is empty.
+    bool pop_wait(T& out, std::chrono::milliseconds timeout) {
+        if (pop(out)) return true;
+        consumer_waiting_.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait_for(lock, timeout, [this]() {
+                return head_.load(std::memory_order_acquire)
+                    != tail_.load(std::memory_order_relaxed);
+            });
+        }
+        consumer_waiting_.store(0, std::memory_order_relaxed);
+        return pop(out);
+    }
+
+    /// Wake a consumer sleeping in pop_wait (shutdown)
+    void notify() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cv_.notify_all();
+    }
+
+private:
+    std::vector<T> slots_;
+    size_t mask_ = 0;
+
+    alignas(64) std::atomic<uint64_t> head_{0};              // items pushed (producer)
+    alignas(64) std::atomic<uint64_t> tail_{0};              // items popped (consumer)
+    alignas(64) std::atomic<uint32_t> consumer_waiting_{0};  // 1 = notify on push
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
@@ -39,12 +39,72 @@ struct MaskSet {
     std::unordered_map<std::string, torch::Tensor> masks;
 };
 
+// ============================================================
+// Visibility grid as packed bits (bit c = cell c). Bit-packed and RLE
+// grids are decoded straight into words; raw byte grids are packed
+// once while parsing.
+// ============================================================
+struct VisGrid {
+    static constexpr int WORDS = (GRID_CELLS + 63) / 64;  // 19
+    uint64_t words[WORDS] = {};
+
+    bool test(int cell) const {
+        return (words[cell >> 6] >> (cell & 63)) & 1;
+    }
+};
+
+// ============================================================
+// Keyframe history for delta STATE reconstruction (one per instance).
+// Every full STATE parsed with a store is recorded; MSG_STATE_DELTA
+// packets are rebuilt on top of the keyframe they name.
+// ============================================================
+struct StateKeyframe {
+    uint32_t tick = 0;
+    bool     valid = false;
+    uint8_t  block[STATE_BLOCK_SIZE];  // GlobalState + UnitState[12], wire layout
+    VisGrid  vis_t0;
+    VisGrid  vis_t1;
+    std::vector<CreepState> creeps;
+};
+
+struct KeyframeStore {
+    std::array<StateKeyframe, KEYFRAME_HISTORY> frames;
+    size_t next = 0;  // ring position of the oldest slot
+
+    const StateKeyframe* find(uint32_t tick) const {
+        for (const auto& f : frames)
+            if (f.valid && f.tick == tick) return &f;
+        return nullptr;
+    }
+
+    /// Oldest slot, reused for a new keyframe (vectors keep their capacity).
+    StateKeyframe& push(uint32_t tick) {
+        StateKeyframe& f = frames[next];
+        next = (next + 1) % frames.size();
+        f.tick = tick;
+        f.valid = true;
+        return f;
+    }
+};
+
+// ============================================================
+// ACTION acknowledgement trailer of a STATE (STATE_ACTION_ACK)
+// ============================================================
+struct ActionAck {
+    bool     compact = false;  // client takes MSG_ACTION_COMPACT
+    uint32_t tick = 0;         // newest ACTION it decoded (0 = none)
+};
+
 // ============================================================
 // State Encoder namespace
 // ============================================================
 namespace state_encoder {
 
     /// Parse a raw binary STATE packet into structured data.
+    /// With a keyframe store, full STATEs are recorded as keyframes and
+    /// MSG_STATE_DELTA packets are reconstructed against them (a delta
+    /// without a store, or whose keyframe is gone, fails).
+    /// action_ack (optional) receives the STATE_ACTION_ACK trailer.
     /// Returns true on success.
     bool parse_packet(const uint8_t* data, size_t len,
                       PacketHeader& header,
@@ -52,17 +112,19 @@ namespace state_encoder {
                       UnitState units[MAX_UNITS],
                       std::vector<Event>& events,
                       std::vector<uint8_t>& pathability,
-                      std::vector<uint8_t>& vis_t0,
-                      std::vector<uint8_t>& vis_t1,
-                      std::vector<CreepState>& creeps);
+                      VisGrid& vis_t0,
+                      VisGrid& vis_t1,
+                      std::vector<CreepState>& creeps,
+                      KeyframeStore* keyframes = nullptr,
+                      ActionAck* action_ack = nullptr);
 
     /// Encode parsed state into per-agent observation tensors (12 perspectives).
     /// Also fills sort_map for enemy distance-sorted action remapping.
     EncodedObs encode(const UnitState units[MAX_UNITS],
                       const GlobalState& global,
                       const std::vector<uint8_t>& pathability,
-                      const std::vector<uint8_t>& vis_t0,
-                      const std::vector<uint8_t>& vis_t1,
+                      const VisGrid& vis_t0,
+                      const VisGrid& vis_t1,
                       const std::vector<CreepState>& creeps);
 
     /// Extract action masks from unit state bit-packed fields.
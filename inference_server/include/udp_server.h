@@ -1,7 +1,10 @@
 #pragma once
 
+#include <chrono>
 #include <cstdint>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <utility>
 
@@ -21,6 +24,8 @@
     #endif
 #else
     #include <sys/socket.h>
+    #include <sys/uio.h>
+    #include <sys/un.h>
     #include <netinet/in.h>
     #include <arpa/inet.h>
     #include <unistd.h>
@@ -32,33 +37,252 @@
 // Maximum UDP datagram we expect (64 KB)
 constexpr size_t MAX_UDP_PACKET = 65536;
 
+// Datagrams pulled per receive syscall (recvmmsg batch / slab size)
+constexpr size_t RECV_BATCH = 32;
+
+// Upper bound on slabs drained by one recv_all() call (RECV_BATCH each).
+// Anything beyond stays in the kernel buffer for the next cycle.
+constexpr size_t MAX_RECV_SLABS = 16;
+
+// Datagrams handed to the kernel per sendmmsg call
+constexpr size_t SEND_BATCH = 64;
+
+// Fragment reassembly (MSG_FRAGMENT, see protocol.h)
+constexpr size_t FRAG_MAX_DATAGRAM = 1 << 20;  // largest reassembled datagram
+constexpr size_t FRAG_MAX_FRAGMENTS = 1024;    // fragments per datagram
+constexpr size_t FRAG_MAX_PENDING = 64;        // datagrams reassembled at once (oldest evicted)
+constexpr int64_t FRAG_TIMEOUT_NS = 500000000; // incomplete datagrams dropped after 500 ms
+
+// ============================================================
+// Endpoint: binary IPv4 address + port (no string formatting).
+// AF_UNIX peers are 127.0.0.1 with a per-socket-path index as port.
+// ============================================================
+struct Endpoint {
+    uint32_t ip   = 0;   // IPv4 address, network byte order
+    uint16_t port = 0;   // host byte order
+
+    /// Packed 64-bit key: (ip << 16) | port
+    uint64_t key() const { return (static_cast<uint64_t>(ip) << 16) | port; }
+
+    /// "a.b.c.d" (logging only)
+    std::string ip_string() const;
+    /// "a.b.c.d:port" (logging only)
+    std::string to_string() const;
+
+    bool operator==(const Endpoint& o) const { return ip == o.ip && port == o.port; }
+    bool operator!=(const Endpoint& o) const { return !(*this == o); }
+};
+
+// ============================================================
+// SockAddr: resolved reply destination (IPv4 address + port, or
+// the path of an AF_UNIX peer socket)
+// ============================================================
+struct SockAddr {
+    struct sockaddr_storage storage{};
+    socklen_t len = 0;
+
+    const struct sockaddr* get() const {
+        return reinterpret_cast<const struct sockaddr*>(&storage);
+    }
+};
+
+// ============================================================
+// Datagram: view of one received packet.
+// data points into UdpServer's slab pool (or a ShmServer ring)
+// and is only valid until the next recv_all() call.
+// ============================================================
+struct Datagram {
+    Endpoint       from;
+    const uint8_t* data;
+    size_t         len;
+    int            shm_slot = -1;   // >= 0: received over shared memory
+    int64_t        rx_ns = 0;       // receive time, realtime_ns() clock (0 = unknown)
+};
+
+/// CLOCK_REALTIME in ns: the clock of kernel receive timestamps
+/// (SO_TIMESTAMPNS), so latencies can be measured against Datagram::rx_ns.
+inline int64_t realtime_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
 class UdpServer {
 public:
     /// listen_port: port to bind and receive STATE packets on.
     /// send_port:   port to send ACTION replies to (on the source address).
-    UdpServer(int listen_port, int send_port);
+    /// reuse_port:  set SO_REUSEPORT so several sockets (shards) can bind
+    ///              the same port (Linux only).
+    UdpServer(int listen_port, int send_port, bool reuse_port = false);
+
+    /// AF_UNIX SOCK_DGRAM socket bound at unix_path (Linux; a stale
+    /// socket file is replaced) with the same recv_all/send semantics.
+    /// Clients bind their own socket (a path, or autobind when in the
+    /// same network namespace) and get replies there.
+    explicit UdpServer(const std::string& unix_path);
     ~UdpServer();
 
     // Non-copyable
     UdpServer(const UdpServer&) = delete;
     UdpServer& operator=(const UdpServer&) = delete;
 
-    /// Non-blocking receive of all pending packets.
-    /// Returns vector of (source_addr_string, raw_data).
-    /// source_addr_string is "ip:port" format (e.g. "127.0.0.1:12345").
-    std::vector<std::pair<std::string, std::vector<uint8_t>>> recv_all();
+    /// Non-blocking receive of all pending packets (up to
+    /// RECV_BATCH * MAX_RECV_SLABS per call).
+    /// Packets are received in batches (recvmmsg on Linux) directly into
+    /// recycled slabs; the returned views stay valid until the next call.
+    /// rx_ns is the kernel receive timestamp on Linux, otherwise the time
+    /// the batch was read.
+    /// MSG_FRAGMENTs are reassembled here: a datagram is returned once all
+    /// its fragments arrived (rx_ns = first fragment). Unfragmented packets
+    /// never touch the reassembly buffers.
+    const std::vector<Datagram>& recv_all();
+
+    /// Resolve the reply address for a source endpoint: source IP with
+    /// send_port_ (the C# plugin listens on a fixed port). Callers cache
+    /// the result per instance so nothing is parsed per packet.
+    /// AF_UNIX: the peer's own socket path.
+    SockAddr reply_addr(const Endpoint& from) const;
+
+    /// Address of the endpoint itself (source IP and source port), used
+    /// for v2 clients that receive replies on their sending socket.
+    /// AF_UNIX: the peer's socket path.
+    SockAddr endpoint_addr(const Endpoint& ep) const;
+
+    /// Reserve len bytes in the send queue for a datagram to dest and
+    /// return a pointer to fill in. The pointer is only valid until the
+    /// next reserve_send()/flush_sends() call.
+    uint8_t* reserve_send(const SockAddr& dest, size_t len);
 
-    /// Send raw data to a specific address.
-    /// addr_str is "ip:port" format or just "ip" (uses send_port_).
-    void send_to(const std::string& addr_str, const uint8_t* data, size_t len);
+    /// Send all queued datagrams (one sendmmsg per SEND_BATCH on Linux,
+    /// plain sendto loop elsewhere). Returns the number sent.
+    size_t flush_sends();
 
-    /// Send raw data to a specific IP (uses send_port_ as port).
-    void send_to_ip(const std::string& ip, const uint8_t* data, size_t len);
+    /// Send raw data immediately (bypasses the queue).
+    void send_to(const SockAddr& dest, const uint8_t* data, size_t len);
+
+    /// Underlying socket (for readiness polling).
+    socket_t fd() const { return sock_; }
+
+    /// Bound to an AF_UNIX path rather than a UDP port.
+    bool is_unix() const { return !unix_path_.empty(); }
+
+    /// AF_UNIX: count one more live instance replying to the peer at addr.
+    /// One socket can carry many instances (v2 games, fate_mock_game --unix).
+    void retain_unix_peer(const SockAddr& addr);
+
+    /// AF_UNIX: drop one instance's hold on the peer at addr (it ended or
+    /// was evicted). When the last one goes, the peer is forgotten and its
+    /// number handed to the next new peer; a datagram from the same socket
+    /// simply registers it again.
+    void release_unix_peer(const SockAddr& addr);
+
+    /// Replace the kernel's 4-tuple SO_REUSEPORT hash (classic BPF) with
+    ///   v2 packets:    (source_ip ^ source_port) % num_shards
+    ///   anything else: source_ip % num_shards
+    /// v1 instances are keyed by IP and may send from changing ports, so a
+    /// v1 host always lands on one shard. v2 games on the same host spread
+    /// over the shards by their sending socket; the limit is that a v2
+    /// client that changes its source port may move to another shard and
+    /// start over there as a new instance. Call once after all num_shards
+    /// sockets are bound. Returns false if unsupported; main then runs one shard.
+    bool attach_reuseport_hash(int num_shards);
+
+    /// Kernel busy polling (SO_BUSY_POLL, Linux): the receive path spins
+    /// on the device queue for up to usec before sleeping. Raising it above
+    /// net.core.busy_read needs CAP_NET_ADMIN. Returns false if rejected.
+    bool set_busy_poll(int usec);
+
+    /// Fragment reassembly counters (receive thread; stats reads are approximate).
+    uint64_t frag_completed() const { return frag_completed_; }
+    uint64_t frag_dropped() const { return frag_dropped_; }
 
 private:
     socket_t sock_;
     int send_port_;
 
+    // AF_UNIX mode: bound path (unlinked on destruction) and the peer
+    // socket addresses seen so far, indexed by Endpoint::port
+    std::string unix_path_;
+    // AF_UNIX peers: index (Endpoint::port) -> address, address hash -> indices
+    std::unordered_multimap<uint64_t, uint16_t> unix_peer_ids_;
+    std::vector<SockAddr> unix_peers_;  // len 0 = free
+    std::vector<uint32_t> unix_refs_;   // live instances per index
+    std::vector<uint16_t> unix_free_;   // released indices, reused last-in first-out
+
+    /// Index of a registered AF_UNIX peer address, or -1.
+    int find_unix_peer(const struct sockaddr_storage& addr, socklen_t len, uint64_t hash) const;
+    bool unix_unbound_warned_ = false;
+
+    // Receive slab pool: each slab holds RECV_BATCH slots of MAX_UDP_PACKET.
+    // Slabs are allocated on first use and reused for the server's lifetime.
+    std::vector<std::unique_ptr<uint8_t[]>> slabs_;
+    std::vector<Datagram> received_;
+
+    // Reassembly slots, created on the first fragment. A completed
+    // datagram is handed out by recv_all() and its slot freed on the next call.
+    struct Reassembly {
+        bool     active = false;
+        bool     delivered = false;
+        Endpoint from;
+        uint32_t msg_id = 0;
+        uint32_t total_len = 0;
+        uint16_t count = 0;
+        uint16_t received = 0;
+        int64_t  first_ns = 0;
+        std::vector<uint8_t> seen;   // per fragment index
+        std::vector<uint8_t> data;   // capacity kept across reuse
+    };
+    std::vector<Reassembly> frags_;
+    size_t frags_active_ = 0;
+
+    // Recently completed datagrams: late or duplicate fragments of these
+    // are ignored for FRAG_TIMEOUT_NS instead of opening a slot that
+    // can never complete. Ring of FRAG_MAX_PENDING, oldest overwritten.
+    struct CompletedFrag {
+        Endpoint from;
+        uint32_t msg_id = 0;
+        int64_t  done_ns = 0;
+    };
+    std::vector<CompletedFrag> frags_done_;
+    size_t frags_done_next_ = 0;
+    uint64_t frag_completed_ = 0;
+    uint64_t frag_dropped_ = 0;    // incomplete datagrams evicted or malformed fragments
+
+    // Send queue: datagram bytes packed into one arena, flushed together
+    struct PendingSend {
+        SockAddr dest;
+        size_t offset;
+        size_t len;
+    };
+    std::vector<uint8_t> send_arena_;
+    std::vector<PendingSend> pending_sends_;
+
+#ifdef __linux__
+    struct mmsghdr     msgs_[RECV_BATCH];
+    struct iovec       iovs_[RECV_BATCH];
+    struct sockaddr_storage from_addrs_[RECV_BATCH];
+    // SCM_TIMESTAMPNS control messages, one per slot
+    alignas(struct cmsghdr) char rx_ctrl_[RECV_BATCH][CMSG_SPACE(sizeof(struct timespec))];
+    bool kernel_timestamps_ = false;
+    struct mmsghdr     send_msgs_[SEND_BATCH];
+    struct iovec       send_iovs_[SEND_BATCH];
+#endif
+
+    /// Receive up to RECV_BATCH datagrams into one slab, appending views
+    /// to received_. Returns number received (0 when the socket is drained).
+    size_t recv_batch(uint8_t* slab);
+
+    /// Queue a received datagram: ordinary packets go straight to
+    /// received_, MSG_FRAGMENTs through add_fragment().
+    void accept(const Datagram& dg);
+    void add_fragment(const Datagram& dg);
+
+    /// Free delivered slots and drop incomplete datagrams past FRAG_TIMEOUT_NS.
+    void expire_fragments();
+
+    /// Source address of a received datagram -> Endpoint (AF_UNIX peers
+    /// get an index; false for unbound peers, which cannot be answered).
+    bool source_endpoint(const struct sockaddr_storage& addr, socklen_t len, Endpoint& ep);
+
     void init_platform();
     void cleanup_platform();
 };
@@ -0,0 +1,96 @@
+#include "cpu_affinity.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// ============================================================
+// CPU list parsing / formatting
+// ============================================================
+
+std::vector<int> parse_cpu_list(const std::string& spec) {
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t end = spec.find(',', pos);
+        if (end == std::string::npos) end = spec.size();
+        const std::string item = spec.substr(pos, end - pos);
+        pos = end + 1;
+        if (item.empty()) continue;
+
+        try {
+            size_t dash = item.find('-');
+            int lo = std::stoi(item.substr(0, dash));
+            int hi = dash == std::string::npos ? lo : std::stoi(item.substr(dash + 1));
+            if (lo < 0 || hi < lo) throw std::invalid_argument(item);
+            for (int c = lo; c <= hi; ++c) cpus.push_back(c);
+        } catch (const std::exception&) {
+            throw std::runtime_error("Bad CPU list '" + spec + "' (expected e.g. 0,2-3)");
+        }
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
+
+std::string cpu_list_string(const std::vector<int>& cpus) {
+    if (cpus.empty()) return "none";
+    std::string s;
+    for (size_t i = 0; i < cpus.size();) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) ++j;
+        if (!s.empty()) s += ",";
+        s += std::to_string(cpus[i]);
+        if (j > i) s += "-" + std::to_string(cpus[j]);
+        i = j + 1;
+    }
+    return s;
+}
+
+// ============================================================
+// Affinity
+// ============================================================
+
+std::vector<int> allowed_cpus() {
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int c = 0; c < CPU_SETSIZE; ++c)
+            if (CPU_ISSET(c, &set)) cpus.push_back(c);
+        return cpus;
+    }
+#endif
+    int n = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    for (int c = 0; c < n; ++c) cpus.push_back(c);
+    return cpus;
+}
+
+bool pin_current_thread(const std::vector<int>& cpus) {
+#ifdef __linux__
+    if (cpus.empty()) return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : cpus)
+        if (c < CPU_SETSIZE) CPU_SET(c, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+std::string cpu_topology(int cpu) {
+    const std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+    std::ifstream core(base + "core_id"), pkg(base + "physical_package_id");
+    int core_id, pkg_id;
+    if (!(core >> core_id) || !(pkg >> pkg_id)) return "";
+    return "core " + std::to_string(core_id) + ", package " + std::to_string(pkg_id);
+}
@@ -0,0 +1,1291 @@
+#include "dispatcher.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+#include "compact_action.h"
+#include "state_encoder.h"
+
+// ============================================================
+// v2 header extension (zeroed for v1 packets)
+// ============================================================
+static PacketHeaderExt read_header_ext(const uint8_t* data, size_t len) {
+    PacketHeaderExt ext{};
+    const PacketHeader* hdr = reinterpret_cast<const PacketHeader*>(data);
+    if (hdr->version == PROTO_VERSION_V2 && len >= sizeof(PacketHeaderV2))
+        std::memcpy(&ext, data + sizeof(PacketHeader), sizeof(ext));
+    return ext;
+}
+
+// ============================================================
+// Build instance key from the datagram source.
+// v1: IP only, since multiple WC3 instances may use different
+//     ephemeral ports (one game per host).
+// v2: IP + client-chosen instance_id (many games per host).
+// shm: the client's slot.
+// AF_UNIX: every peer shares the loopback address, so v1 senders
+//     are told apart by peer number instead (local id = number + 1).
+// ============================================================
+static InstanceId instance_key(const Datagram& dg, const PacketHeaderExt& ext, bool unix_peer) {
+    if (dg.shm_slot >= 0) return make_shm_instance_id(dg.shm_slot);
+    const PacketHeader* hdr = reinterpret_cast<const PacketHeader*>(dg.data);
+    if (unix_peer && hdr->version != PROTO_VERSION_V2)
+        return make_instance_id(ntohl(dg.from.ip), static_cast<uint32_t>(dg.from.port) + 1);
+    return make_instance_id(ntohl(dg.from.ip), ext.instance_id);
+}
+
+static size_t action_packet_size(uint8_t version) {
+    return (version == PROTO_VERSION_V2 ? sizeof(PacketHeaderV2) : sizeof(PacketHeader))
+         + sizeof(UnitAction) * MAX_UNITS;
+}
+
+// ============================================================
+// Policy outputs -> wire actions (continuous heads clamped to [-1, 1],
+// enemy targets remapped from sorted slots to real player offsets).
+// ============================================================
+static void decode_unit_actions(
+    const std::array<InferenceEngine::InferResult, MAX_UNITS>& results,
+    const EnemySortMapping* sort_map,
+    UnitAction actions[MAX_UNITS])
+{
+    std::memset(actions, 0, sizeof(UnitAction) * MAX_UNITS);
+
+    for (int i = 0; i < MAX_UNITS; ++i) {
+        auto& ua = actions[i];
+        ua.idx = static_cast<uint8_t>(i);
+        const auto& r = results[i];
+
+        // Move continuous action -> clamp to [-1, 1]
+        auto move_it = r.actions.find("move");
+        if (move_it != r.actions.end()) {
+            auto mv = move_it->second.cpu().contiguous();
+            float mx = mv.dim() > 1 ? mv[0][0].item<float>() : mv[0].item<float>();
+            float my = mv.dim() > 1 ? mv[0][1].item<float>() : mv[1].item<float>();
+            ua.move_x = std::max(-1.0f, std::min(1.0f, mx));
+            ua.move_y = std::max(-1.0f, std::min(1.0f, my));
+        }
+
+        // Point continuous action
+        auto point_it = r.actions.find("point");
+        if (point_it != r.actions.end()) {
+            auto pt = point_it->second.cpu().contiguous();
+            float px = pt.dim() > 1 ? pt[0][0].item<float>() : pt[0].item<float>();
+            float py = pt.dim() > 1 ? pt[0][1].item<float>() : pt[1].item<float>();
+            ua.point_x = std::max(-1.0f, std::min(1.0f, px));
+            ua.point_y = std::max(-1.0f, std::min(1.0f, py));
+        }
+
+        // Discrete actions
+        auto get_int = [&](const char* name) -> uint8_t {
+            auto it = r.actions.find(name);
+            if (it != r.actions.end())
+                return static_cast<uint8_t>(it->second.item<int64_t>());
+            return 0;
+        };
+
+        ua.skill          = get_int("skill");
+        ua.unit_target    = get_int("unit_target");
+
+        // Remap enemy target from sorted slot to real player offset
+        // unit_target layout: 0-5=allies, 6-7=special(no_target,attack_point), 8-13=enemies
+        if (sort_map && ua.unit_target >= 8 && ua.unit_target <= 13) {
+            int sorted_slot = ua.unit_target - 8;
+            int real_offset = sort_map->sorted_to_real[i][sorted_slot];
+            ua.unit_target = static_cast<uint8_t>(8 + real_offset);
+        }
+
+        ua.skill_levelup  = get_int("skill_levelup");
+        ua.stat_upgrade   = get_int("stat_upgrade");
+        ua.attribute      = get_int("attribute");
+        ua.item_buy       = get_int("item_buy");
+        ua.item_use       = get_int("item_use");
+        ua.seal_use       = get_int("seal_use");
+        ua.faire_send     = get_int("faire_send");
+        ua.faire_request  = get_int("faire_request");
+        ua.faire_respond  = get_int("faire_respond");
+    }
+}
+
+// ============================================================
+// Build ACTION packets in place (UDP send queue or shm ring,
+// flushed once per loop iteration).
+// Replies use the requesting packet's protocol version (v2 echoes
+// the instance/episode ids so the client can verify the routing).
+// ============================================================
+static size_t write_reply_header(uint8_t* buf, uint8_t version, uint8_t msg_type,
+                                  const PacketHeaderExt& ext, uint32_t tick) {
+    PacketHeader hdr;
+    hdr.magic = MAGIC;
+    hdr.version = version;
+    hdr.msg_type = msg_type;
+    hdr.tick = tick;
+    std::memcpy(buf, &hdr, sizeof(hdr));
+    if (version == PROTO_VERSION_V2)
+        std::memcpy(buf + sizeof(PacketHeader), &ext, sizeof(ext));
+    return header_size(hdr);
+}
+
+static void write_action_packet(uint8_t* buf, uint8_t version, const PacketHeaderExt& ext,
+                                uint32_t tick, const UnitAction actions[MAX_UNITS]) {
+    size_t hdr_size = write_reply_header(buf, version, MSG_ACTION, ext, tick);
+    std::memcpy(buf + hdr_size, actions, sizeof(UnitAction) * MAX_UNITS);
+}
+
+// ============================================================
+// Flow control tuning (MSG_FLOW_CONTROL)
+// ============================================================
+constexpr auto FLOW_WINDOW  = std::chrono::seconds(1);   // measurement window per instance
+constexpr auto FLOW_REFRESH = std::chrono::seconds(3);   // resend a non-zero interval
+constexpr uint16_t FLOW_TTL_MS          = 10000;         // client falls back to every tick
+constexpr uint16_t FLOW_MIN_INTERVAL_MS = 5;             // smaller intervals become 0
+constexpr uint16_t FLOW_MAX_INTERVAL_MS = 1000;
+
+// ============================================================
+// Stage timing helper: no clock reads unless timings are enabled
+// ============================================================
+namespace {
+class StageClock {
+public:
+    explicit StageClock(StageTimings* timings) : timings_(timings) { restart(); }
+
+    void restart() {
+        if (timings_) last_ = std::chrono::steady_clock::now();
+    }
+
+    /// Record the time since the last lap/restart under stage.
+    void lap(PipelineStage stage) {
+        if (!timings_) return;
+        auto now = std::chrono::steady_clock::now();
+        timings_->us[stage].push_back(
+            std::chrono::duration<float, std::micro>(now - last_).count());
+        last_ = now;
+    }
+
+private:
+    StageTimings* timings_;
+    std::chrono::steady_clock::time_point last_;
+};
+
+// Memory held by an instance's state (keyframe creep lists included)
+size_t instance_bytes(const InstanceState& inst) {
+    size_t bytes = sizeof(InstanceState);
+    for (const auto& f : inst.keyframes.frames) bytes += f.creeps.capacity() * sizeof(CreepState);
+    return bytes;
+}
+
+uint64_t ns_since(std::chrono::steady_clock::time_point start) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count());
+}
+}  // namespace
+
+// ============================================================
+// Constructor
+// ============================================================
+
+Dispatcher::Dispatcher(int shard_id,
+                       UdpServer* server,
+                       InferenceEngine& engine,
+                       RolloutWriter& writer,
+                       torch::Device device,
+                       ShmServer* shm,
+                       PacketCapture* capture)
+    : shard_id_(shard_id), server_(server), engine_(engine),
+      writer_(writer), device_(device), shm_(shm), capture_(capture)
+{
+}
+
+Dispatcher::~Dispatcher() {
+    if (!pipelined()) return;
+    pipe_stop_ = true;
+    to_infer_->notify();
+    to_rollout_->notify();
+    if (infer_thread_.joinable()) infer_thread_.join();
+    if (rollout_thread_.joinable()) rollout_thread_.join();
+#ifdef __linux__
+    if (reply_efd_ >= 0) close(reply_efd_);
+#endif
+}
+
+// ============================================================
+// start_pipeline: INFER and ROLLOUT stage threads
+// ============================================================
+
+void Dispatcher::start_pipeline(int depth) {
+#ifdef __linux__
+    if (pipelined() || depth <= 0) return;
+    if (!server_) {
+        throw std::runtime_error("Dispatcher::start_pipeline needs a UdpServer");
+    }
+    reply_efd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reply_efd_ < 0) {
+        throw std::runtime_error("eventfd failed: " + std::to_string(errno));
+    }
+
+    const size_t n = static_cast<size_t>(depth);
+    to_infer_   = std::make_unique<SpscQueue<StageBatch*>>(n);
+    to_reply_   = std::make_unique<SpscQueue<StageBatch*>>(n);
+    to_rollout_ = std::make_unique<SpscQueue<StageBatch*>>(n);
+    to_free_    = std::make_unique<SpscQueue<StageBatch*>>(n);
+    for (size_t i = 0; i < n; ++i) {
+        batch_pool_.push_back(std::make_unique<StageBatch>());
+        to_free_->push(batch_pool_.back().get());
+    }
+
+    infer_thread_ = std::thread([this]() {
+        stage_thread(PIPE_INFER, *to_infer_, *to_reply_);
+    });
+    rollout_thread_ = std::thread([this]() {
+        stage_thread(PIPE_ROLLOUT, *to_rollout_, *to_free_);
+    });
+    std::cout << "[main] Shard " << shard_id_ << ": pipelined, "
+              << depth << " batches in flight" << std::endl;
+#else
+    (void)depth;
+    throw std::runtime_error("Dispatcher::start_pipeline requires Linux");
+#endif
+}
+
+// INFER / ROLLOUT thread: pop a batch, run the stage, hand it on
+void Dispatcher::stage_thread(PipeStage stage, SpscQueue<StageBatch*>& in,
+                              SpscQueue<StageBatch*>& out) {
+    PipeStageCounters& counters = pipe_stages[stage];
+    while (!pipe_stop_) {
+        StageBatch* batch = nullptr;
+        if (!in.pop_wait(batch, std::chrono::milliseconds(100))) continue;
+        counters.queue_depth += in.size() + 1;
+
+        const auto start = std::chrono::steady_clock::now();
+        if (stage == PIPE_INFER) {
+            infer_stage(*batch);
+        } else {
+            rollout_stage(*batch);
+        }
+        counters.busy_ns += ns_since(start);
+        ++counters.batches;
+
+        out.push(batch);
+#ifdef __linux__
+        if (stage == PIPE_INFER) {
+            const uint64_t one = 1;
+            if (write(reply_efd_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+                std::cerr << "[main] reply eventfd write error: " << errno << std::endl;
+            }
+        }
+#endif
+    }
+}
+
+// ============================================================
+// Reply buffers and flow control
+// ============================================================
+
+uint8_t* Dispatcher::reserve_reply(const InstanceState& inst, size_t len) {
+    if (inst.shm_slot >= 0 && shm_) return shm_->reserve_send(inst.shm_slot, len);
+    if (server_) return server_->reserve_send(inst.reply_addr, len);
+    action_scratch_.resize(len);  // offline: build and discard
+    return action_scratch_.data();
+}
+
+void Dispatcher::set_reply_addr(InstanceState& inst, const SockAddr& addr) {
+    if (inst.has_reply_addr && inst.reply_addr.len == addr.len
+        && std::memcmp(&inst.reply_addr.storage, &addr.storage, addr.len) == 0) return;
+    server_->retain_unix_peer(addr);
+    if (inst.has_reply_addr) ended_peers_.push_back(inst.reply_addr);
+    inst.reply_addr = addr;
+    inst.has_reply_addr = true;
+}
+
+void Dispatcher::reset_instance(InstanceState& inst) {
+    const SockAddr reply_addr = inst.reply_addr;
+    const bool has_reply_addr = inst.has_reply_addr;
+    inst = InstanceState{};
+    inst.reply_addr = reply_addr;
+    inst.has_reply_addr = has_reply_addr;
+}
+
+void Dispatcher::update_flow_control(InstanceState& inst, uint8_t version,
+                                     const PacketHeaderExt& ext, uint32_t tick,
+                                     uint32_t superseded, int64_t queue_ns) {
+    inst.flow_received += 1 + superseded;
+    ++inst.flow_processed;
+    if (queue_ns >= 0) {
+        inst.flow_queue_ns += queue_ns;
+        ++inst.flow_queue_samples;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    const auto elapsed = now - inst.flow_window_start;
+    if (elapsed < FLOW_WINDOW) return;
+
+    // Overloaded: STATEs superseded before we got to them, or waiting
+    // longer than the target. Ask for a little more than the interval
+    // this instance was actually served at, and back off gradually
+    // once the queue has drained.
+    const int64_t elapsed_ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+    const double queue_ms = inst.flow_queue_samples
+        ? inst.flow_queue_ns / 1e6 / inst.flow_queue_samples : 0.0;
+    const bool overloaded = inst.flow_received > inst.flow_processed
+                         || queue_ms > flow_target_ms_;
+
+    const uint16_t cur = inst.state_interval_ms;
+    int64_t next = cur;
+    if (overloaded) {
+        int64_t served = elapsed_ms / inst.flow_processed;
+        next = std::max<int64_t>(served + served / 4, cur + cur / 4 + FLOW_MIN_INTERVAL_MS);
+        next = std::min<int64_t>(next, FLOW_MAX_INTERVAL_MS);
+    } else if (cur > 0 && queue_ms < flow_target_ms_ / 2.0) {
+        next = cur * 3 / 4;
+        if (next < FLOW_MIN_INTERVAL_MS) next = 0;
+    }
+
+    inst.flow_window_start = now;
+    inst.flow_received = inst.flow_processed = inst.flow_queue_samples = 0;
+    inst.flow_queue_ns = 0;
+
+    if (next == cur && (cur == 0 || now - inst.flow_sent < FLOW_REFRESH)) return;
+    inst.state_interval_ms = static_cast<uint16_t>(next);
+
+    const size_t len = (version == PROTO_VERSION_V2 ? sizeof(PacketHeaderV2) : sizeof(PacketHeader))
+                     + sizeof(FlowControlBody);
+    uint8_t* buf = reserve_reply(inst, len);
+    if (!buf) return;
+    size_t hdr_size = write_reply_header(buf, version, MSG_FLOW_CONTROL, ext, tick);
+    FlowControlBody body{inst.state_interval_ms, FLOW_TTL_MS};
+    std::memcpy(buf + hdr_size, &body, sizeof(body));
+    inst.flow_sent = now;
+    ++total_flow_updates;
+}
+
+void Dispatcher::send_action(InstanceState& inst, uint8_t version, const PacketHeaderExt& ext,
+                             uint32_t tick, const UnitAction actions[MAX_UNITS]) {
+    // Compact clients get only the units that changed since the ACTION
+    // they acknowledged
+    CompactActionSet compact;
+    uint8_t compact_body[COMPACT_ACTION_MAX_BODY];
+    size_t pkt_size = action_packet_size(version);
+    size_t body_size = 0;
+    if (inst.compact_actions) {
+        for (int i = 0; i < MAX_UNITS; ++i) compact[i] = compact_unit_action(actions[i]);
+        body_size = write_compact_action_body(
+            compact_body, compact, inst.sent_actions.find(inst.acked_action_tick));
+        pkt_size = (version == PROTO_VERSION_V2 ? sizeof(PacketHeaderV2) : sizeof(PacketHeader))
+                 + body_size;
+    }
+
+    uint8_t* buf = reserve_reply(inst, pkt_size);
+    if (buf && inst.compact_actions) {
+        size_t hdr_size = write_reply_header(buf, version, MSG_ACTION_COMPACT, ext, tick);
+        std::memcpy(buf + hdr_size, compact_body, body_size);
+        inst.sent_actions.push(tick, compact);
+        ++total_compact_actions;
+        total_compact_bytes += body_size;
+    } else if (buf) {
+        write_action_packet(buf, version, ext, tick, actions);
+    }
+
+    if (actions != inst.last_actions)
+        std::memcpy(inst.last_actions, actions, sizeof(UnitAction) * MAX_UNITS);
+    inst.has_last_action = true;
+}
+
+bool Dispatcher::hold_last_action(InstanceId inst_id, const PacketHeader& hdr,
+                                  const PacketHeaderExt& ext, uint32_t superseded) {
+    auto it = instances_.find(inst_id);
+    if (it == instances_.end()) return false;
+    InstanceState& inst = it->second;
+
+    // A new episode (or a tick reset) needs a real inference
+    if (!inst.has_last_action || ext.episode_id != inst.episode_id || hdr.tick < inst.last_tick)
+        return false;
+
+    send_action(inst, hdr.version, ext, hdr.tick, inst.last_actions);
+    inst.last_recv_time = std::chrono::steady_clock::now();
+    inst.flow_received += 1 + superseded;  // received, not processed: flow control backs off
+    ++total_deadline_misses;
+    deadline_missed_.push_back(inst_id);
+    return true;
+}
+
+// ============================================================
+// run: receive loop for this shard
+// ============================================================
+
+void Dispatcher::run(EventLoop& loop, int busy_poll_us) {
+    static const std::vector<Datagram> no_packets;
+    if (!server_) {
+        throw std::runtime_error("Dispatcher::run needs a UdpServer");
+    }
+    if (idle_timeout_.count() > 0) {
+        loop.add_timer(std::chrono::seconds(1), [this]() { evict_idle(); });
+    }
+    if (pipelined()) {
+        run_pipelined(loop, busy_poll_us);
+        return;
+    }
+
+    while (true) {
+        // 1. Receive all pending packets (socket + shm rings)
+        const auto& packets = server_->recv_all();
+        const auto& shm_packets = shm_ ? shm_->recv_all() : no_packets;
+        auto idle = [&]() { return packets.empty() && shm_packets.empty(); };
+
+        if (idle() && busy_poll_us > 0) {
+            // Latency option: spin on the socket briefly before blocking
+            auto spin_until = std::chrono::steady_clock::now()
+                            + std::chrono::microseconds(busy_poll_us);
+            while (std::chrono::steady_clock::now() < spin_until) {
+                server_->recv_all();
+                if (shm_) shm_->recv_all();
+                if (!idle()) break;
+            }
+        }
+
+        if (idle()) {
+            // No data: block until the socket is readable, a shm client
+            // rings the doorbell or a timer fires
+            if (shm_ && shm_->prepare_wait()) {
+                shm_->end_wait();
+                continue;
+            }
+            loop.wait();
+            if (shm_) shm_->end_wait();
+            continue;
+        }
+
+        if (!packets.empty()) process(packets);
+        if (!shm_packets.empty()) process(shm_packets);
+
+        // Run any due timers without blocking (keeps periodic tasks alive
+        // while packets arrive continuously)
+        loop.wait(std::chrono::milliseconds(0));
+    }
+}
+
+// ============================================================
+// run_pipelined: the NET stage. Encoded batches go to the INFER
+// thread; finished ones come back for their ACTIONs and move on to
+// ROLLOUT, which returns them to the free pool.
+// ============================================================
+
+void Dispatcher::run_pipelined(EventLoop& loop, int busy_poll_us) {
+    static const std::vector<Datagram> no_packets;
+#ifdef __linux__
+    loop.add_reader(reply_efd_, [fd = reply_efd_]() {
+        uint64_t n;
+        while (read(fd, &n, sizeof(n)) > 0) {}
+    });
+#endif
+    PipeStageCounters& counters = pipe_stages[PIPE_NET];
+    StageBatch* batch = nullptr;
+
+    while (true) {
+        // ACTIONs out as soon as their inference is done
+        drain_replies();
+
+        // Every batch in flight: the socket waits until one comes back
+        if (!batch && !to_free_->pop_wait(batch, std::chrono::milliseconds(1))) continue;
+
+        // Idle evictions go through the stages like a batch of their own
+        if (!evicted_.empty()) {
+            batch->clear();
+            std::swap(*batch, evicted_);
+            to_infer_->push(batch);
+            batch = nullptr;
+            continue;
+        }
+
+        const auto& packets = server_->recv_all();
+        const auto& shm_packets = shm_ ? shm_->recv_all() : no_packets;
+        auto idle = [&]() { return packets.empty() && shm_packets.empty(); };
+
+        if (idle() && busy_poll_us > 0) {
+            auto spin_until = std::chrono::steady_clock::now()
+                            + std::chrono::microseconds(busy_poll_us);
+            while (std::chrono::steady_clock::now() < spin_until) {
+                server_->recv_all();
+                if (shm_) shm_->recv_all();
+                if (!idle() || to_reply_->size()) break;
+            }
+        }
+
+        if (idle()) {
+            if (to_reply_->size()) continue;
+            if (shm_ && shm_->prepare_wait()) {
+                shm_->end_wait();
+                continue;
+            }
+            loop.wait();  // socket, shm doorbell, reply eventfd or a timer
+            if (shm_) shm_->end_wait();
+            continue;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        batch->clear();
+        if (!packets.empty()) encode_stage(packets, *batch);
+        if (!shm_packets.empty()) encode_stage(shm_packets, *batch);
+
+        // DONE-ACKs now, the ACTIONs once inferred
+        server_->flush_sends();
+        if (shm_) shm_->flush_sends();
+        counters.busy_ns += ns_since(start);
+
+        if (!batch->empty()) {
+            to_infer_->push(batch);
+            batch = nullptr;
+        }
+
+        loop.wait(std::chrono::milliseconds(0));
+    }
+}
+
+void Dispatcher::drain_replies() {
+    PipeStageCounters& counters = pipe_stages[PIPE_NET];
+    StageBatch* batch = nullptr;
+    while (to_reply_->pop(batch)) {
+        counters.queue_depth += to_reply_->size() + 1;
+        const auto start = std::chrono::steady_clock::now();
+        reply_stage(*batch);
+        counters.busy_ns += ns_since(start);
+        ++counters.batches;
+        to_rollout_->push(batch);
+    }
+}
+
+// ============================================================
+// evict_idle: release instances that stopped sending (crashed
+// clients never send a DONE). The rollout and LSTM state go
+// through the stages in order, after any step still in flight.
+// ============================================================
+
+void Dispatcher::evict_idle() {
+    const auto now = std::chrono::steady_clock::now();
+    const auto cutoff = now - idle_timeout_;
+
+    for (auto it = instances_.begin(); it != instances_.end();) {
+        if (it->second.last_recv_time > cutoff) {
+            ++it;
+            continue;
+        }
+        std::cout << "[main] Evicting idle instance " << instance_id_str(it->first)
+                  << " (" << std::chrono::duration_cast<std::chrono::seconds>(
+                         now - it->second.last_recv_time).count()
+                  << "s without packets, tick=" << it->second.last_tick << ", "
+                  << (idle_discard_ ? "discarding" : "flushing") << " partial episode)"
+                  << std::endl;
+        total_reclaimed_bytes += instance_bytes(it->second);
+        evicted_.episode_ends.push_back({it->first, {}, idle_discard_, true});
+        evicted_.evicted.push_back(it->first);
+        if (server_ && it->second.has_reply_addr) server_->release_unix_peer(it->second.reply_addr);
+        it = instances_.erase(it);
+        ++total_evicted;
+    }
+
+    // DONE records only matter while the client may still retransmit
+    for (auto it = last_done_.begin(); it != last_done_.end();) {
+        if (it->second.at <= cutoff) it = last_done_.erase(it);
+        else ++it;
+    }
+
+    if (evicted_.empty()) return;
+    active_instances = instances_.size();
+    if (!pipelined()) {
+        infer_stage(evicted_);
+        rollout_stage(evicted_);
+        evicted_.clear();
+    }
+}
+
+// ============================================================
+// take_latency: hand the current window to the stats timer
+// ============================================================
+
+void Dispatcher::take_latency(std::unordered_map<InstanceId, InstanceLatency>& out) {
+    std::unordered_map<InstanceId, InstanceLatency> window;
+    {
+        std::lock_guard<std::mutex> lock(latency_mutex_);
+        window.swap(latency_);
+    }
+    for (auto& [inst_id, lat] : window) {
+        InstanceLatency& o = out[inst_id];
+        o.queue.merge(lat.queue);
+        o.process.merge(lat.process);
+        o.to_action.merge(lat.to_action);
+        o.superseded += lat.superseded;
+        o.deadline_misses += lat.deadline_misses;
+    }
+}
+
+// ============================================================
+// process: Phase 1-3 for one received batch, every stage in turn
+// ============================================================
+
+void Dispatcher::process(const std::vector<Datagram>& packets) {
+    batch_.clear();
+    encode_stage(packets, batch_);
+    infer_stage(batch_);
+    reply_stage(batch_);
+    rollout_stage(batch_);
+}
+
+// ============================================================
+// encode_stage: Phases 1, 2 and 3a
+// ============================================================
+
+void Dispatcher::encode_stage(const std::vector<Datagram>& packets, StageBatch& batch) {
+    // Raw capture first: every datagram as received, before any filtering
+    if (capture_) capture_->record(packets);
+
+    // ============================================================
+    // Phase 1: Classify packets — keep DONE + latest STATE per instance
+    // This prevents buffer overflow from dropping critical DONE packets.
+    // With 3 WC3 containers sending ~100 STATE/s each, processing
+    // every STATE is impossible (~12ms per inference × 300 pkt/s; measure
+    // the actual saturation point with fate_loadgen --ramp).
+    // Instead, only process the LATEST STATE per instance per cycle.
+    // ============================================================
+    struct ClassifiedPacket {
+        Endpoint from;
+        InstanceId inst_id;
+        const uint8_t* data;
+        size_t size;
+        uint8_t msg_type;
+        uint32_t tick;
+        uint8_t version;
+        uint32_t episode_id;  // v2 only (0 for v1)
+        int shm_slot;
+    };
+
+    struct LatestState {
+        size_t idx;             // index into packets
+        uint32_t superseded;    // older STATEs of this instance in the batch
+    };
+
+    std::vector<ClassifiedPacket> done_packets;
+    // inst_id → latest STATE per instance
+    std::unordered_map<InstanceId, LatestState> latest_state;
+    uint64_t skipped_this_cycle = 0;
+    const bool unix_peers = server_ && server_->is_unix();
+
+    for (size_t pi = 0; pi < packets.size(); ++pi) {
+        const Datagram& dg = packets[pi];
+        if (dg.len < sizeof(PacketHeader)) continue;
+
+        const PacketHeader* hdr = reinterpret_cast<const PacketHeader*>(dg.data);
+        if (hdr->magic != MAGIC || !is_supported_version(hdr->version)) continue;
+        if (dg.len < header_size(*hdr)) continue;
+
+        PacketHeaderExt ext = read_header_ext(dg.data, dg.len);
+        InstanceId inst_id = instance_key(dg, ext, unix_peers);
+
+        if (hdr->msg_type == MSG_DONE) {
+            done_packets.push_back({dg.from, inst_id, dg.data, dg.len,
+                                    hdr->msg_type, hdr->tick,
+                                    hdr->version, ext.episode_id, dg.shm_slot});
+        } else if (hdr->msg_type == MSG_STATE || hdr->msg_type == MSG_STATE_DELTA) {
+            auto it = latest_state.find(inst_id);
+            if (it != latest_state.end()) {
+                // Already have a STATE for this instance — keep the newer one
+                // (a different v2 episode id means a newer episode: take it)
+                auto& prev = packets[it->second.idx];
+                const PacketHeader* prev_hdr = reinterpret_cast<const PacketHeader*>(prev.data);
+                PacketHeaderExt prev_ext = read_header_ext(prev.data, prev.len);
+                if (ext.episode_id != prev_ext.episode_id || hdr->tick >= prev_hdr->tick) {
+                    it->second.idx = pi;  // replace with newer
+                }
+                ++it->second.superseded;
+                ++skipped_this_cycle;
+            } else {
+                latest_state[inst_id] = {pi, 0};
+            }
+        }
+    }
+    total_skipped += skipped_this_cycle;
+
+    // ============================================================
+    // Phase 2: Process DONE packets first (critical, never skip)
+    // Every DONE is acknowledged; clients retransmit until they see
+    // the ACK, so only the first copy per episode is applied.
+    // ============================================================
+    for (auto& dp : done_packets) {
+        const size_t hdr_size = (dp.version == PROTO_VERSION_V2)
+                              ? sizeof(PacketHeaderV2) : sizeof(PacketHeader);
+        if (dp.size < hdr_size + sizeof(DoneBody)) continue;
+        const DoneBody* done = reinterpret_cast<const DoneBody*>(dp.data + hdr_size);
+
+        // DONE-ACK: the DONE's header with msg_type swapped, flushed with the ACTIONs
+        uint8_t* ack = nullptr;
+        if (dp.shm_slot >= 0) {
+            if (shm_) ack = shm_->reserve_send(dp.shm_slot, hdr_size);
+        } else if (server_) {
+            ack = server_->reserve_send(dp.version == PROTO_VERSION_V2
+                                            ? server_->endpoint_addr(dp.from)
+                                            : server_->reply_addr(dp.from),
+                                        hdr_size);
+        }
+        if (ack) {
+            std::memcpy(ack, dp.data, hdr_size);
+            ack[offsetof(PacketHeader, msg_type)] = MSG_DONE_ACK;
+        }
+
+        auto ld = last_done_.find(dp.inst_id);
+        if (ld != last_done_.end() && ld->second.episode_id == dp.episode_id
+            && ld->second.tick == dp.tick) {
+            ++total_duplicate_dones;
+            continue;
+        }
+
+        std::cout << "[main] DONE from " << instance_id_str(dp.inst_id)
+                  << " winner=" << (int)done->winner
+                  << " reason=" << (int)done->reason
+                  << " score=" << done->score_team0 << "-" << done->score_team1
+                  << " tick=" << dp.tick
+                  << std::endl;
+
+        // Compute terminal rewards (v2: only for the episode being played,
+        // a DONE for an earlier episode id is stale; v1: a DONE older than
+        // the latest STATE belongs to an episode already reset)
+        auto it = instances_.find(dp.inst_id);
+        if (it != instances_.end() && it->second.episode_id == dp.episode_id
+            && dp.tick >= it->second.last_tick) {
+            auto terminal_r = it->second.reward_calc.compute_terminal(
+                done->winner, done->reason);
+
+            batch.episode_ends.push_back({dp.inst_id, terminal_r});
+            batch.forget.push_back(dp.inst_id);
+            if (it->second.has_reply_addr) ended_peers_.push_back(it->second.reply_addr);
+            instances_.erase(it);
+            ++total_dones;
+        }
+        last_done_[dp.inst_id] = {dp.episode_id, dp.tick, std::chrono::steady_clock::now()};
+
+        // Remove from latest_state if present (don't process STATE after DONE,
+        // unless it already belongs to the next episode)
+        auto ls = latest_state.find(dp.inst_id);
+        if (ls != latest_state.end()) {
+            const Datagram& sp = packets[ls->second.idx];
+            const PacketHeader* sp_hdr = reinterpret_cast<const PacketHeader*>(sp.data);
+            if (read_header_ext(sp.data, sp.len).episode_id == dp.episode_id
+                && sp_hdr->tick <= dp.tick)
+                latest_state.erase(ls);
+        }
+    }
+
+    // ============================================================
+    // Phase 3a: Parse and encode the latest STATE per instance
+    // ============================================================
+    // Earliest deadline first: every STATE has the same budget, so the
+    // oldest goes first (receive order when the kernel timestamp is unknown)
+    std::vector<std::pair<InstanceId, LatestState>> pending(latest_state.begin(),
+                                                            latest_state.end());
+    std::sort(pending.begin(), pending.end(), [&](const auto& a, const auto& b) {
+        const int64_t ra = packets[a.second.idx].rx_ns;
+        const int64_t rb = packets[b.second.idx].rx_ns;
+        return ra != rb ? ra < rb : a.second.idx < b.second.idx;
+    });
+
+    auto& steps = batch.steps;
+    steps.reserve(steps.size() + pending.size());
+    deadline_missed_.clear();
+    for (auto& [inst_id, latest] : pending) {
+        const Datagram& dg = packets[latest.idx];
+        const int64_t start_ns = realtime_ns();
+
+        const PacketHeader* raw_hdr = reinterpret_cast<const PacketHeader*>(dg.data);
+        PacketHeaderExt ext = read_header_ext(dg.data, dg.len);
+
+        // Deadline: would this STATE's ACTION, queued behind the steps
+        // already taken, miss the budget? Then shed it and hold the last
+        // ACTION. The first step of a batch is always served, which keeps
+        // the cost estimate current. The client takes an ACTION for a full
+        // STATE's tick as the ack of that keyframe, so a late full STATE is
+        // still parsed (storing the keyframe) and shed after that.
+        const bool late = deadline_ns_ > 0 && dg.rx_ns && !steps.empty()
+            && start_ns + static_cast<int64_t>(step_cost_ns_ * (steps.size() + 1))
+                   > dg.rx_ns + deadline_ns_;
+        if (late && raw_hdr->msg_type == MSG_STATE_DELTA
+            && hold_last_action(inst_id, *raw_hdr, ext, latest.superseded)) {
+            continue;
+        }
+
+        // Get or create instance state. Episode resets happen before
+        // parsing so a new episode never decodes against old keyframes.
+        auto& inst = instances_[inst_id];
+        const bool is_new = inst.last_tick == 0;
+        if (inst.last_tick > 0 && ext.episode_id != inst.episode_id) {
+            // v2: client started a new episode without a DONE reaching us
+            std::cout << "[main] Episode change: " << instance_id_str(inst_id)
+                      << " old_episode=" << inst.episode_id
+                      << " new_episode=" << ext.episode_id << std::endl;
+            batch.episode_ends.push_back({inst_id, {}});
+            reset_instance(inst);
+        } else if (inst.last_tick > 0 && raw_hdr->tick < inst.last_tick) {
+            // Tick went backwards → new episode from same IP
+            std::cout << "[main] Tick reset: " << instance_id_str(inst_id)
+                      << " old_tick=" << inst.last_tick
+                      << " new_tick=" << raw_hdr->tick << std::endl;
+            batch.episode_ends.push_back({inst_id, {}});
+            reset_instance(inst);
+        }
+
+        // Parse binary state (delta STATEs rebuilt from the instance's keyframes)
+        steps.emplace_back();
+        PendingStep& step = steps.back();
+        PacketHeader& header = step.header;
+        std::vector<uint8_t> pathability;
+        VisGrid vis_t0, vis_t1;
+        std::vector<CreepState> creeps;
+        ActionAck action_ack;
+
+        StageClock stage_clock(timings_);
+        if (!state_encoder::parse_packet(dg.data, dg.len,
+                                         header, step.global, step.units,
+                                         step.events, pathability, vis_t0, vis_t1,
+                                         creeps, &inst.keyframes, &action_ack)) {
+            std::cerr << "[main] Failed to parse STATE from " << dg.from.to_string() << std::endl;
+            steps.pop_back();
+            if (inst.last_tick == 0) {
+                if (inst.has_reply_addr) ended_peers_.push_back(inst.reply_addr);
+                instances_.erase(inst_id);
+            }
+            continue;
+        }
+
+        stage_clock.lap(STAGE_PARSE);
+        if (late && header.msg_type == MSG_STATE
+            && hold_last_action(inst_id, header, ext, latest.superseded)) {
+            steps.pop_back();   // keyframe stored: no encode or inference
+            continue;
+        }
+        ++total_packets;
+
+        if (is_new && header.tick > 0) {
+            std::cout << "[main] New instance: " << instance_id_str(inst_id)
+                      << " tick=" << header.tick << std::endl;
+        }
+        inst.last_tick = header.tick;
+        inst.last_recv_time = std::chrono::steady_clock::now();
+        inst.proto_version = header.version;
+        inst.episode_id = ext.episode_id;
+        inst.shm_slot = dg.shm_slot;
+        inst.compact_actions = action_ack.compact;
+        inst.acked_action_tick = action_ack.tick;
+        if (dg.shm_slot >= 0) {
+            // shm: reply through the client's to_client ring
+        } else if (header.version == PROTO_VERSION_V2 && server_) {
+            // v2: reply to the sender's actual endpoint (follows port changes)
+            set_reply_addr(inst, server_->endpoint_addr(dg.from));
+        } else if (!inst.has_reply_addr && server_) {
+            set_reply_addr(inst, server_->reply_addr(dg.from));
+        }
+
+        // Encode state -> tensors (with distance-sorted enemies)
+        stage_clock.restart();
+        step.obs = state_encoder::encode(step.units, step.global, pathability,
+                                         vis_t0, vis_t1, creeps);
+        stage_clock.lap(STAGE_ENCODE);
+        step.masks = state_encoder::encode_masks(step.units, &step.obs.sort_map);
+        stage_clock.lap(STAGE_MASKS);
+
+        // Compute rewards (from previous state to current)
+        step.rewards = inst.reward_calc.compute(
+            step.units, step.global, step.events, inst.prev_units, inst.prev_global, inst.has_prev);
+        stage_clock.lap(STAGE_REWARD);
+
+        // Previous state for the transition; current state becomes previous
+        step.has_prev = inst.has_prev;
+        if (inst.has_prev) {
+            std::memcpy(step.prev_units, inst.prev_units, sizeof(UnitState) * MAX_UNITS);
+            step.prev_global = inst.prev_global;
+        }
+        std::memcpy(inst.prev_units, step.units, sizeof(UnitState) * MAX_UNITS);
+        inst.prev_global = step.global;
+        inst.has_prev = true;
+
+        step.reset_hidden = inst.generation == 0;
+        if (step.reset_hidden) inst.generation = ++next_generation_;
+        step.inst_id = inst_id;
+        step.generation = inst.generation;
+        step.superseded = latest.superseded;
+        step.rx_ns = dg.rx_ns;
+        step.start_ns = start_ns;
+        step.ext = ext;
+    }
+
+    // AF_UNIX: drop the holds of instances that ended. A peer still
+    // carrying other games (or this batch's next episode) keeps its number.
+    if (server_) {
+        for (const SockAddr& peer : ended_peers_) server_->release_unix_peer(peer);
+    }
+    ended_peers_.clear();
+
+    if (!deadline_missed_.empty()) {
+        std::lock_guard<std::mutex> lock(latency_mutex_);
+        for (InstanceId inst_id : deadline_missed_) ++latency_[inst_id].deadline_misses;
+    }
+
+    active_instances = instances_.size();
+}
+
+// ============================================================
+// infer_stage: Phase 3b, one forward per hero model across all
+// instances of the batch
+// ============================================================
+
+void Dispatcher::infer_stage(StageBatch& batch) {
+    for (InstanceId inst_id : batch.forget) hidden_.erase(inst_id);
+    for (InstanceId inst_id : batch.evicted) {
+        auto it = hidden_.find(inst_id);
+        if (it == hidden_.end()) continue;
+        size_t bytes = 0;
+        for (const auto* hx : {&it->second.hx_h, &it->second.hx_c}) {
+            for (const auto& [hero_id, t] : *hx) bytes += t.nbytes();
+        }
+        total_reclaimed_bytes += bytes;
+        hidden_.erase(it);
+    }
+    if (batch.steps.empty()) return;
+
+    const auto infer_start = std::chrono::steady_clock::now();
+    infer_pending(batch.steps);
+    if (timings_) {
+        const float share = std::chrono::duration<float, std::micro>(
+            std::chrono::steady_clock::now() - infer_start).count() / batch.steps.size();
+        for (size_t n = 0; n < batch.steps.size(); ++n)
+            timings_->us[STAGE_INFER].push_back(share);
+    }
+}
+
+// ============================================================
+// reply_stage: Phase 3c, build the ACTIONs and flush every reply
+// ============================================================
+
+void Dispatcher::reply_stage(StageBatch& batch) {
+    latency_samples_.clear();
+    for (PendingStep& step : batch.steps) {
+        // The instance ended or restarted while this step was being
+        // inferred (--pipeline): nobody is waiting for its ACTION
+        auto inst_it = instances_.find(step.inst_id);
+        if (inst_it == instances_.end() || inst_it->second.generation != step.generation)
+            continue;
+        InstanceState& inst = inst_it->second;
+        const InstanceId inst_id = step.inst_id;
+        const PacketHeader& header = step.header;
+        const PacketHeaderExt& ext = step.ext;
+        const auto& obs = step.obs;
+        const auto& results = step.results;
+        StageClock stage_clock(timings_);
+
+        // Send ACTION packet back (with enemy sort mapping for target remapping)
+        UnitAction actions[MAX_UNITS];
+        decode_unit_actions(results, &obs.sort_map, actions);
+        send_action(inst, header.version, ext, header.tick, actions);
+        stage_clock.lap(STAGE_ACTION);
+        latency_samples_.push_back({inst_id, step.rx_ns, step.start_ns, realtime_ns(),
+                                    step.superseded});
+        if (flow_target_ms_ > 0) {
+            update_flow_control(inst, header.version, ext, header.tick, step.superseded,
+                                step.rx_ns ? step.start_ns - step.rx_ns : -1);
+        }
+    }
+
+    // Flush all ACTION packets produced this iteration in one batch
+    if (server_) server_->flush_sends();
+    if (shm_) shm_->flush_sends();
+
+    // Deadline cost estimate: the batch's span from its first start to
+    // its last ACTION, per step
+    if (deadline_ns_ > 0 && !latency_samples_.empty()) {
+        int64_t first_start = latency_samples_.front().start_ns;
+        for (const auto& ls : latency_samples_) first_start = std::min(first_start, ls.start_ns);
+        const double per_step = static_cast<double>(latency_samples_.back().queued_ns - first_start)
+                              / latency_samples_.size();
+        step_cost_ns_ = step_cost_ns_ > 0 ? 0.9 * step_cost_ns_ + 0.1 * per_step : per_step;
+    }
+
+    // Latency histograms: one lock per batch (the stats timer swaps them out)
+    if (!latency_samples_.empty()) {
+        const int64_t sent_ns = realtime_ns();
+        auto span = [](int64_t from, int64_t to) {
+            return static_cast<uint64_t>(std::max<int64_t>(0, to - from));
+        };
+        std::lock_guard<std::mutex> lock(latency_mutex_);
+        for (const auto& ls : latency_samples_) {
+            InstanceLatency& lat = latency_[ls.inst_id];
+            lat.process.record(span(ls.start_ns, ls.queued_ns));
+            lat.superseded += ls.superseded;
+            if (ls.rx_ns == 0) continue;  // receive time unknown (fate_replay)
+            lat.queue.record(span(ls.rx_ns, ls.start_ns));
+            lat.to_action.record(span(ls.rx_ns, sent_ns));
+        }
+    }
+}
+
+// ============================================================
+// rollout_stage: episode ends, then store the batch's transitions
+// ============================================================
+
+void Dispatcher::rollout_stage(StageBatch& batch) {
+    for (const EpisodeEnd& end : batch.episode_ends) {
+        if (end.discard) {
+            total_reclaimed_bytes += writer_.discard_episode(end.inst_id);
+            continue;
+        }
+        // Flushed: the buffer moves out of the instance into the dump queue
+        if (end.evicted) total_reclaimed_bytes += writer_.buffered_bytes(end.inst_id);
+        writer_.mark_last_done(end.inst_id, end.terminal_rewards);
+        writer_.flush_episode(end.inst_id);
+    }
+
+    for (const PendingStep& step : batch.steps) {
+        const auto& obs = step.obs;
+        const auto& masks = step.masks;
+        const auto& results = step.results;
+        StageClock stage_clock(timings_);
+
+        if (step.has_prev) {
+            for (int i = 0; i < MAX_UNITS; ++i) {
+                writer_.store(
+                    step.inst_id, i,
+                    obs.self_vec[i],
+                    obs.ally_vec[i],
+                    obs.enemy_vec[i],
+                    obs.global_vec[i],
+                    obs.grid[i],
+                    [&]() -> std::unordered_map<std::string, torch::Tensor> {
+                        std::unordered_map<std::string, torch::Tensor> m;
+                        for (const auto& [name, t] : masks.masks) {
+                            m[name] = t[i];
+                        }
+                        return m;
+                    }(),
+                    results[i].actions,
+                    results[i].log_prob.item<float>(),
+                    results[i].value.item<float>(),
+                    step.rewards[i],
+                    false,  // not done
+                    step.input_hx_h[i],
+                    step.input_hx_c[i],
+                    // FATE v2 parameters
+                    step.events,
+                    step.prev_units,
+                    step.units,
+                    step.prev_global,
+                    step.global,
+                    0  // model_version (no version tracking yet)
+                );
+            }
+        }
+
+        stage_clock.lap(STAGE_STORE);
+    }
+}
+
+// ============================================================
+// infer_grouped_pending: Phase 3b as one grouped forward.
+// Row k * 12 + i is unit i of steps[k], so the observation tensors
+// are concatenated per step instead of gathered per row.
+// ============================================================
+
+bool Dispatcher::infer_grouped_pending(std::vector<PendingStep>& steps) {
+    const auto& hero_index = hero_to_idx();
+    std::vector<int> heroes;
+    std::vector<std::string> hero_names;
+    heroes.reserve(steps.size() * MAX_UNITS);
+    hero_names.reserve(steps.size() * MAX_UNITS);
+    for (const PendingStep& step : steps) {
+        for (int i = 0; i < MAX_UNITS; ++i) {
+            std::string hero_id(step.units[i].hero_id, 4);
+            auto it = hero_index.find(hero_id);
+            if (it == hero_index.end()) return false;  // not one of the 12 models
+            heroes.push_back(it->second);
+            hero_names.push_back(std::move(hero_id));
+        }
+    }
+
+    std::vector<torch::Tensor> self_v, ally_v, enemy_v, global_v, grid_v, hx_h_v, hx_c_v;
+    std::unordered_map<std::string, std::vector<torch::Tensor>> mask_v;
+    size_t row = 0;
+    for (size_t k = 0; k < steps.size(); ++k) {
+        const PendingStep& step = steps[k];
+        self_v.push_back(step.obs.self_vec);
+        ally_v.push_back(step.obs.ally_vec);
+        enemy_v.push_back(step.obs.enemy_vec);
+        global_v.push_back(step.obs.global_vec);
+        grid_v.push_back(step.obs.grid);
+        for (const auto& [name, mask_tensor] : step.masks.masks)
+            mask_v[name].push_back(mask_tensor);
+        for (int i = 0; i < MAX_UNITS; ++i, ++row) {
+            hx_h_v.push_back(step_hidden_[k]->hx_h[hero_names[row]]);
+            hx_c_v.push_back(step_hidden_[k]->hx_c[hero_names[row]]);
+        }
+    }
+
+    auto hx_h = torch::cat(hx_h_v, /*dim=*/1);   // (1, N, 256)
+    auto hx_c = torch::cat(hx_c_v, /*dim=*/1);
+    std::unordered_map<std::string, torch::Tensor> batch_masks;
+    for (const auto& [name, v] : mask_v) batch_masks[name] = torch::cat(v).to(device_);
+
+    std::vector<InferenceEngine::InferResult> results;
+    try {
+        results = engine_.infer_grouped(
+            heroes,
+            torch::cat(self_v).to(device_),
+            torch::cat(ally_v).to(device_),
+            torch::cat(enemy_v).to(device_),
+            torch::cat(global_v).to(device_),
+            torch::cat(grid_v).to(device_),
+            hx_h, hx_c,
+            batch_masks
+        );
+    } catch (const std::exception& e) {
+        std::cerr << "[main] Grouped inference error, rows=" << heroes.size()
+                  << ": " << e.what() << " (falling back to per-hero forwards)" << std::endl;
+        return false;
+    }
+    ++total_forwards;
+
+    // Save INPUT hx before inference (detach + cpu for storage), one copy per batch
+    auto hx_h_cpu = hx_h.detach().cpu();
+    auto hx_c_cpu = hx_c.detach().cpu();
+    row = 0;
+    for (size_t k = 0; k < steps.size(); ++k) {
+        PendingStep& step = steps[k];
+        for (int i = 0; i < MAX_UNITS; ++i, ++row) {
+            const int64_t r = static_cast<int64_t>(row);
+            step.input_hx_h[i] = hx_h_cpu.slice(1, r, r + 1);
+            step.input_hx_c[i] = hx_c_cpu.slice(1, r, r + 1);
+            step_hidden_[k]->hx_h[hero_names[row]] = results[row].new_h;
+            step_hidden_[k]->hx_c[hero_names[row]] = results[row].new_c;
+            step.results[i] = std::move(results[row]);
+            ++total_inferences;
+        }
+    }
+    return true;
+}
+
+// ============================================================
+// infer_pending: batched inference for Phase 3b.
+// Row b of hero H's batch is unit i of steps[k]; its LSTM state is
+// gathered into (1, B, 256) and the new state scattered back.
+// ============================================================
+
+void Dispatcher::infer_pending(std::vector<PendingStep>& steps) {
+    for (auto& [hero_id, rows] : hero_rows_) rows.clear();
+    step_hidden_.clear();
+    for (size_t k = 0; k < steps.size(); ++k) {
+        const PendingStep& step = steps[k];
+        if (step.reset_hidden) hidden_.erase(step.inst_id);
+        HiddenState& hidden = hidden_[step.inst_id];
+        step_hidden_.push_back(&hidden);
+        for (int i = 0; i < MAX_UNITS; ++i) {
+            std::string hero_id(step.units[i].hero_id, 4);
+
+            // Get or init LSTM hidden state
+            if (hidden.hx_h.find(hero_id) == hidden.hx_h.end()) {
+                auto [h, c] = engine_.init_hidden();
+                hidden.hx_h[hero_id] = h;
+                hidden.hx_c[hero_id] = c;
+            }
+            hero_rows_[hero_id].emplace_back(k, i);
+        }
+    }
+    if (engine_.grouped_ready() && infer_grouped_pending(steps)) return;
+
+    std::vector<torch::Tensor> self_v, ally_v, enemy_v, global_v, grid_v, hx_h_v, hx_c_v;
+    std::unordered_map<std::string, std::vector<torch::Tensor>> mask_v;
+    for (auto& [hero_id, rows] : hero_rows_) {
+        if (rows.empty()) continue;
+
+        self_v.clear(); ally_v.clear(); enemy_v.clear(); global_v.clear(); grid_v.clear();
+        hx_h_v.clear(); hx_c_v.clear();
+        for (auto& [name, v] : mask_v) v.clear();
+        for (const auto& [k, i] : rows) {
+            const PendingStep& step = steps[k];
+            self_v.push_back(step.obs.self_vec[i]);
+            ally_v.push_back(step.obs.ally_vec[i]);
+            enemy_v.push_back(step.obs.enemy_vec[i]);
+            global_v.push_back(step.obs.global_vec[i]);
+            grid_v.push_back(step.obs.grid[i]);
+            hx_h_v.push_back(step_hidden_[k]->hx_h[hero_id]);
+            hx_c_v.push_back(step_hidden_[k]->hx_c[hero_id]);
+            for (const auto& [name, mask_tensor] : step.masks.masks)
+                mask_v[name].push_back(mask_tensor[i]);
+        }
+
+        auto hx_h = torch::cat(hx_h_v, /*dim=*/1);   // (1, B, 256)
+        auto hx_c = torch::cat(hx_c_v, /*dim=*/1);
+
+        // Save INPUT hx before inference (detach + cpu for storage), one copy per batch
+        auto hx_h_cpu = hx_h.detach().cpu();
+        auto hx_c_cpu = hx_c.detach().cpu();
+
+        std::unordered_map<std::string, torch::Tensor> batch_masks;
+        for (const auto& [name, v] : mask_v) {
+            if (!v.empty()) batch_masks[name] = torch::stack(v).to(device_);
+        }
+
+        std::vector<InferenceEngine::InferResult> results;
+        try {
+            results = engine_.infer_batch(
+                hero_id,
+                torch::stack(self_v).to(device_),
+                torch::stack(ally_v).to(device_),
+                torch::stack(enemy_v).to(device_),
+                torch::stack(global_v).to(device_),
+                torch::stack(grid_v).to(device_),
+                hx_h, hx_c,
+                batch_masks
+            );
+        } catch (const std::exception& e) {
+            std::cerr << "[main] Inference error hero=" << hero_id
+                      << " batch=" << rows.size() << ": " << e.what() << std::endl;
+            // Print mask shapes for debugging
+            for (const auto& [mname, mt] : batch_masks) {
+                std::cerr << "  mask[" << mname << "] shape=";
+                for (int d = 0; d < mt.dim(); ++d) std::cerr << mt.size(d) << (d+1<mt.dim()? "x" : "");
+                std::cerr << std::endl;
+            }
+            // Use default (no-op) results
+            results.assign(rows.size(), {});
+            const auto& heads = discrete_heads();
+            for (size_t b = 0; b < rows.size(); ++b) {
+                auto& r = results[b];
+                r.actions["move"] = torch::zeros({1, 2});
+                r.actions["point"] = torch::zeros({1, 2});
+                r.log_prob = torch::zeros({1});
+                r.value = torch::zeros({1});
+                r.new_h = hx_h_v[b];
+                r.new_c = hx_c_v[b];
+                for (int h = 0; h < NUM_DISCRETE_HEADS; ++h)
+                    r.actions[heads[h].name] = torch::zeros({1}, torch::kLong);
+            }
+        }
+        ++total_forwards;
+
+        for (size_t b = 0; b < rows.size(); ++b) {
+            const auto [k, i] = rows[b];
+            PendingStep& step = steps[k];
+            const int64_t row = static_cast<int64_t>(b);
+            step.input_hx_h[i] = hx_h_cpu.slice(1, row, row + 1);
+            step.input_hx_c[i] = hx_c_cpu.slice(1, row, row + 1);
+
+            // Update LSTM hidden state
+            step_hidden_[k]->hx_h[hero_id] = results[b].new_h;
+            step_hidden_[k]->hx_c[hero_id] = results[b].new_c;
+            step.results[i] = std::move(results[b]);
+
+            ++total_inferences;
+        }
+    }
+}
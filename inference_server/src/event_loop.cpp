@@ -0,0 +1,192 @@
+#include "event_loop.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
+// Epoll user data for the socket; timers use their index in timers_,
+// readers their index tagged with READER_TAG
+static constexpr uint64_t SOCKET_TAG = ~0ULL;
+static constexpr uint64_t READER_TAG = 1ULL << 32;
+
+// ============================================================
+// Constructor / Destructor
+// ============================================================
+
+EventLoop::EventLoop(socket_t sock)
+    : sock_(sock)
+{
+#ifdef __linux__
+    epfd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd_ < 0) {
+        throw std::runtime_error("epoll_create1 failed: " + std::to_string(errno));
+    }
+
+    struct epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = SOCKET_TAG;
+    if (epoll_ctl(epfd_, EPOLL_CTL_ADD, sock_, &ev) != 0) {
+        close(epfd_);
+        throw std::runtime_error("epoll_ctl(socket) failed: " + std::to_string(errno));
+    }
+#endif
+}
+
+EventLoop::~EventLoop() {
+#ifdef __linux__
+    for (auto& t : timers_) close(t.fd);
+    close(epfd_);
+#endif
+}
+
+// ============================================================
+// add_timer
+// ============================================================
+
+void EventLoop::add_timer(std::chrono::milliseconds interval, Callback cb) {
+    Timer t;
+    t.interval = interval;
+    t.cb = std::move(cb);
+    t.deadline = Clock::now() + interval;
+    t.fd = -1;
+
+#ifdef __linux__
+    t.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (t.fd < 0) {
+        throw std::runtime_error("timerfd_create failed: " + std::to_string(errno));
+    }
+
+    struct itimerspec spec;
+    std::memset(&spec, 0, sizeof(spec));
+    spec.it_interval.tv_sec  = interval.count() / 1000;
+    spec.it_interval.tv_nsec = (interval.count() % 1000) * 1000000L;
+    spec.it_value = spec.it_interval;
+    timerfd_settime(t.fd, 0, &spec, nullptr);
+
+    struct epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = timers_.size();
+    if (epoll_ctl(epfd_, EPOLL_CTL_ADD, t.fd, &ev) != 0) {
+        close(t.fd);
+        throw std::runtime_error("epoll_ctl(timerfd) failed: " + std::to_string(errno));
+    }
+#endif
+
+    timers_.push_back(std::move(t));
+}
+
+// ============================================================
+// add_reader
+// ============================================================
+
+void EventLoop::add_reader(int fd, Callback cb) {
+#ifdef __linux__
+    struct epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = READER_TAG | readers_.size();
+    if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        throw std::runtime_error("epoll_ctl(reader) failed: " + std::to_string(errno));
+    }
+#endif
+    readers_.push_back({fd, std::move(cb)});
+}
+
+// ============================================================
+// wait
+// ============================================================
+
+#ifdef __linux__
+
+bool EventLoop::wait(std::chrono::milliseconds timeout) {
+    constexpr int MAX_EVENTS = 16;
+    struct epoll_event events[MAX_EVENTS];
+
+    int n = epoll_wait(epfd_, events, MAX_EVENTS,
+                       timeout.count() < 0 ? -1 : static_cast<int>(timeout.count()));
+    if (n < 0) {
+        if (errno != EINTR)
+            std::cerr << "[EventLoop] epoll_wait error: " << errno << std::endl;
+        return false;
+    }
+
+    bool readable = false;
+    for (int i = 0; i < n; ++i) {
+        uint64_t tag = events[i].data.u64;
+        if (tag == SOCKET_TAG) {
+            readable = true;
+            continue;
+        }
+        if (tag & READER_TAG) {
+            readers_[tag & ~READER_TAG].cb();
+            continue;
+        }
+        auto& t = timers_[tag];
+        uint64_t expirations = 0;
+        if (read(t.fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+            // Missed expirations are coalesced into one callback
+            t.cb();
+        }
+    }
+    return readable;
+}
+
+#else
+
+bool EventLoop::wait(std::chrono::milliseconds timeout) {
+    auto now = Clock::now();
+
+    // Shorten the wait to the earliest timer deadline
+    auto wait_for = timeout;
+    for (const auto& t : timers_) {
+        auto until = std::chrono::duration_cast<std::chrono::milliseconds>(t.deadline - now);
+        if (until.count() < 0) until = std::chrono::milliseconds(0);
+        if (wait_for.count() < 0 || until < wait_for) wait_for = until;
+    }
+
+    fd_set rfds;
+    FD_ZERO(&rfds);
+    FD_SET(sock_, &rfds);
+    int max_fd = static_cast<int>(sock_);
+    for (const auto& r : readers_) {
+        FD_SET(r.fd, &rfds);
+        max_fd = std::max(max_fd, r.fd);
+    }
+
+    struct timeval tv;
+    struct timeval* tvp = nullptr;
+    if (wait_for.count() >= 0) {
+        tv.tv_sec  = static_cast<long>(wait_for.count() / 1000);
+        tv.tv_usec = static_cast<long>((wait_for.count() % 1000) * 1000);
+        tvp = &tv;
+    }
+
+    int n = select(max_fd + 1, &rfds, nullptr, nullptr, tvp);
+    bool readable = n > 0 && FD_ISSET(sock_, &rfds);
+    if (n > 0) {
+        for (auto& r : readers_) {
+            if (FD_ISSET(r.fd, &rfds)) r.cb();
+        }
+    }
+
+    now = Clock::now();
+    for (auto& t : timers_) {
+        if (now >= t.deadline) {
+            t.cb();
+            // Missed expirations are coalesced into one callback
+            do { t.deadline += t.interval; } while (t.deadline <= now);
+        }
+    }
+    return readable;
+}
+
+#endif
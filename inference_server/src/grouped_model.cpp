@@ -0,0 +1,218 @@
+#include "grouped_model.h"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
+
+namespace {
+
+using ParamMap = std::unordered_map<std::string, torch::Tensor>;
+
+const torch::Tensor& param(const ParamMap& params, const std::string& name) {
+    auto it = params.find(name);
+    if (it == params.end()) throw std::runtime_error("missing parameter " + name);
+    return it->second;
+}
+
+/// Stack Linear layers over heroes. Several prefixes are concatenated
+/// along the output dimension (one bmm for all the heads).
+StackedLinear stack_linear(const std::vector<ParamMap>& heroes,
+                           const std::vector<std::string>& prefixes, torch::Device device) {
+    std::vector<torch::Tensor> ws, bs;
+    for (const auto& params : heroes) {
+        std::vector<torch::Tensor> w, b;
+        for (const auto& prefix : prefixes) {
+            w.push_back(param(params, prefix + ".weight"));  // (out, in)
+            b.push_back(param(params, prefix + ".bias"));    // (out,)
+        }
+        ws.push_back(torch::cat(w, 0));
+        bs.push_back(torch::cat(b, 0));
+    }
+    StackedLinear lin;
+    lin.w = torch::stack(ws).transpose(1, 2).contiguous().to(device);  // (H, in, out)
+    lin.b = torch::stack(bs).unsqueeze(1).to(device);                  // (H, 1, out)
+    return lin;
+}
+
+/// Stack conv weights (out, in, k, k) into (H * out, in, k, k) for groups = H.
+std::pair<torch::Tensor, torch::Tensor> stack_conv(const std::vector<ParamMap>& heroes,
+                                                   const std::string& prefix,
+                                                   torch::Device device) {
+    std::vector<torch::Tensor> ws, bs;
+    for (const auto& params : heroes) {
+        ws.push_back(param(params, prefix + ".weight"));
+        bs.push_back(param(params, prefix + ".bias"));
+    }
+    return {torch::cat(ws, 0).contiguous().to(device), torch::cat(bs, 0).to(device)};
+}
+
+}  // namespace
+
+// ============================================================
+// Constructor: stack every hero's parameters
+// ============================================================
+
+GroupedHeroModel::GroupedHeroModel(const std::vector<torch::jit::script::Module>& models,
+                                   torch::Device device)
+    : device_(device)
+{
+    if (models.size() != static_cast<size_t>(NUM_HEROES)) {
+        throw std::runtime_error("GroupedHeroModel needs " + std::to_string(NUM_HEROES)
+                                 + " models, got " + std::to_string(models.size()));
+    }
+
+    std::vector<ParamMap> heroes(models.size());
+    for (size_t h = 0; h < models.size(); ++h) {
+        for (const auto& p : models[h].named_parameters())
+            heroes[h][p.name] = p.value.detach();
+    }
+
+    try {
+        self1_    = stack_linear(heroes, {"self_enc.net.0"}, device);
+        self2_    = stack_linear(heroes, {"self_enc.net.2"}, device);
+        ally_     = stack_linear(heroes, {"ally_enc.net.0"}, device);
+        enemy_    = stack_linear(heroes, {"enemy_enc.net.0"}, device);
+        global_   = stack_linear(heroes, {"global_fc.0"}, device);
+        grid_fc_  = stack_linear(heroes, {"grid_enc.fc"}, device);
+        pre_lstm_ = stack_linear(heroes, {"pre_lstm.0"}, device);
+
+        std::vector<std::string> head_prefixes;
+        for (const auto& head : discrete_heads())
+            head_prefixes.push_back(std::string("head_") + head.name);
+        head_prefixes.insert(head_prefixes.end(), {"move_mean", "point_mean", "value_head.0"});
+        heads_     = stack_linear(heroes, head_prefixes, device);
+        value_out_ = stack_linear(heroes, {"value_head.2"}, device);
+
+        // LSTM: both biases folded into the input projection
+        std::vector<torch::Tensor> w_ih, w_hh, bias;
+        std::vector<torch::Tensor> move_logstd, point_logstd;
+        for (const auto& params : heroes) {
+            w_ih.push_back(param(params, "lstm.weight_ih_l0"));
+            w_hh.push_back(param(params, "lstm.weight_hh_l0"));
+            bias.push_back(param(params, "lstm.bias_ih_l0") + param(params, "lstm.bias_hh_l0"));
+            move_logstd.push_back(param(params, "move_logstd"));
+            point_logstd.push_back(param(params, "point_logstd"));
+        }
+        lstm_ih_.w = torch::stack(w_ih).transpose(1, 2).contiguous().to(device);
+        lstm_ih_.b = torch::stack(bias).unsqueeze(1).to(device);
+        lstm_hh_   = torch::stack(w_hh).transpose(1, 2).contiguous().to(device);
+
+        // Same clamp as FateModelExport.forward
+        move_logstd_  = torch::stack(move_logstd).clamp(-2.0, 0.5).to(device);
+        point_logstd_ = torch::stack(point_logstd).clamp(-2.0, 0.5).to(device);
+
+        std::tie(conv1_w_, conv1_b_) = stack_conv(heroes, "grid_enc.conv.0", device);
+        std::tie(conv2_w_, conv2_b_) = stack_conv(heroes, "grid_enc.conv.2", device);
+    } catch (const c10::Error& e) {
+        throw std::runtime_error(std::string("hero models differ in shape: ") + e.what());
+    }
+}
+
+// ============================================================
+// forward
+// ============================================================
+
+std::vector<torch::Tensor> GroupedHeroModel::forward(
+    const std::vector<int>& hero,
+    const torch::Tensor& self_vec,
+    const torch::Tensor& ally_vec,
+    const torch::Tensor& enemy_vec,
+    const torch::Tensor& global_vec,
+    const torch::Tensor& grid,
+    const torch::Tensor& hx_h,
+    const torch::Tensor& hx_c) const
+{
+    const int64_t heroes = NUM_HEROES;
+    const int64_t n = self_vec.size(0);
+
+    // Slot h * m + j holds the j-th row of hero h; padding slots repeat row 0
+    std::array<int64_t, NUM_HEROES> count{};
+    for (int h : hero) ++count[h];
+    const int64_t m = std::max<int64_t>(1, *std::max_element(count.begin(), count.end()));
+
+    std::vector<int64_t> gather(heroes * m, 0), scatter(n), hero_idx(hero.begin(), hero.end());
+    std::array<int64_t, NUM_HEROES> fill{};
+    for (int64_t r = 0; r < n; ++r) {
+        const int64_t slot = hero[r] * m + fill[hero[r]]++;
+        gather[slot] = r;
+        scatter[r] = slot;
+    }
+    auto index = [&](std::vector<int64_t>& v) {
+        return torch::from_blob(v.data(), {static_cast<int64_t>(v.size())}, torch::kLong)
+            .to(device_);
+    };
+    const torch::Tensor gather_t = index(gather);
+    const torch::Tensor scatter_t = index(scatter);
+    const torch::Tensor hero_t = index(hero_idx);
+
+    auto linear = [](const StackedLinear& l, const torch::Tensor& x) {
+        return torch::baddbmm(l.b, x, l.w);  // (H, rows, out)
+    };
+    auto grouped = [&](const torch::Tensor& t) {  // (N, ...) -> (H * m, ...)
+        return t.index_select(0, gather_t);
+    };
+
+    // --- Encoders ---
+    auto s = torch::relu(linear(self1_, grouped(self_vec).view({heroes, m, -1})));
+    s = torch::relu(linear(self2_, s));                                    // (H, m, 128)
+
+    auto unit_mean = [&](const StackedLinear& l, const torch::Tensor& units) {   // (N, U, D)
+        const int64_t u = units.size(1);
+        auto x = grouped(units).view({heroes, m * u, units.size(2)});
+        return torch::relu(linear(l, x)).view({heroes, m, u, -1}).mean(2);
+    };
+    auto a = unit_mean(ally_, ally_vec);                                   // (H, m, 128)
+    auto e = unit_mean(enemy_, enemy_vec);                                 // (H, m, 128)
+    auto g = torch::relu(linear(global_, grouped(global_vec).view({heroes, m, -1})));
+
+    // Grid: heroes become channel groups, (m, H * C, 25, 48)
+    const int64_t c = grid.size(1), gh = grid.size(2), gw = grid.size(3);
+    auto x = grouped(grid).view({heroes, m, c, gh, gw}).transpose(0, 1)
+                          .reshape({m, heroes * c, gh, gw});
+    x = torch::relu(torch::conv2d(x, conv1_w_, conv1_b_, /*stride=*/1, /*padding=*/1,
+                                  /*dilation=*/1, /*groups=*/heroes));
+    x = torch::relu(torch::conv2d(x, conv2_w_, conv2_b_, /*stride=*/1, /*padding=*/1,
+                                  /*dilation=*/1, /*groups=*/heroes));
+    x = torch::adaptive_avg_pool2d(x, {4, 4});                            // (m, H * 64, 4, 4)
+    x = x.reshape({m, heroes, -1}).transpose(0, 1);                       // (H, m, 1024)
+    auto grid_emb = torch::relu(linear(grid_fc_, x));                     // (H, m, 128)
+
+    // --- Core: same concat order as FateModelExport ---
+    x = torch::relu(linear(pre_lstm_, torch::cat({s, a, e, grid_emb, g}, -1)));
+
+    // --- LSTM cell step (gate order i, f, g, o) ---
+    auto h0 = hx_h.index_select(1, gather_t).view({heroes, m, -1});
+    auto c0 = hx_c.index_select(1, gather_t).view({heroes, m, -1});
+    auto gates = (linear(lstm_ih_, x) + torch::bmm(h0, lstm_hh_)).chunk(4, -1);
+    auto c1 = torch::sigmoid(gates[1]) * c0 + torch::sigmoid(gates[0]) * torch::tanh(gates[2]);
+    auto h1 = torch::sigmoid(gates[3]) * torch::tanh(c1);
+
+    // --- Heads: one bmm, value MLP finished per hero ---
+    auto head_out = linear(heads_, h1);                                   // (H, m, 222)
+    const int64_t value_off = head_out.size(2) - value_out_.w.size(1);
+    auto value = linear(value_out_, torch::relu(head_out.narrow(2, value_off,
+                                                                value_out_.w.size(1))));
+
+    // Back to row order
+    auto rows = [&](const torch::Tensor& t) {
+        return t.reshape({heroes * m, t.size(-1)}).index_select(0, scatter_t);
+    };
+    auto head_rows = rows(head_out);
+
+    std::vector<torch::Tensor> out;
+    int64_t off = 0;
+    for (const auto& head : discrete_heads()) {
+        out.push_back(head_rows.narrow(1, off, head.size));
+        off += head.size;
+    }
+    out.push_back(torch::tanh(head_rows.narrow(1, off, 2)));              // move_mean
+    out.push_back(move_logstd_.index_select(0, hero_t));
+    out.push_back(torch::tanh(head_rows.narrow(1, off + 2, 2)));          // point_mean
+    out.push_back(point_logstd_.index_select(0, hero_t));
+    out.push_back(rows(value).squeeze(-1));                               // (N,)
+    out.push_back(rows(h1).unsqueeze(0));                                 // (1, N, 256)
+    out.push_back(rows(c1).unsqueeze(0));
+    return out;
+}
@@ -3,6 +3,8 @@
 #include <cmath>
 #include <iostream>
 #include <algorithm>
+#include <array>
+#include <stdexcept>
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -14,16 +16,19 @@ namespace fs = std::filesystem;
 // Constructor
 // ============================================================
 
-InferenceEngine::InferenceEngine(const std::string& model_dir, torch::Device device)
-    : model_dir_(model_dir), device_(device)
+InferenceEngine::InferenceEngine(const std::string& model_dir, torch::Device device,
+                                 bool grouped)
+    : model_dir_(model_dir), device_(device), grouped_mode_(grouped)
 {
     std::cout << "[InferenceEngine] Model dir: " << model_dir
-              << ", device: " << device << std::endl;
+              << ", device: " << device
+              << (grouped ? ", grouped 12-hero forward" : "") << std::endl;
 
     // Try to load per-hero models at startup
     int loaded = load_hero_models();
     if (loaded > 0) {
         std::cout << "[InferenceEngine] Loaded " << loaded << " hero models at startup" << std::endl;
+        rebuild_grouped();
     } else {
         std::cout << "[InferenceEngine] No hero models found at startup (will retry)" << std::endl;
     }
@@ -56,8 +61,12 @@ bool InferenceEngine::load_hero_model(const std::string& hero_id) {
     try {
         auto module = torch::jit::load(model_path.string(), device_);
         module.eval();
+        auto write_time = fs::last_write_time(model_path);
+
+        // Swap under the write lock; in-flight forwards keep their own handle
+        std::unique_lock<std::shared_mutex> lock(models_mutex_);
         hero_models_[hero_id] = std::move(module);
-        model_times_[hero_id] = fs::last_write_time(model_path);
+        model_times_[hero_id] = write_time;
 
         return true;
     } catch (const c10::Error& e) {
@@ -72,18 +81,64 @@ bool InferenceEngine::load_hero_model(const std::string& hero_id) {
 // ============================================================
 
 void InferenceEngine::maybe_reload() {
+    bool reloaded = false;
     for (const auto& hid : hero_ids()) {
         fs::path model_path = fs::path(model_dir_) / (hid + ".pt");
         if (!fs::exists(model_path)) continue;
 
         auto new_time = fs::last_write_time(model_path);
-        auto it = model_times_.find(hid);
-        if (it == model_times_.end() || it->second != new_time) {
+        bool changed;
+        {
+            std::shared_lock<std::shared_mutex> lock(models_mutex_);
+            auto it = model_times_.find(hid);
+            changed = (it == model_times_.end() || it->second != new_time);
+        }
+        if (changed) {
             if (load_hero_model(hid)) {
                 std::cout << "[InferenceEngine] Reloaded " << hid << ".pt" << std::endl;
+                reloaded = true;
             }
         }
     }
+    if (reloaded) rebuild_grouped();
+}
+
+// ============================================================
+// rebuild_grouped: restack the weights after (re)loading models
+// ============================================================
+
+void InferenceEngine::rebuild_grouped() {
+    if (!grouped_mode_) return;
+
+    std::vector<torch::jit::script::Module> models;
+    {
+        std::shared_lock<std::shared_mutex> lock(models_mutex_);
+        for (const auto& hid : hero_ids()) {
+            auto it = hero_models_.find(hid);
+            if (it == hero_models_.end()) break;
+            models.push_back(it->second);
+        }
+    }
+
+    std::shared_ptr<const GroupedHeroModel> grouped;
+    if (models.size() == static_cast<size_t>(NUM_HEROES)) {
+        try {
+            grouped = std::make_shared<const GroupedHeroModel>(models, device_);
+        } catch (const std::exception& e) {
+            std::cerr << "[InferenceEngine] Grouped forward disabled: " << e.what() << std::endl;
+        }
+    } else {
+        std::cout << "[InferenceEngine] Grouped forward waits for all "
+                  << NUM_HEROES << " hero models" << std::endl;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(models_mutex_);
+    grouped_ = std::move(grouped);
+}
+
+bool InferenceEngine::grouped_ready() const {
+    std::shared_lock<std::shared_mutex> lock(models_mutex_);
+    return grouped_ != nullptr;
 }
 
 // ============================================================
@@ -91,6 +146,7 @@ void InferenceEngine::maybe_reload() {
 // ============================================================
 
 bool InferenceEngine::has_model(const std::string& hero_id) const {
+    std::shared_lock<std::shared_mutex> lock(models_mutex_);
     return hero_models_.count(hero_id) > 0;
 }
 
@@ -110,7 +166,7 @@ std::pair<torch::Tensor, torch::Tensor> InferenceEngine::init_hidden() {
 
 std::pair<torch::Tensor, torch::Tensor>
 InferenceEngine::sample_categorical(torch::Tensor logits, torch::Tensor mask) {
-    // logits: (1, N), mask: (1, N) bool
+    // logits: (B, N), mask: (B, N) bool
     // Apply mask: set disallowed actions to -inf
     auto masked_logits = logits.masked_fill(~mask, -1e8f);
 
@@ -119,7 +175,7 @@ InferenceEngine::sample_categorical(torch::Tensor logits, torch::Tensor mask) {
 
     // Sample
     auto action = torch::multinomial(probs, /*num_samples=*/1, /*replacement=*/false);
-    // action: (1, 1) -> squeeze to (1,)
+    // action: (B, 1) -> squeeze to (B,)
     action = action.squeeze(-1);
 
     // Log probability
@@ -135,7 +191,7 @@ InferenceEngine::sample_categorical(torch::Tensor logits, torch::Tensor mask) {
 
 std::pair<torch::Tensor, torch::Tensor>
 InferenceEngine::sample_normal(torch::Tensor mean, torch::Tensor logstd) {
-    // mean: (1, 2), logstd: (2,)
+    // mean: (B, 2), logstd: (2,) or (B, 2)
     auto stddev = logstd.exp().expand_as(mean);
     auto noise = torch::randn_like(mean);
     auto sample = mean + stddev * noise;
@@ -146,16 +202,16 @@ InferenceEngine::sample_normal(torch::Tensor mean, torch::Tensor logstd) {
     auto var = stddev * stddev;
     auto log_prob = -0.5f * ((sample - mean).pow(2) / var) - logstd.expand_as(mean)
                     - 0.5f * log2pi;
-    auto total_log_prob = log_prob.sum(-1);  // (1,)
+    auto total_log_prob = log_prob.sum(-1);  // (B,)
 
     return {sample, total_log_prob};
 }
 
 // ============================================================
-// infer_hero: Run inference for a single hero (per-hero model)
+// infer_batch: Run one hero's model on a batch of games
 // ============================================================
 
-InferenceEngine::InferResult InferenceEngine::infer_hero(
+std::vector<InferenceEngine::InferResult> InferenceEngine::infer_batch(
     const std::string& hero_id,
     torch::Tensor self_vec,
     torch::Tensor ally_vec,
@@ -166,28 +222,41 @@ InferenceEngine::InferResult InferenceEngine::infer_hero(
     torch::Tensor hx_c,
     const std::unordered_map<std::string, torch::Tensor>& masks)
 {
-    InferResult result;
-
-    auto model_it = hero_models_.find(hero_id);
-    if (model_it == hero_models_.end()) {
+    const int64_t batch = self_vec.size(0);
+    std::vector<InferResult> results(static_cast<size_t>(batch));
+
+    // Take a handle to the module (shallow copy) so a concurrent reload
+    // can replace the map entry while this forward is running
+    torch::jit::script::Module model;
+    bool found = false;
+    {
+        std::shared_lock<std::shared_mutex> lock(models_mutex_);
+        auto model_it = hero_models_.find(hero_id);
+        if (model_it != hero_models_.end()) {
+            model = model_it->second;
+            found = true;
+        }
+    }
+    if (!found) {
         // No model loaded for this hero: return random/default actions
         std::cerr << "[InferenceEngine] No model for " << hero_id << ", returning defaults" << std::endl;
 
         const auto& heads = discrete_heads();
-        for (int h = 0; h < NUM_DISCRETE_HEADS; ++h) {
-            result.actions[heads[h].name] = torch::zeros({1}, torch::kLong).to(device_);
+        for (int64_t b = 0; b < batch; ++b) {
+            InferResult& result = results[b];
+            for (int h = 0; h < NUM_DISCRETE_HEADS; ++h) {
+                result.actions[heads[h].name] = torch::zeros({1}, torch::kLong);
+            }
+            result.actions["move"] = torch::zeros({1, 2});
+            result.actions["point"] = torch::zeros({1, 2});
+            result.log_prob = torch::zeros({1});
+            result.value = torch::zeros({1});
+            result.new_h = hx_h.slice(1, b, b + 1);
+            result.new_c = hx_c.slice(1, b, b + 1);
         }
-        result.actions["move"] = torch::zeros({1, 2}).to(device_);
-        result.actions["point"] = torch::zeros({1, 2}).to(device_);
-        result.log_prob = torch::zeros({1}).to(device_);
-        result.value = torch::zeros({1}).to(device_);
-        result.new_h = hx_h;
-        result.new_c = hx_c;
-        return result;
+        return results;
     }
 
-    auto& model = model_it->second;
-
     // Build input vector matching FateModelExport.forward() signature
     std::vector<torch::jit::IValue> inputs;
     inputs.push_back(self_vec);
@@ -217,7 +286,7 @@ InferenceEngine::InferResult InferenceEngine::infer_hero(
                     break;
                 }
             }
-            inputs.push_back(torch::ones({1, size}, torch::kBool).to(device_));
+            inputs.push_back(torch::ones({batch, size}, torch::kBool).to(device_));
         }
     }
 
@@ -231,49 +300,103 @@ InferenceEngine::InferResult InferenceEngine::infer_hero(
     // 13: point_mean (B,2), 14: point_logstd (2,)
     // 15: value (B,)
     // 16: new_h (1,B,256), 17: new_c (1,B,256)
-    auto tuple = output.toTuple();
-    auto elements = tuple->elements();
+    std::vector<torch::Tensor> elements;
+    for (const auto& e : output.toTuple()->elements()) elements.push_back(e.toTensor());
+    return sample_rows(elements, masks, batch);
+}
+
+// ============================================================
+// sample_rows: forward outputs -> one InferResult per row.
+// Samples every row at once and copies each output to the host
+// once; the per-row results are slices of these.
+// ============================================================
+
+std::vector<InferenceEngine::InferResult> InferenceEngine::sample_rows(
+    const std::vector<torch::Tensor>& elements,
+    const std::unordered_map<std::string, torch::Tensor>& masks,
+    int64_t batch)
+{
+    std::vector<InferResult> results(static_cast<size_t>(batch));
 
     // Discrete head outputs (indices 0-10) - these are already masked logits
-    float total_log_prob = 0.0f;
     const auto& heads = discrete_heads();
+    std::array<torch::Tensor, NUM_DISCRETE_HEADS> discrete;
+    torch::Tensor total_log_prob;
     for (int h = 0; h < NUM_DISCRETE_HEADS; ++h) {
-        auto logits = elements[h].toTensor();  // (1, head_size)
+        const auto& logits = elements[h];  // (B, head_size)
         auto mask_it = masks.find(heads[h].name);
         torch::Tensor mask_t;
         if (mask_it != masks.end()) {
             mask_t = mask_it->second;
         } else {
-            mask_t = torch::ones({1, heads[h].size}, torch::kBool).to(device_);
+            mask_t = torch::ones({batch, heads[h].size}, torch::kBool).to(device_);
         }
 
         auto [action, lp] = sample_categorical(logits, mask_t);
-        result.actions[heads[h].name] = action;
-        total_log_prob += lp.item<float>();
+        discrete[h] = action.cpu();
+        total_log_prob = h == 0 ? lp : total_log_prob + lp;
     }
 
     // Continuous: move (indices 11, 12)
-    auto move_mean = elements[11].toTensor();    // (1, 2)
-    auto move_logstd = elements[12].toTensor();  // (2,)
+    const auto& move_mean = elements[11];    // (B, 2)
+    const auto& move_logstd = elements[12];  // (2,) or (B, 2)
     auto [move_sample, move_lp] = sample_normal(move_mean, move_logstd);
-    result.actions["move"] = move_sample;
-    total_log_prob += move_lp.item<float>();
 
     // Continuous: point (indices 13, 14)
-    auto point_mean = elements[13].toTensor();    // (1, 2)
-    auto point_logstd = elements[14].toTensor();  // (2,)
+    const auto& point_mean = elements[13];    // (B, 2)
+    const auto& point_logstd = elements[14];  // (2,) or (B, 2)
     auto [point_sample, point_lp] = sample_normal(point_mean, point_logstd);
-    result.actions["point"] = point_sample;
-    total_log_prob += point_lp.item<float>();
 
-    // Value (index 15)
-    result.value = elements[15].toTensor();  // (1,)
+    auto move = move_sample.cpu();
+    auto point = point_sample.cpu();
+    auto log_prob = (total_log_prob + move_lp + point_lp).cpu();
+    auto value = elements[15].reshape({batch}).cpu();  // (B,)
 
-    // LSTM hidden state (indices 16, 17)
-    result.new_h = elements[16].toTensor();  // (1, 1, 256)
-    result.new_c = elements[17].toTensor();  // (1, 1, 256)
+    // LSTM hidden state (indices 16, 17), kept on the device
+    const auto& new_h = elements[16];  // (1, B, 256)
+    const auto& new_c = elements[17];  // (1, B, 256)
 
-    result.log_prob = torch::tensor({total_log_prob}).to(device_);
+    for (int64_t b = 0; b < batch; ++b) {
+        InferResult& result = results[b];
+        for (int h = 0; h < NUM_DISCRETE_HEADS; ++h) {
+            result.actions[heads[h].name] = discrete[h].slice(0, b, b + 1);
+        }
+        result.actions["move"] = move.slice(0, b, b + 1);
+        result.actions["point"] = point.slice(0, b, b + 1);
+        result.log_prob = log_prob.slice(0, b, b + 1);
+        result.value = value.slice(0, b, b + 1);
+        result.new_h = new_h.slice(1, b, b + 1);
+        result.new_c = new_c.slice(1, b, b + 1);
+    }
+
+    return results;
+}
+
+// ============================================================
+// infer_grouped: every hero's rows in one grouped forward
+// ============================================================
 
-    return result;
+std::vector<InferenceEngine::InferResult> InferenceEngine::infer_grouped(
+    const std::vector<int>& hero,
+    torch::Tensor self_vec,
+    torch::Tensor ally_vec,
+    torch::Tensor enemy_vec,
+    torch::Tensor global_vec,
+    torch::Tensor grid,
+    torch::Tensor hx_h,
+    torch::Tensor hx_c,
+    const std::unordered_map<std::string, torch::Tensor>& masks)
+{
+    // Keep the stacked weights alive across a concurrent rebuild
+    std::shared_ptr<const GroupedHeroModel> grouped;
+    {
+        std::shared_lock<std::shared_mutex> lock(models_mutex_);
+        grouped = grouped_;
+    }
+    if (!grouped) throw std::runtime_error("grouped forward not ready");
+
+    torch::NoGradGuard no_grad;
+    auto elements = grouped->forward(hero, self_vec, ally_vec, enemy_vec, global_vec, grid,
+                                     hx_h, hx_c);
+    return sample_rows(elements, masks, self_vec.size(0));
 }
@@ -1,43 +1,25 @@
+#include <algorithm>
+#include <array>
 #include <chrono>
-#include <cstring>
+#include <cstdio>
 #include <iostream>
+#include <memory>
 #include <string>
-#include <unordered_map>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include <torch/torch.h>
 
-#include "protocol.h"
-#include "constants.h"
+#include "cpu_affinity.h"
 #include "udp_server.h"
-#include "state_encoder.h"
+#include "shm_server.h"
+#include "packet_capture.h"
+#include "event_loop.h"
+#include "dispatcher.h"
 #include "inference_engine.h"
-#include "reward_calc.h"
 #include "rollout_writer.h"
 
-// ============================================================
-// Per-instance state tracking
-// ============================================================
-struct InstanceState {
-    // LSTM hidden states per hero (keyed by hero_id string)
-    std::unordered_map<std::string, torch::Tensor> hx_h;  // (1, 1, 256)
-    std::unordered_map<std::string, torch::Tensor> hx_c;
-
-    // Previous state for reward computation
-    UnitState prev_units[MAX_UNITS];
-    GlobalState prev_global{};
-    bool has_prev = false;
-
-    // Reward calculator per instance
-    RewardCalc reward_calc;
-
-    // Last tick seen
-    uint32_t last_tick = 0;
-
-    // Last time we received a packet from this instance (for timeout detection)
-    std::chrono::steady_clock::time_point last_recv_time = std::chrono::steady_clock::now();
-};
-
 // ============================================================
 // Command-line argument parsing
 // ============================================================
@@ -49,6 +31,24 @@ struct Config {
     std::string rollout_dir = "./rollouts";
     int rollout_size = 4096;
     int reload_interval_sec = 5;
+    int busy_poll_us = 0;          // spin before blocking when idle (0 = off)
+    int shards = 1;                // SO_REUSEPORT receive shards (threads)
+    std::string shm_socket;        // shared-memory transport handshake path ("" = off)
+    std::string unix_socket;       // AF_UNIX datagram path instead of the UDP port ("" = off)
+    bool grouped_heroes = false;   // one grouped forward over all 12 hero models
+    int pipeline_depth = 0;        // batches in flight per shard with stage threads (0 = off)
+    int shm_slots = 16;            // max shared-memory clients
+    std::string capture_path;      // raw datagram capture file ("" = off)
+    bool latency_mode = false;     // pin network threads, confine libtorch pools
+    std::string net_cpus;          // latency mode: one CPU per shard ("" = auto)
+    std::string torch_cpus;        // latency mode: CPUs for libtorch ("" = the rest)
+    int torch_threads = 0;         // intra-op threads (0 = one per torch CPU)
+    int interop_threads = 1;       // inter-op threads
+    int so_busy_poll_us = 0;       // SO_BUSY_POLL on the sockets (0 = off)
+    int flow_control_ms = 0;       // MSG_FLOW_CONTROL queueing target (0 = off)
+    int deadline_ms = 0;           // per-STATE latency budget, hold last ACTION past it (0 = off)
+    int idle_timeout_sec = 0;      // evict instances silent this long (0 = never)
+    bool idle_discard = false;     // eviction drops the partial episode instead of flushing it
 };
 
 static Config parse_args(int argc, char* argv[]) {
@@ -69,6 +69,48 @@ static Config parse_args(int argc, char* argv[]) {
             cfg.rollout_size = std::stoi(argv[++i]);
         else if (arg == "--reload-interval" && i + 1 < argc)
             cfg.reload_interval_sec = std::stoi(argv[++i]);
+        else if (arg == "--busy-poll-us" && i + 1 < argc)
+            cfg.busy_poll_us = std::stoi(argv[++i]);
+        else if (arg == "--shards" && i + 1 < argc)
+            cfg.shards = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--shm" && i + 1 < argc)
+            cfg.shm_socket = argv[++i];
+        else if (arg == "--grouped-heroes")
+            cfg.grouped_heroes = true;
+        else if (arg == "--pipeline" && i + 1 < argc)
+            cfg.pipeline_depth = std::max(0, std::stoi(argv[++i]));
+        else if (arg == "--unix" && i + 1 < argc)
+            cfg.unix_socket = argv[++i];
+        else if (arg == "--shm-slots" && i + 1 < argc)
+            cfg.shm_slots = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--capture" && i + 1 < argc)
+            cfg.capture_path = argv[++i];
+        else if (arg == "--latency-mode")
+            cfg.latency_mode = true;
+        else if (arg == "--net-cpus" && i + 1 < argc)
+            cfg.net_cpus = argv[++i];
+        else if (arg == "--torch-cpus" && i + 1 < argc)
+            cfg.torch_cpus = argv[++i];
+        else if (arg == "--torch-threads" && i + 1 < argc)
+            cfg.torch_threads = std::max(0, std::stoi(argv[++i]));
+        else if (arg == "--interop-threads" && i + 1 < argc)
+            cfg.interop_threads = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--so-busy-poll-us" && i + 1 < argc)
+            cfg.so_busy_poll_us = std::max(0, std::stoi(argv[++i]));
+        else if (arg == "--flow-control" && i + 1 < argc)
+            cfg.flow_control_ms = std::max(0, std::stoi(argv[++i]));
+        else if (arg == "--deadline-ms" && i + 1 < argc)
+            cfg.deadline_ms = std::max(0, std::stoi(argv[++i]));
+        else if (arg == "--idle-timeout" && i + 1 < argc)
+            cfg.idle_timeout_sec = std::max(0, std::stoi(argv[++i]));
+        else if (arg == "--idle-policy" && i + 1 < argc) {
+            std::string policy = argv[++i];
+            if (policy != "flush" && policy != "discard") {
+                std::cerr << "[main] --idle-policy must be flush or discard" << std::endl;
+                std::exit(1);
+            }
+            cfg.idle_discard = policy == "discard";
+        }
         else if (arg == "--help" || arg == "-h") {
             std::cout << "Usage: fate_inference_server [options]\n"
                       << "  --port <int>           Listen port (default: 7777)\n"
@@ -77,7 +119,38 @@ static Config parse_args(int argc, char* argv[]) {
                       << "  --model-dir <path>     Model directory (default: ./models)\n"
                       << "  --rollout-dir <path>   Rollout output dir (default: ./rollouts)\n"
                       << "  --rollout-size <int>   Min transitions before dump (default: 4096)\n"
-                      << "  --reload-interval <int> Model reload check seconds (default: 5)\n";
+                      << "  --reload-interval <int> Model reload check seconds (default: 5)\n"
+                      << "  --busy-poll-us <int>   Busy-poll window before blocking when idle (default: 0)\n"
+                      << "  --shards <int>         SO_REUSEPORT receive shards, one thread each (default: 1)\n"
+                      << "  --shm <path>           Also serve co-located clients over shared memory (Linux),\n"
+                      << "                         handshake on this AF_UNIX socket path\n"
+                      << "  --shm-slots <int>      Max shared-memory clients (default: 16)\n"
+                      << "  --unix <path>          Serve datagrams on an AF_UNIX socket at this path\n"
+                      << "                         instead of the UDP port (Linux, one shard)\n"
+                      << "  --grouped-heroes       Run all 12 hero models as one grouped forward\n"
+                      << "                         (weights stacked over heroes, bmm / grouped conv)\n"
+                      << "  --pipeline <int>       Run inference and rollout storage on their own threads\n"
+                      << "                         per shard, up to this many batches in flight (Linux,\n"
+                      << "                         default: 0 = all stages on the receive thread)\n"
+                      << "  --capture <file>       Append every received datagram to a capture file\n"
+                      << "                         (replay with fate_replay)\n"
+                      << "  --latency-mode         Pin each shard's network/dispatch thread to its own CPU\n"
+                      << "                         and confine libtorch threads to the other CPUs (Linux)\n"
+                      << "  --net-cpus <list>      Latency mode: shard CPUs, e.g. 3 or 6-7 (default: last CPUs)\n"
+                      << "  --torch-cpus <list>    Latency mode: libtorch CPUs (default: the remaining CPUs)\n"
+                      << "  --torch-threads <int>  Latency mode: intra-op threads (default: one per torch CPU)\n"
+                      << "  --interop-threads <int> Latency mode: inter-op threads (default: 1)\n"
+                      << "  --so-busy-poll-us <int> Kernel SO_BUSY_POLL on the sockets (default: 0 = off)\n"
+                      << "  --flow-control <ms>    Ask clients to send STATEs less often when theirs are\n"
+                      << "                         superseded or queued longer than this (default: 0 = off)\n"
+                      << "  --deadline-ms <ms>     Serve STATEs earliest deadline first; a STATE that cannot\n"
+                      << "                         get its ACTION within this budget of arrival gets the\n"
+                      << "                         instance's last ACTION again instead, without inference\n"
+                      << "                         (full STATEs are still parsed as keyframes) (default: 0 = off)\n"
+                      << "  --idle-timeout <sec>   Evict instances that sent nothing for this long and\n"
+                      << "                         release their memory (default: 0 = never)\n"
+                      << "  --idle-policy <p>      Evicted partial episodes: flush (to the rollouts, like a\n"
+                      << "                         DONE) or discard (default: flush)\n";
             std::exit(0);
         }
     }
@@ -85,98 +158,156 @@ static Config parse_args(int argc, char* argv[]) {
 }
 
 // ============================================================
-// Extract IP from "ip:port" string
+// Latency report: one line per instance for the stats window
 // ============================================================
-static std::string extract_ip(const std::string& addr) {
-    auto pos = addr.rfind(':');
-    if (pos != std::string::npos)
-        return addr.substr(0, pos);
-    return addr;
+
+static std::string format_pcts(const LatencyHistogram& h) {
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), "%.0f/%.0f/%.0f",
+                  h.percentile(0.50) / 1e3, h.percentile(0.99) / 1e3, h.percentile(0.999) / 1e3);
+    return buf;
+}
+
+static void print_latency_report(const std::unordered_map<InstanceId, InstanceLatency>& window) {
+    std::vector<InstanceId> ids;
+    ids.reserve(window.size());
+    for (const auto& [id, lat] : window) ids.push_back(id);
+    std::sort(ids.begin(), ids.end());
+
+    InstanceLatency all;
+    for (InstanceId id : ids) {
+        const InstanceLatency& lat = window.at(id);
+        all.queue.merge(lat.queue);
+        all.process.merge(lat.process);
+        all.to_action.merge(lat.to_action);
+        all.superseded += lat.superseded;
+        all.deadline_misses += lat.deadline_misses;
+        std::cout << "[main] Latency " << instance_id_str(id)
+                  << " (us p50/p99/p999): queue " << format_pcts(lat.queue)
+                  << ", process " << format_pcts(lat.process)
+                  << ", rx->action " << format_pcts(lat.to_action)
+                  << ", " << lat.process.count() << " states, "
+                  << lat.superseded << " superseded";
+        if (lat.deadline_misses) std::cout << ", " << lat.deadline_misses << " deadline misses";
+        std::cout << std::endl;
+    }
+    if (ids.size() > 1) {
+        std::cout << "[main] Latency all (us p50/p99/p999): queue " << format_pcts(all.queue)
+                  << ", process " << format_pcts(all.process)
+                  << ", rx->action " << format_pcts(all.to_action)
+                  << ", " << all.process.count() << " states, "
+                  << all.superseded << " superseded";
+        if (all.deadline_misses) std::cout << ", " << all.deadline_misses << " deadline misses";
+        std::cout << std::endl;
+    }
 }
 
 // ============================================================
-// Build instance key from source address (use IP only,
-// since multiple WC3 instances may use different ephemeral ports)
+// Pipeline report (--pipeline): per stage, the share of the window
+// spent working (averaged over shards) and the mean depth of its
+// input queue per batch
 // ============================================================
-static std::string instance_key(const std::string& addr) {
-    return extract_ip(addr);
+struct PipeTotals {
+    uint64_t busy_ns = 0;
+    uint64_t batches = 0;
+    uint64_t queue_depth = 0;
+};
+
+static void print_pipeline_report(const std::vector<std::unique_ptr<Dispatcher>>& dispatchers,
+                                  std::array<PipeTotals, NUM_PIPE_STAGES>& prev,
+                                  std::chrono::steady_clock::time_point& last) {
+    const auto now = std::chrono::steady_clock::now();
+    const double window_ns = std::chrono::duration<double, std::nano>(now - last).count()
+                           * dispatchers.size();
+    last = now;
+
+    std::cout << "[main] Pipeline:";
+    for (int st = 0; st < NUM_PIPE_STAGES; ++st) {
+        PipeTotals cur;
+        for (const auto& d : dispatchers) {
+            cur.busy_ns     += d->pipe_stages[st].busy_ns;
+            cur.batches     += d->pipe_stages[st].batches;
+            cur.queue_depth += d->pipe_stages[st].queue_depth;
+        }
+        const uint64_t batches = cur.batches - prev[st].batches;
+        char buf[96];
+        std::snprintf(buf, sizeof(buf), " %s %.0f%% busy (%llu batches, queue %.2f)%s",
+                      pipe_stage_name(st),
+                      window_ns > 0 ? 100.0 * (cur.busy_ns - prev[st].busy_ns) / window_ns : 0.0,
+                      static_cast<unsigned long long>(batches),
+                      batches ? double(cur.queue_depth - prev[st].queue_depth) / batches : 0.0,
+                      st + 1 < NUM_PIPE_STAGES ? "," : "");
+        std::cout << buf;
+        prev[st] = cur;
+    }
+    std::cout << std::endl;
 }
 
 // ============================================================
-// Build and send ACTION packet
+// Latency mode: CPU plan
+// Each shard's receive + dispatch thread gets a CPU of its own and
+// libtorch's intra-/inter-op pools are confined to the other CPUs,
+// so spinning OpenMP workers never preempt the network thread.
 // ============================================================
-static void send_action_packet(
-    UdpServer& server,
-    const std::string& addr,
-    uint32_t tick,
-    const std::array<InferenceEngine::InferResult, MAX_UNITS>& results,
-    const UnitState units[MAX_UNITS],
-    const EnemySortMapping* sort_map = nullptr)
-{
-    ActionPacket pkt;
-    std::memset(&pkt, 0, sizeof(pkt));
-
-    pkt.header.magic = MAGIC;
-    pkt.header.version = PROTO_VERSION;
-    pkt.header.msg_type = MSG_ACTION;
-    pkt.header.tick = tick;
-
-    for (int i = 0; i < MAX_UNITS; ++i) {
-        auto& ua = pkt.actions[i];
-        ua.idx = static_cast<uint8_t>(i);
-        const auto& r = results[i];
-
-        // Move continuous action -> clamp to [-1, 1]
-        auto move_it = r.actions.find("move");
-        if (move_it != r.actions.end()) {
-            auto mv = move_it->second.cpu().contiguous();
-            float mx = mv.dim() > 1 ? mv[0][0].item<float>() : mv[0].item<float>();
-            float my = mv.dim() > 1 ? mv[0][1].item<float>() : mv[1].item<float>();
-            ua.move_x = std::max(-1.0f, std::min(1.0f, mx));
-            ua.move_y = std::max(-1.0f, std::min(1.0f, my));
-        }
+struct CpuPlan {
+    std::vector<int> allowed;
+    std::vector<int> net;      // one per shard
+    std::vector<int> torch;
+    int intra_threads = 1;
+};
 
-        // Point continuous action
-        auto point_it = r.actions.find("point");
-        if (point_it != r.actions.end()) {
-            auto pt = point_it->second.cpu().contiguous();
-            float px = pt.dim() > 1 ? pt[0][0].item<float>() : pt[0].item<float>();
-            float py = pt.dim() > 1 ? pt[0][1].item<float>() : pt[1].item<float>();
-            ua.point_x = std::max(-1.0f, std::min(1.0f, px));
-            ua.point_y = std::max(-1.0f, std::min(1.0f, py));
-        }
+static CpuPlan make_cpu_plan(const Config& cfg) {
+    CpuPlan plan;
+    plan.allowed = allowed_cpus();
+    const auto& all = plan.allowed;
 
-        // Discrete actions
-        auto get_int = [&](const char* name) -> uint8_t {
-            auto it = r.actions.find(name);
-            if (it != r.actions.end())
-                return static_cast<uint8_t>(it->second.item<int64_t>());
-            return 0;
-        };
-
-        ua.skill          = get_int("skill");
-        ua.unit_target    = get_int("unit_target");
-
-        // Remap enemy target from sorted slot to real player offset
-        // unit_target layout: 0-5=allies, 6-7=special(no_target,attack_point), 8-13=enemies
-        if (sort_map && ua.unit_target >= 8 && ua.unit_target <= 13) {
-            int sorted_slot = ua.unit_target - 8;
-            int real_offset = sort_map->sorted_to_real[i][sorted_slot];
-            ua.unit_target = static_cast<uint8_t>(8 + real_offset);
-        }
+    std::vector<int> net = cfg.net_cpus.empty() ? std::vector<int>{} : parse_cpu_list(cfg.net_cpus);
+    if (net.empty()) {
+        // Default: the last CPUs, leaving the low ones to libtorch
+        const size_t n = std::min(all.size(), static_cast<size_t>(cfg.shards));
+        net.assign(all.end() - n, all.end());
+    }
+    for (int s = 0; s < cfg.shards; ++s) plan.net.push_back(net[s % net.size()]);
 
-        ua.skill_levelup  = get_int("skill_levelup");
-        ua.stat_upgrade   = get_int("stat_upgrade");
-        ua.attribute      = get_int("attribute");
-        ua.item_buy       = get_int("item_buy");
-        ua.item_use       = get_int("item_use");
-        ua.seal_use       = get_int("seal_use");
-        ua.faire_send     = get_int("faire_send");
-        ua.faire_request  = get_int("faire_request");
-        ua.faire_respond  = get_int("faire_respond");
+    if (!cfg.torch_cpus.empty()) {
+        plan.torch = parse_cpu_list(cfg.torch_cpus);
+    } else {
+        for (int c : all)
+            if (std::find(net.begin(), net.end(), c) == net.end()) plan.torch.push_back(c);
+        if (plan.torch.empty()) plan.torch = all;   // too few CPUs: share
     }
+    plan.intra_threads = cfg.torch_threads > 0 ? cfg.torch_threads
+                                               : static_cast<int>(plan.torch.size());
+    return plan;
+}
 
-    server.send_to(addr, reinterpret_cast<const uint8_t*>(&pkt), sizeof(pkt));
+/// Run one small parallel op so the calling thread's intra-op pool
+/// exists (and its workers inherit the current, torch-only, affinity)
+/// before the thread pins itself to its network CPU.
+static void warm_up_torch() {
+    torch::NoGradGuard no_grad;
+    auto t = torch::ones({256, 256});
+    (void)t.matmul(t).sum().item<float>();
+}
+
+static void report_cpu_plan(const Config& cfg, const CpuPlan& plan) {
+    std::cout << "[main] Latency mode: allowed CPUs " << cpu_list_string(plan.allowed) << std::endl;
+    for (int s = 0; s < cfg.shards; ++s) {
+        std::string topo = cpu_topology(plan.net[s]);
+        std::cout << "[main]   shard " << s << " network/dispatch -> CPU " << plan.net[s]
+                  << (topo.empty() ? "" : " (" + topo + ")") << std::endl;
+    }
+    std::cout << "[main]   libtorch -> CPUs " << cpu_list_string(plan.torch) << ", "
+              << plan.intra_threads << " intra-op / " << cfg.interop_threads
+              << " inter-op threads" << std::endl;
+    for (int c : plan.torch) {
+        if (std::find(plan.net.begin(), plan.net.end(), c) != plan.net.end()) {
+            std::cout << "[main]   warning: CPU " << c
+                      << " is shared by a network thread and libtorch" << std::endl;
+        }
+    }
+    if (cfg.so_busy_poll_us > 0)
+        std::cout << "[main]   SO_BUSY_POLL " << cfg.so_busy_poll_us << " us" << std::endl;
 }
 
 // ============================================================
@@ -195,307 +326,213 @@ int main(int argc, char* argv[]) {
         std::cout << "[main] Using CPU" << std::endl;
     }
 
-    // Initialize components
-    UdpServer server(cfg.listen_port, cfg.send_port);
-    InferenceEngine engine(cfg.model_dir, device);
-    RolloutWriter writer(cfg.rollout_dir);
-
-    // Per-instance state
-    std::unordered_map<std::string, InstanceState> instances;
-
-    // Timing for periodic tasks
-    auto last_reload = std::chrono::steady_clock::now();
-    auto last_stats = std::chrono::steady_clock::now();
-    uint64_t total_packets = 0;
-    uint64_t total_inferences = 0;
+#ifndef __linux__
+    if (cfg.latency_mode) {
+        std::cout << "[main] --latency-mode CPU pinning requires Linux, "
+                     "only setting libtorch thread counts" << std::endl;
+    }
+    if (cfg.shards > 1) {
+        std::cout << "[main] --shards requires SO_REUSEPORT (Linux), using 1" << std::endl;
+        cfg.shards = 1;
+    }
+    if (!cfg.shm_socket.empty()) {
+        std::cout << "[main] --shm requires Linux, disabled" << std::endl;
+        cfg.shm_socket.clear();
+    }
+    if (!cfg.unix_socket.empty()) {
+        std::cout << "[main] --unix requires Linux, using UDP" << std::endl;
+        cfg.unix_socket.clear();
+    }
+    if (cfg.pipeline_depth > 0) {
+        std::cout << "[main] --pipeline requires Linux, disabled" << std::endl;
+        cfg.pipeline_depth = 0;
+    }
+#endif
+    if (!cfg.unix_socket.empty() && cfg.shards > 1) {
+        std::cout << "[main] --unix serves a single socket, using 1 shard" << std::endl;
+        cfg.shards = 1;
+    }
 
-    std::cout << "[main] Inference server running. Press Ctrl+C to stop." << std::endl;
+    // Latency mode: confine the process (and so every thread created from
+    // here on: libtorch pools, capture writer) to the torch CPUs; the
+    // network threads pin themselves to their own CPU before running.
+    CpuPlan cpu_plan;
+    if (cfg.latency_mode) {
+        cpu_plan = make_cpu_plan(cfg);
+        pin_current_thread(cpu_plan.torch);
+        torch::set_num_threads(cpu_plan.intra_threads);
+        try {
+            torch::set_num_interop_threads(cfg.interop_threads);
+        } catch (const std::exception& e) {
+            std::cerr << "[main] set_num_interop_threads: " << e.what() << std::endl;
+        }
+        warm_up_torch();
+        report_cpu_plan(cfg, cpu_plan);
+    }
 
-    uint64_t total_skipped = 0;
+    // Initialize components
+    // All shards bind the same port; the kernel spreads sources across them.
+    std::vector<std::unique_ptr<UdpServer>> servers;
+    if (!cfg.unix_socket.empty()) {
+        servers.push_back(std::make_unique<UdpServer>(cfg.unix_socket));
+    }
+    for (int s = static_cast<int>(servers.size()); s < cfg.shards; ++s) {
+        servers.push_back(std::make_unique<UdpServer>(
+            cfg.listen_port, cfg.send_port, /*reuse_port=*/cfg.shards > 1));
+    }
+    if (cfg.shards > 1 && !servers[0]->attach_reuseport_hash(cfg.shards)) {
+        // Pin each instance to one shard (v1: by source IP, v2: by IP and port).
+        // Under the kernel's 4-tuple hash a v1 client that changes ports
+        // could reach two shards, whose Dispatchers would both own its id.
+        std::cerr << "[main] --shards needs the source-IP reuseport hash, using 1" << std::endl;
+        servers.resize(1);
+        cfg.shards = 1;
+    }
+    if (cfg.so_busy_poll_us > 0 && cfg.unix_socket.empty()) {
+        for (auto& srv : servers) srv->set_busy_poll(cfg.so_busy_poll_us);
+    }
 
-    while (true) {
-        // 1. Receive all pending packets
-        auto packets = server.recv_all();
+    // Shared-memory clients are served by shard 0
+    std::unique_ptr<ShmServer> shm;
+    if (!cfg.shm_socket.empty()) {
+        shm = std::make_unique<ShmServer>(cfg.shm_socket, cfg.shm_slots);
+    }
 
-        if (packets.empty()) {
-            // No data: sleep briefly to avoid busy-wait
-            std::this_thread::sleep_for(std::chrono::microseconds(100));
-            // Continue to periodic tasks
-        }
+    // Raw datagram capture, shared by all shards
+    std::unique_ptr<PacketCapture> capture;
+    if (!cfg.capture_path.empty()) {
+        capture = std::make_unique<PacketCapture>(cfg.capture_path);
+    }
 
-        // ============================================================
-        // Phase 1: Classify packets — keep DONE + latest STATE per instance
-        // This prevents buffer overflow from dropping critical DONE packets.
-        // With 3 WC3 containers sending ~100 STATE/s each, processing
-        // every STATE is impossible (~12ms per inference × 300 pkt/s).
-        // Instead, only process the LATEST STATE per instance per cycle.
-        // ============================================================
-        struct ClassifiedPacket {
-            std::string addr;
-            std::string inst_id;
-            const uint8_t* data;
-            size_t size;
-            uint8_t msg_type;
-            uint32_t tick;
-        };
-
-        std::vector<ClassifiedPacket> done_packets;
-        // inst_id → index into packets (latest STATE per instance)
-        std::unordered_map<std::string, size_t> latest_state;
-        uint64_t skipped_this_cycle = 0;
-
-        for (size_t pi = 0; pi < packets.size(); ++pi) {
-            auto& [addr, raw_data] = packets[pi];
-            if (raw_data.size() < sizeof(PacketHeader)) continue;
-
-            const PacketHeader* hdr = reinterpret_cast<const PacketHeader*>(raw_data.data());
-            if (hdr->magic != MAGIC || hdr->version != PROTO_VERSION) continue;
-
-            std::string inst_id = instance_key(addr);
-
-            if (hdr->msg_type == MSG_DONE) {
-                done_packets.push_back({addr, inst_id, raw_data.data(), raw_data.size(),
-                                        hdr->msg_type, hdr->tick});
-            } else if (hdr->msg_type == MSG_STATE) {
-                auto it = latest_state.find(inst_id);
-                if (it != latest_state.end()) {
-                    // Already have a STATE for this instance — keep the newer one
-                    auto& prev = packets[it->second];
-                    const PacketHeader* prev_hdr = reinterpret_cast<const PacketHeader*>(prev.second.data());
-                    if (hdr->tick >= prev_hdr->tick) {
-                        it->second = pi;  // replace with newer
-                    }
-                    ++skipped_this_cycle;
-                } else {
-                    latest_state[inst_id] = pi;
-                }
-            }
-        }
-        total_skipped += skipped_this_cycle;
-
-        // ============================================================
-        // Phase 2: Process DONE packets first (critical, never skip)
-        // ============================================================
-        for (auto& dp : done_packets) {
-            if (dp.size < sizeof(DonePacket)) continue;
-            const DonePacket* done = reinterpret_cast<const DonePacket*>(dp.data);
-
-            std::cout << "[main] DONE from " << dp.inst_id
-                      << " winner=" << (int)done->winner
-                      << " reason=" << (int)done->reason
-                      << " score=" << done->score_team0 << "-" << done->score_team1
-                      << " tick=" << dp.tick
-                      << std::endl;
-
-            // Compute terminal rewards
-            auto it = instances.find(dp.inst_id);
-            if (it != instances.end()) {
-                auto terminal_r = it->second.reward_calc.compute_terminal(
-                    done->winner, done->reason);
-
-                writer.mark_last_done(dp.inst_id, terminal_r);
-                writer.flush_episode(dp.inst_id);
-                instances.erase(it);
-            }
+    InferenceEngine engine(cfg.model_dir, device, cfg.grouped_heroes);
+    RolloutWriter writer(cfg.rollout_dir);
 
-            // Remove from latest_state if present (don't process STATE after DONE)
-            latest_state.erase(dp.inst_id);
-        }
+    std::vector<std::unique_ptr<Dispatcher>> dispatchers;
+    for (int s = 0; s < cfg.shards; ++s) {
+        dispatchers.push_back(std::make_unique<Dispatcher>(
+            s, servers[s].get(), engine, writer, device,
+            s == 0 ? shm.get() : nullptr, capture.get()));
+        dispatchers.back()->set_flow_control(cfg.flow_control_ms);
+        dispatchers.back()->set_deadline(cfg.deadline_ms);
+        dispatchers.back()->set_idle_eviction(cfg.idle_timeout_sec, cfg.idle_discard);
+        // Stage threads start here, on the torch CPUs in latency mode
+        dispatchers.back()->start_pipeline(cfg.pipeline_depth);
+    }
 
-        // ============================================================
-        // Phase 3: Process latest STATE per instance
-        // ============================================================
-        for (auto& [inst_id, pkt_idx] : latest_state) {
-            auto& [addr, raw_data] = packets[pkt_idx];
-
-            // Parse binary state
-            PacketHeader header;
-            GlobalState global;
-            UnitState units[MAX_UNITS];
-            std::vector<Event> events;
-            std::vector<uint8_t> pathability, vis_t0, vis_t1;
-            std::vector<CreepState> creeps;
-
-            if (!state_encoder::parse_packet(raw_data.data(), raw_data.size(),
-                                             header, global, units,
-                                             events, pathability, vis_t0, vis_t1,
-                                             creeps)) {
-                std::cerr << "[main] Failed to parse STATE from " << addr << std::endl;
-                continue;
-            }
+    // Periodic tasks run from timers on shard 0's loop
+    EventLoop loop(servers[0]->fd());
 
-            ++total_packets;
-
-            // Get or create instance state
-            auto& inst = instances[inst_id];
-            if (inst.last_tick == 0 && header.tick > 0) {
-                std::cout << "[main] New instance: " << inst_id
-                          << " tick=" << header.tick << std::endl;
-            } else if (inst.last_tick > 0 && header.tick < inst.last_tick) {
-                // Tick went backwards → new episode from same IP
-                std::cout << "[main] Tick reset: " << inst_id
-                          << " old_tick=" << inst.last_tick
-                          << " new_tick=" << header.tick << std::endl;
-                std::array<float, MAX_UNITS> zero_rewards{};
-                writer.mark_last_done(inst_id, zero_rewards);
-                writer.flush_episode(inst_id);
-                inst = InstanceState{};  // reset
-            }
-            inst.last_tick = header.tick;
-            inst.last_recv_time = std::chrono::steady_clock::now();
-
-            // Encode state -> tensors (with distance-sorted enemies)
-            std::cerr << "[main] Encoding state..." << std::endl;
-            EncodedObs obs = state_encoder::encode(units, global, pathability, vis_t0, vis_t1, creeps);
-            MaskSet masks = state_encoder::encode_masks(units, &obs.sort_map);
-
-            // Compute rewards (from previous state to current)
-            std::cerr << "[main] Computing rewards..." << std::endl;
-            auto rewards = inst.reward_calc.compute(
-                units, global, events, inst.prev_units, inst.prev_global, inst.has_prev);
-            std::cerr << "[main] Rewards done, starting inference..." << std::endl;
-
-            // Save INPUT hidden states BEFORE inference (for rollout storage)
-            std::array<torch::Tensor, MAX_UNITS> input_hx_h;
-            std::array<torch::Tensor, MAX_UNITS> input_hx_c;
-
-            // Run inference for all 12 heroes
-            std::array<InferenceEngine::InferResult, MAX_UNITS> results;
-
-            for (int i = 0; i < MAX_UNITS; ++i) {
-                std::string hero_id(units[i].hero_id, 4);
-
-                // Get or init LSTM hidden state
-                if (inst.hx_h.find(hero_id) == inst.hx_h.end()) {
-                    auto [h, c] = engine.init_hidden();
-                    inst.hx_h[hero_id] = h;
-                    inst.hx_c[hero_id] = c;
-                }
-
-                // Save INPUT hx before inference (detach + cpu for storage)
-                input_hx_h[i] = inst.hx_h[hero_id].detach().cpu();
-                input_hx_c[i] = inst.hx_c[hero_id].detach().cpu();
-
-                // Slice per-agent tensors: (12, ...) -> (1, ...)
-                auto self_i   = obs.self_vec[i].unsqueeze(0).to(device);
-                auto ally_i   = obs.ally_vec[i].unsqueeze(0).to(device);
-                auto enemy_i  = obs.enemy_vec[i].unsqueeze(0).to(device);
-                auto global_i = obs.global_vec[i].unsqueeze(0).to(device);
-                auto grid_i   = obs.grid[i].unsqueeze(0).to(device);
-
-                // Per-agent masks
-                std::unordered_map<std::string, torch::Tensor> agent_masks;
-                for (const auto& [name, mask_tensor] : masks.masks) {
-                    agent_masks[name] = mask_tensor[i].unsqueeze(0).to(device);
-                }
-
-                try {
-                    results[i] = engine.infer_hero(
-                        hero_id, self_i, ally_i, enemy_i, global_i, grid_i,
-                        inst.hx_h[hero_id], inst.hx_c[hero_id],
-                        agent_masks
-                    );
-                } catch (const std::exception& e) {
-                    std::cerr << "[main] Inference error hero=" << hero_id
-                              << " i=" << i << ": " << e.what() << std::endl;
-                    // Print mask shapes for debugging
-                    for (const auto& [mname, mt] : agent_masks) {
-                        std::cerr << "  mask[" << mname << "] shape=";
-                        for (int d = 0; d < mt.dim(); ++d) std::cerr << mt.size(d) << (d+1<mt.dim()? "x" : "");
-                        std::cerr << std::endl;
-                    }
-                    // Use default (no-op) result
-                    results[i].actions["move"] = torch::zeros({1, 2});
-                    results[i].actions["point"] = torch::zeros({1, 2});
-                    results[i].log_prob = torch::zeros({1});
-                    results[i].value = torch::zeros({1});
-                    results[i].new_h = inst.hx_h[hero_id];
-                    results[i].new_c = inst.hx_c[hero_id];
-                    const auto& heads = discrete_heads();
-                    for (int h = 0; h < NUM_DISCRETE_HEADS; ++h)
-                        results[i].actions[heads[h].name] = torch::zeros({1}, torch::kLong);
-                }
-
-                // Update LSTM hidden state
-                inst.hx_h[hero_id] = results[i].new_h;
-                inst.hx_c[hero_id] = results[i].new_c;
-
-                ++total_inferences;
-            }
+    if (shm) {
+        loop.add_reader(shm->listen_fd(), [&]() { shm->accept_clients(); });
+        loop.add_reader(shm->doorbell_fd(), [&]() { shm->drain_doorbell(); });
+        loop.add_timer(std::chrono::seconds(1), [&]() { shm->reap_clients(); });
+    }
 
-            // Store transitions in rollout buffer
-            if (inst.has_prev) {
-                for (int i = 0; i < MAX_UNITS; ++i) {
-                    writer.store(
-                        inst_id, i,
-                        obs.self_vec[i],
-                        obs.ally_vec[i],
-                        obs.enemy_vec[i],
-                        obs.global_vec[i],
-                        obs.grid[i],
-                        [&]() -> std::unordered_map<std::string, torch::Tensor> {
-                            std::unordered_map<std::string, torch::Tensor> m;
-                            for (const auto& [name, t] : masks.masks) {
-                                m[name] = t[i];
-                            }
-                            return m;
-                        }(),
-                        results[i].actions,
-                        results[i].log_prob.item<float>(),
-                        results[i].value.item<float>(),
-                        rewards[i],
-                        false,  // not done
-                        input_hx_h[i],
-                        input_hx_c[i],
-                        // FATE v2 parameters
-                        events,
-                        inst.prev_units,
-                        units,
-                        inst.prev_global,
-                        global,
-                        0  // model_version (no version tracking yet)
-                    );
-                }
-            }
+    // Model hot-reload check
+    loop.add_timer(std::chrono::seconds(std::max(1, cfg.reload_interval_sec)), [&]() {
+        engine.maybe_reload();
+    });
 
-            // Save current state as previous for next tick
-            std::memcpy(inst.prev_units, units, sizeof(UnitState) * MAX_UNITS);
-            inst.prev_global = global;
-            inst.has_prev = true;
+    // Episodes end via DONE packet or tick reset; with --idle-timeout each
+    // shard's loop also evicts instances that went silent (Dispatcher::run)
 
-            // Send ACTION packet back (with enemy sort mapping for target remapping)
-            send_action_packet(server, addr, header.tick, results, units, &obs.sort_map);
+    // Rollout dump check
+    loop.add_timer(std::chrono::seconds(1), [&]() {
+        writer.maybe_dump(cfg.rollout_size);
+    });
+
+    // Stats logging every 30 seconds (summed over shards)
+    std::array<PipeTotals, NUM_PIPE_STAGES> pipe_prev{};  // totals at the last report
+    auto pipe_last = std::chrono::steady_clock::now();
+    loop.add_timer(std::chrono::seconds(30), [&]() {
+        uint64_t packets = 0, inferences = 0, instances = 0, skipped = 0;
+        uint64_t dones = 0, duplicate_dones = 0, compact_actions = 0, compact_bytes = 0;
+        uint64_t flow_updates = 0, forwards = 0, deadline_misses = 0;
+        uint64_t evicted = 0, reclaimed_bytes = 0;
+        for (const auto& d : dispatchers) {
+            packets    += d->total_packets;
+            inferences += d->total_inferences;
+            forwards   += d->total_forwards;
+            instances  += d->active_instances;
+            skipped    += d->total_skipped;
+            dones           += d->total_dones;
+            duplicate_dones += d->total_duplicate_dones;
+            compact_actions += d->total_compact_actions;
+            compact_bytes   += d->total_compact_bytes;
+            flow_updates    += d->total_flow_updates;
+            deadline_misses += d->total_deadline_misses;
+            evicted         += d->total_evicted;
+            reclaimed_bytes += d->total_reclaimed_bytes;
         }
-
-        // --------------------------------------------------------
-        // Periodic tasks
-        // --------------------------------------------------------
-        auto now = std::chrono::steady_clock::now();
-
-        // Model hot-reload check
-        auto reload_elapsed = std::chrono::duration_cast<std::chrono::seconds>(
-            now - last_reload).count();
-        if (reload_elapsed >= cfg.reload_interval_sec) {
-            engine.maybe_reload();
-            last_reload = now;
+        std::cout << "[main] Stats: " << packets << " packets, "
+                  << inferences << " inferences in " << forwards << " forwards, "
+                  << instances << " active instances, "
+                  << skipped << " skipped, "
+                  << dones << " DONEs (" << duplicate_dones << " retransmitted)";
+        if (shm) {
+            std::cout << ", " << shm->active_clients() << " shm clients, "
+                      << shm->dropped_sends() << " shm drops";
+        }
+        if (compact_actions) {
+            std::cout << ", " << compact_actions << " compact ACTIONs (avg "
+                      << compact_bytes / compact_actions << " body bytes)";
+        }
+        if (cfg.flow_control_ms > 0)
+            std::cout << ", " << flow_updates << " flow-control updates";
+        if (cfg.deadline_ms > 0)
+            std::cout << ", " << deadline_misses << " deadline misses (last ACTION held)";
+        if (cfg.idle_timeout_sec > 0) {
+            std::cout << ", " << evicted << " idle evictions ("
+                      << reclaimed_bytes / (1024 * 1024) << " MB reclaimed)";
+        }
+        uint64_t frag_completed = 0, frag_dropped = 0;
+        for (const auto& srv : servers) {
+            frag_completed += srv->frag_completed();
+            frag_dropped   += srv->frag_dropped();
+        }
+        if (frag_completed || frag_dropped) {
+            std::cout << ", " << frag_completed << " reassembled ("
+                      << frag_dropped << " incomplete dropped)";
+        }
+        if (capture) {
+            std::cout << ", captured " << capture->records() << " ("
+                      << capture->dropped() << " dropped)";
+        }
+        std::cout << std::endl;
+        if (cfg.pipeline_depth > 0) {
+            print_pipeline_report(dispatchers, pipe_prev, pipe_last);
         }
 
-        // No timeout — episodes end only via DONE packet or tick reset
+        // Per-instance latency since the last report
+        std::unordered_map<InstanceId, InstanceLatency> latency;
+        for (const auto& d : dispatchers) d->take_latency(latency);
+        print_latency_report(latency);
+    });
+
+    // Shards 1..N-1 get their own thread and event loop
+    std::vector<std::thread> threads;
+    for (int s = 1; s < cfg.shards; ++s) {
+        threads.emplace_back([&, s]() {
+            if (cfg.latency_mode) {
+                warm_up_torch();   // this thread's intra-op pool, still on the torch CPUs
+                if (!pin_current_thread({cpu_plan.net[s]}))
+                    std::cerr << "[main] Could not pin shard " << s << " to CPU "
+                              << cpu_plan.net[s] << std::endl;
+            }
+            EventLoop shard_loop(servers[s]->fd());
+            dispatchers[s]->run(shard_loop, cfg.busy_poll_us);
+        });
+    }
 
-        // Rollout dump check
-        writer.maybe_dump(cfg.rollout_size);
+    std::cout << "[main] Inference server running ("
+              << cfg.shards << " shard" << (cfg.shards > 1 ? "s" : "")
+              << "). Press Ctrl+C to stop." << std::endl;
 
-        // Stats logging every 30 seconds
-        auto stats_elapsed = std::chrono::duration_cast<std::chrono::seconds>(
-            now - last_stats).count();
-        if (stats_elapsed >= 30) {
-            std::cout << "[main] Stats: " << total_packets << " packets, "
-                      << total_inferences << " inferences, "
-                      << instances.size() << " active instances, "
-                      << total_skipped << " skipped" << std::endl;
-            last_stats = now;
-        }
+    if (cfg.latency_mode && !pin_current_thread({cpu_plan.net[0]})) {
+        std::cerr << "[main] Could not pin shard 0 to CPU " << cpu_plan.net[0] << std::endl;
     }
+    dispatchers[0]->run(loop, cfg.busy_poll_us);
 
+    for (auto& t : threads) t.join();
     return 0;
 }
@@ -25,7 +25,7 @@ RolloutWriter::RolloutWriter(const std::string& rollout_dir)
 // ============================================================
 
 void RolloutWriter::store(
-    const std::string& instance_id,
+    InstanceId instance_id,
     int agent_idx,
     const torch::Tensor& self_vec,
     const torch::Tensor& ally_vec,
@@ -98,7 +98,7 @@ void RolloutWriter::store(
 // ============================================================
 
 void RolloutWriter::mark_last_done(
-    const std::string& instance_id,
+    InstanceId instance_id,
     const std::array<float, MAX_UNITS>& terminal_rewards)
 {
     std::lock_guard<std::mutex> lock(mutex_);
@@ -119,7 +119,7 @@ void RolloutWriter::mark_last_done(
 // flush_episode: Group all 12 agents into a single CompletedEpisode
 // ============================================================
 
-void RolloutWriter::flush_episode(const std::string& instance_id) {
+void RolloutWriter::flush_episode(InstanceId instance_id) {
     std::lock_guard<std::mutex> lock(mutex_);
 
     auto it = buffers_.find(instance_id);
@@ -139,6 +139,48 @@ void RolloutWriter::flush_episode(const std::string& instance_id) {
     buffers_.erase(it);
 }
 
+// ============================================================
+// discard_episode: Drop a partial episode (idle eviction)
+// ============================================================
+
+size_t RolloutWriter::discard_episode(InstanceId instance_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = buffers_.find(instance_id);
+    if (it == buffers_.end()) return 0;
+
+    const size_t bytes = trajectories_bytes(it->second);
+    buffers_.erase(it);
+    return bytes;
+}
+
+size_t RolloutWriter::buffered_bytes(InstanceId instance_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = buffers_.find(instance_id);
+    return it == buffers_.end() ? 0 : trajectories_bytes(it->second);
+}
+
+size_t RolloutWriter::trajectories_bytes(
+    const std::array<std::vector<Transition>, MAX_UNITS>& agents) {
+    size_t bytes = 0;
+    for (const auto& traj : agents) {
+        for (const auto& t : traj) bytes += transition_bytes(t);
+    }
+    return bytes;
+}
+
+size_t RolloutWriter::transition_bytes(const Transition& t) {
+    size_t bytes = sizeof(Transition) + t.events.capacity() * sizeof(Event);
+    for (const torch::Tensor* x : {&t.self_vec, &t.ally_vec, &t.enemy_vec, &t.global_vec,
+                                   &t.grid, &t.hx_h, &t.hx_c}) {
+        if (x->defined()) bytes += x->nbytes();
+    }
+    for (const auto& [name, x] : t.masks) bytes += name.capacity() + x.nbytes();
+    for (const auto& [name, x] : t.actions) bytes += name.capacity() + x.nbytes();
+    return bytes;
+}
+
 // ============================================================
 // maybe_dump: Write .pt files if we have enough transitions
 // ============================================================
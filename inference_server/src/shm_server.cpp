@@ -0,0 +1,333 @@
+#include "shm_server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+#endif
+
+#ifdef __linux__
+
+// ============================================================
+// Constructor / Destructor
+// ============================================================
+
+ShmServer::ShmServer(const std::string& socket_path, int num_slots)
+    : socket_path_(socket_path), num_slots_(num_slots), clients_(num_slots)
+{
+    if (num_slots <= 0) {
+        throw std::runtime_error("ShmServer: num_slots must be positive");
+    }
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("ShmServer: socket path too long: " + socket_path);
+    }
+    std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+    // Segment: header + rings for every slot
+    size_ = shm_segment_size(static_cast<uint32_t>(num_slots));
+    memfd_ = memfd_create("fate_rl_shm", MFD_CLOEXEC);
+    if (memfd_ < 0) {
+        throw std::runtime_error("memfd_create failed: " + std::to_string(errno));
+    }
+    if (ftruncate(memfd_, static_cast<off_t>(size_)) != 0) {
+        close(memfd_);
+        throw std::runtime_error("ftruncate(shm) failed: " + std::to_string(errno));
+    }
+    base_ = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, memfd_, 0);
+    if (base_ == MAP_FAILED) {
+        close(memfd_);
+        throw std::runtime_error("mmap(shm) failed: " + std::to_string(errno));
+    }
+
+    auto* hdr = static_cast<ShmSegmentHeader*>(base_);
+    hdr->magic = SHM_MAGIC;
+    hdr->version = SHM_VERSION;
+    hdr->num_slots = static_cast<uint32_t>(num_slots);
+    hdr->ring_bytes = static_cast<uint32_t>(SHM_RING_BYTES);
+    for (int i = 0; i < num_slots; ++i) {
+        ShmSlot* slot = shm_slot(base_, static_cast<uint32_t>(i));
+        for (ShmRing* r : {&slot->to_server, &slot->to_client}) {
+            new (&r->head) std::atomic<uint64_t>(0);
+            new (&r->tail) std::atomic<uint64_t>(0);
+            new (&r->consumer_waiting) std::atomic<uint32_t>(0);
+        }
+    }
+
+    // Server doorbell: every client rings this one
+    doorbell_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (doorbell_fd_ < 0) {
+        munmap(base_, size_);
+        close(memfd_);
+        throw std::runtime_error("eventfd failed: " + std::to_string(errno));
+    }
+
+    // Handshake socket
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    unlink(socket_path.c_str());
+    if (listen_fd_ < 0
+        || bind(listen_fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0
+        || listen(listen_fd_, 16) != 0) {
+        int err = errno;
+        if (listen_fd_ >= 0) close(listen_fd_);
+        close(doorbell_fd_);
+        munmap(base_, size_);
+        close(memfd_);
+        throw std::runtime_error("ShmServer: bind/listen " + socket_path
+                                 + " failed: " + std::to_string(err));
+    }
+
+    received_.reserve(static_cast<size_t>(num_slots) * 4);
+
+    std::cout << "[ShmServer] Listening on " << socket_path
+              << " (" << num_slots << " slots, "
+              << (size_ >> 10) << " KB segment)" << std::endl;
+}
+
+ShmServer::~ShmServer() {
+    for (int i = 0; i < num_slots_; ++i) {
+        if (clients_[i].active) detach(i);
+    }
+    if (listen_fd_ >= 0) {
+        close(listen_fd_);
+        unlink(socket_path_.c_str());
+    }
+    if (doorbell_fd_ >= 0) close(doorbell_fd_);
+    if (base_ && base_ != MAP_FAILED) munmap(base_, size_);
+    if (memfd_ >= 0) close(memfd_);
+}
+
+// ============================================================
+// Client attach / detach
+// ============================================================
+
+void ShmServer::accept_clients() {
+    while (true) {
+        int conn = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (conn < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                std::cerr << "[ShmServer] accept error: " << errno << std::endl;
+            return;
+        }
+
+        int slot = -1;
+        for (int i = 0; i < num_slots_; ++i) {
+            if (!clients_[i].active) { slot = i; break; }
+        }
+
+        ShmHello hello;
+        hello.magic = SHM_MAGIC;
+        hello.version = SHM_VERSION;
+        hello.slot = slot >= 0 ? static_cast<uint32_t>(slot) : SHM_NO_SLOT;
+        hello.num_slots = static_cast<uint32_t>(num_slots_);
+        hello.segment_size = size_;
+
+        int client_doorbell = -1;
+        if (slot >= 0) {
+            // Fresh rings before the client can see them
+            ShmSlot* s = shm_slot(base_, static_cast<uint32_t>(slot));
+            for (ShmRing* r : {&s->to_server, &s->to_client}) {
+                r->head.store(0, std::memory_order_relaxed);
+                r->tail.store(0, std::memory_order_relaxed);
+                r->consumer_waiting.store(0, std::memory_order_relaxed);
+            }
+
+            client_doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (client_doorbell < 0) {
+                std::cerr << "[ShmServer] eventfd error: " << errno << std::endl;
+                close(conn);
+                continue;
+            }
+        }
+
+        // Reply: ShmHello + [memfd, server doorbell, client doorbell]
+        struct iovec iov;
+        iov.iov_base = &hello;
+        iov.iov_len = sizeof(hello);
+        int fds[3] = {memfd_, doorbell_fd_, client_doorbell};
+        alignas(struct cmsghdr) char ctrl[CMSG_SPACE(sizeof(fds))];
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        if (slot >= 0) {
+            msg.msg_control = ctrl;
+            msg.msg_controllen = sizeof(ctrl);
+            struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+            cm->cmsg_level = SOL_SOCKET;
+            cm->cmsg_type = SCM_RIGHTS;
+            cm->cmsg_len = CMSG_LEN(sizeof(fds));
+            std::memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+        }
+        if (sendmsg(conn, &msg, MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(hello))) {
+            std::cerr << "[ShmServer] handshake send error: " << errno << std::endl;
+            if (client_doorbell >= 0) close(client_doorbell);
+            close(conn);
+            continue;
+        }
+
+        if (slot < 0) {
+            std::cerr << "[ShmServer] No free slot, client rejected" << std::endl;
+            close(conn);
+            continue;
+        }
+
+        ShmSlot* s = shm_slot(base_, static_cast<uint32_t>(slot));
+        Client& c = clients_[slot];
+        c.active = true;
+        c.conn_fd = conn;
+        c.doorbell_fd = client_doorbell;
+        c.in = ShmConsumer(&s->to_server);
+        c.out = ShmProducer(&s->to_client);
+        c.pending = 0;
+
+        std::cout << "[ShmServer] Client attached: slot " << slot << std::endl;
+    }
+}
+
+void ShmServer::reap_clients() {
+    for (int i = 0; i < num_slots_; ++i) {
+        Client& c = clients_[i];
+        if (!c.active) continue;
+        char b;
+        ssize_t n = recv(c.conn_fd, &b, 1, MSG_DONTWAIT | MSG_PEEK);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            std::cout << "[ShmServer] Client detached: slot " << i << std::endl;
+            detach(i);
+        }
+    }
+}
+
+void ShmServer::detach(int slot) {
+    Client& c = clients_[slot];
+    if (c.conn_fd >= 0) close(c.conn_fd);
+    if (c.doorbell_fd >= 0) close(c.doorbell_fd);
+    c = Client{};
+
+    // Drop views into this slot's ring from the current batch
+    received_.erase(std::remove_if(received_.begin(), received_.end(),
+                                   [slot](const Datagram& d) { return d.shm_slot == slot; }),
+                    received_.end());
+}
+
+int ShmServer::active_clients() const {
+    int n = 0;
+    for (const auto& c : clients_) n += c.active ? 1 : 0;
+    return n;
+}
+
+// ============================================================
+// recv_all: zero-copy views into every client's to_server ring
+// ============================================================
+
+const std::vector<Datagram>& ShmServer::recv_all() {
+    received_.clear();
+    const int64_t now_ns = realtime_ns();   // rings carry no timestamps
+    for (int i = 0; i < num_slots_; ++i) {
+        Client& c = clients_[i];
+        if (!c.active) continue;
+
+        // Previous batch is done: hand its space back to the client
+        c.in.release();
+
+        size_t len;
+        while (const uint8_t* p = c.in.peek(len)) {
+            Datagram dg;
+            dg.data = p;
+            dg.len = len;
+            dg.shm_slot = i;
+            dg.rx_ns = now_ns;
+            received_.push_back(dg);
+        }
+    }
+    return received_;
+}
+
+// ============================================================
+// reserve_send / flush_sends
+// ============================================================
+
+uint8_t* ShmServer::reserve_send(int slot, size_t len) {
+    if (slot < 0 || slot >= num_slots_ || !clients_[slot].active) {
+        ++dropped_sends_;
+        return nullptr;
+    }
+    Client& c = clients_[slot];
+    uint8_t* p = c.out.reserve(len);
+    if (!p) {
+        ++dropped_sends_;
+        return nullptr;
+    }
+    ++c.pending;
+    return p;
+}
+
+size_t ShmServer::flush_sends() {
+    size_t published = 0;
+    for (auto& c : clients_) {
+        if (!c.active || c.pending == 0) continue;
+        published += c.pending;
+        c.pending = 0;
+        if (c.out.commit()) {
+            uint64_t one = 1;
+            if (write(c.doorbell_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+                std::cerr << "[ShmServer] doorbell write error: " << errno << std::endl;
+        }
+    }
+    return published;
+}
+
+// ============================================================
+// Sleep handshake with the clients' producers
+// ============================================================
+
+bool ShmServer::prepare_wait() {
+    bool pending = false;
+    for (auto& c : clients_) {
+        if (c.active && c.in.prepare_wait()) pending = true;
+    }
+    return pending;
+}
+
+void ShmServer::end_wait() {
+    for (auto& c : clients_) {
+        if (c.active) c.in.end_wait();
+    }
+}
+
+void ShmServer::drain_doorbell() {
+    uint64_t count;
+    while (read(doorbell_fd_, &count, sizeof(count)) == sizeof(count)) {}
+}
+
+#else  // !__linux__
+
+ShmServer::ShmServer(const std::string& socket_path, int num_slots)
+    : socket_path_(socket_path), num_slots_(num_slots)
+{
+    throw std::runtime_error("ShmServer: shared-memory transport requires Linux");
+}
+
+ShmServer::~ShmServer() {}
+
+const std::vector<Datagram>& ShmServer::recv_all() { return received_; }
+uint8_t* ShmServer::reserve_send(int, size_t) { return nullptr; }
+size_t ShmServer::flush_sends() { return 0; }
+bool ShmServer::prepare_wait() { return false; }
+void ShmServer::end_wait() {}
+void ShmServer::accept_clients() {}
+void ShmServer::drain_doorbell() {}
+void ShmServer::reap_clients() {}
+void ShmServer::detach(int) {}
+int ShmServer::active_clients() const { return 0; }
+
+#endif
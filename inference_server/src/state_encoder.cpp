@@ -4,9 +4,94 @@
 #include <cmath>
 #include <cstring>
 #include <iostream>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 namespace state_encoder {
 
+// Index of the lowest set bit (x != 0)
+static inline int lowest_bit(uint64_t x) {
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward64(&i, x);
+    return static_cast<int>(i);
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+// ============================================================
+// Visibility grid decoding (raw bytes, bit-packed or RLE)
+// ============================================================
+
+// Set bits [begin, end) using whole-word masks
+static void set_bit_range(uint64_t* words, int begin, int end) {
+    while (begin < end) {
+        int w = begin >> 6;
+        int lo = begin & 63;
+        int hi = std::min(64, lo + (end - begin));
+        uint64_t mask = (hi == 64 ? ~0ULL : ((1ULL << hi) - 1)) & ~((1ULL << lo) - 1);
+        words[w] |= mask;
+        begin += hi - lo;
+    }
+}
+
+static bool read_vis_grid(const uint8_t* data, size_t len, size_t& offset,
+                          uint8_t grid_flags, VisGrid& out, const char* name)
+{
+    std::memset(out.words, 0, sizeof(out.words));
+
+    if (grid_flags & GRID_VIS_BITS) {
+        if (offset + VIS_PACKED_BYTES > len) {
+            std::cerr << "[state_encoder] Packet truncated at " << name << std::endl;
+            return false;
+        }
+        // LSB-first bytes == little-endian words
+        std::memcpy(out.words, data + offset, VIS_PACKED_BYTES);
+        offset += VIS_PACKED_BYTES;
+        return true;
+    }
+
+    if (grid_flags & GRID_VIS_RLE) {
+        uint16_t num_runs;
+        if (offset + sizeof(num_runs) > len) {
+            std::cerr << "[state_encoder] Packet truncated at " << name << std::endl;
+            return false;
+        }
+        std::memcpy(&num_runs, data + offset, sizeof(num_runs));
+        offset += sizeof(num_runs);
+        if (offset + num_runs > len) {
+            std::cerr << "[state_encoder] Packet truncated at " << name << " runs" << std::endl;
+            return false;
+        }
+        int cell = 0;
+        for (uint16_t r = 0; r < num_runs; ++r) {
+            uint8_t run = data[offset + r];
+            int run_len = (run & 0x7F) + 1;
+            if (cell + run_len > GRID_CELLS) {
+                std::cerr << "[state_encoder] " << name << " RLE overruns grid" << std::endl;
+                return false;
+            }
+            if (run & 0x80) set_bit_range(out.words, cell, cell + run_len);
+            cell += run_len;
+        }
+        offset += num_runs;
+        return true;
+    }
+
+    if (offset + GRID_CELLS > len) {
+        std::cerr << "[state_encoder] Packet truncated at " << name << std::endl;
+        return false;
+    }
+    const uint8_t* cells = data + offset;
+    for (int c = 0; c < GRID_CELLS; ++c) {
+        out.words[c >> 6] |= static_cast<uint64_t>(cells[c] != 0) << (c & 63);
+    }
+    offset += GRID_CELLS;
+    return true;
+}
+
 // ============================================================
 // Binary packet parsing
 // ============================================================
@@ -17,45 +102,103 @@ bool parse_packet(const uint8_t* data, size_t len,
                   UnitState units[MAX_UNITS],
                   std::vector<Event>& events,
                   std::vector<uint8_t>& pathability,
-                  std::vector<uint8_t>& vis_t0,
-                  std::vector<uint8_t>& vis_t1,
-                  std::vector<CreepState>& creeps)
+                  VisGrid& vis_t0,
+                  VisGrid& vis_t1,
+                  std::vector<CreepState>& creeps,
+                  KeyframeStore* keyframes,
+                  ActionAck* action_ack)
 {
-    // Minimum size: fixed portion
-    constexpr size_t FIXED_SIZE = sizeof(StatePacketFixed);
-    if (len < FIXED_SIZE) {
-        std::cerr << "[state_encoder] Packet too small: " << len
-                  << " < " << FIXED_SIZE << std::endl;
+    // Minimum size: header + fixed portion of the body
+    if (len < sizeof(PacketHeader)) {
+        std::cerr << "[state_encoder] Packet too small: " << len << std::endl;
         return false;
     }
-
-    const StatePacketFixed* fixed = reinterpret_cast<const StatePacketFixed*>(data);
+    std::memcpy(&header, data, sizeof(PacketHeader));
 
     // Validate magic and version
-    if (fixed->header.magic != MAGIC) {
+    if (header.magic != MAGIC) {
         std::cerr << "[state_encoder] Bad magic: 0x" << std::hex
-                  << fixed->header.magic << std::dec << std::endl;
+                  << header.magic << std::dec << std::endl;
         return false;
     }
-    if (fixed->header.version != PROTO_VERSION) {
-        std::cerr << "[state_encoder] Bad version: " << (int)fixed->header.version << std::endl;
+    if (!is_supported_version(header.version)) {
+        std::cerr << "[state_encoder] Bad version: " << (int)header.version << std::endl;
         return false;
     }
-    if (fixed->header.msg_type != MSG_STATE) {
+    if (header.msg_type != MSG_STATE && header.msg_type != MSG_STATE_DELTA) {
         std::cerr << "[state_encoder] Not a STATE packet: type="
-                  << (int)fixed->header.msg_type << std::endl;
+                  << (int)header.msg_type << std::endl;
         return false;
     }
+    const bool is_delta = header.msg_type == MSG_STATE_DELTA;
+
+    // Body starts after the (v1 or v2) header
+    const size_t hdr_size = header_size(header);
+    const uint8_t* block = nullptr;       // GlobalState + units, wire layout
+    const StateKeyframe* base = nullptr;  // delta only
+    uint8_t rebuilt[STATE_BLOCK_SIZE];
+    size_t offset;
+
+    if (!is_delta) {
+        const size_t FIXED_SIZE = hdr_size + STATE_BLOCK_SIZE + 1;
+        if (len < FIXED_SIZE) {
+            std::cerr << "[state_encoder] Packet too small: " << len
+                      << " < " << FIXED_SIZE << std::endl;
+            return false;
+        }
+        block = data + hdr_size;
+        offset = hdr_size + STATE_BLOCK_SIZE;
+    } else {
+        if (!keyframes) {
+            std::cerr << "[state_encoder] Delta STATE without keyframe history" << std::endl;
+            return false;
+        }
+        offset = hdr_size;
+        if (offset + sizeof(uint32_t) + DELTA_MASK_BYTES > len) {
+            std::cerr << "[state_encoder] Delta packet too small: " << len << std::endl;
+            return false;
+        }
+        uint32_t base_tick;
+        std::memcpy(&base_tick, data + offset, sizeof(base_tick));
+        offset += sizeof(base_tick);
+
+        base = keyframes->find(base_tick);
+        if (!base) {
+            std::cerr << "[state_encoder] Delta keyframe not found: tick="
+                      << base_tick << std::endl;
+            return false;
+        }
+
+        // Keyframe block with the changed chunks patched in
+        const uint8_t* chunk_mask = data + offset;
+        offset += DELTA_MASK_BYTES;
+        std::memcpy(rebuilt, base->block, STATE_BLOCK_SIZE);
+        for (size_t c = 0; c < DELTA_NUM_CHUNKS; ++c) {
+            if (!((chunk_mask[c >> 3] >> (c & 7)) & 1)) continue;
+            size_t pos = c * DELTA_CHUNK;
+            size_t n = std::min(DELTA_CHUNK, STATE_BLOCK_SIZE - pos);
+            if (offset + n > len) {
+                std::cerr << "[state_encoder] Delta packet truncated at chunk " << c << std::endl;
+                return false;
+            }
+            std::memcpy(rebuilt + pos, data + offset, n);
+            offset += n;
+        }
+        block = rebuilt;
+
+        if (offset + 1 > len) {
+            std::cerr << "[state_encoder] Delta packet truncated at num_events" << std::endl;
+            return false;
+        }
+    }
 
-    header = fixed->header;
-    global = fixed->global;
-    std::memcpy(units, fixed->units, sizeof(UnitState) * MAX_UNITS);
+    std::memcpy(&global, block, sizeof(GlobalState));
+    std::memcpy(units, block + sizeof(GlobalState), sizeof(UnitState) * MAX_UNITS);
 
     // Parse events
-    uint8_t num_events = fixed->num_events;
+    uint8_t num_events = data[offset++];
     if (num_events > MAX_EVENTS) num_events = MAX_EVENTS;
 
-    size_t offset = FIXED_SIZE;
     size_t events_size = num_events * sizeof(Event);
     if (offset + events_size > len) {
         std::cerr << "[state_encoder] Packet truncated at events" << std::endl;
@@ -69,16 +212,16 @@ bool parse_packet(const uint8_t* data, size_t len,
     }
     offset += events_size;
 
-    // Parse has_pathability flag
+    // Parse grid flags (has_pathability + visibility encoding)
     if (offset + 1 > len) {
         std::cerr << "[state_encoder] Packet truncated at has_pathability" << std::endl;
         return false;
     }
-    uint8_t has_path = data[offset++];
+    uint8_t grid_flags = data[offset++];
 
     // Parse pathability grid (if present)
     pathability.clear();
-    if (has_path) {
+    if (grid_flags & GRID_HAS_PATHABILITY) {
         if (offset + GRID_CELLS > len) {
             std::cerr << "[state_encoder] Packet truncated at pathability grid" << std::endl;
             return false;
@@ -87,27 +230,36 @@ bool parse_packet(const uint8_t* data, size_t len,
         offset += GRID_CELLS;
     }
 
-    // Parse visibility grids (team 0 and team 1)
-    vis_t0.clear();
-    vis_t1.clear();
+    // Delta: which of the remaining sections are present
+    uint8_t delta_flags = DELTA_VIS_T0 | DELTA_VIS_T1 | DELTA_CREEPS;
+    if (is_delta) {
+        if (offset + 1 > len) {
+            std::cerr << "[state_encoder] Delta packet truncated at flags" << std::endl;
+            return false;
+        }
+        delta_flags = data[offset++];
+    }
 
-    if (offset + GRID_CELLS > len) {
-        std::cerr << "[state_encoder] Packet truncated at visibility_t0" << std::endl;
-        return false;
+    // Parse visibility grids (team 0 and team 1)
+    if (delta_flags & DELTA_VIS_T0) {
+        if (!read_vis_grid(data, len, offset, grid_flags, vis_t0, "visibility_t0"))
+            return false;
+    } else {
+        vis_t0 = base->vis_t0;
     }
-    vis_t0.assign(data + offset, data + offset + GRID_CELLS);
-    offset += GRID_CELLS;
 
-    if (offset + GRID_CELLS > len) {
-        std::cerr << "[state_encoder] Packet truncated at visibility_t1" << std::endl;
-        return false;
+    if (delta_flags & DELTA_VIS_T1) {
+        if (!read_vis_grid(data, len, offset, grid_flags, vis_t1, "visibility_t1"))
+            return false;
+    } else {
+        vis_t1 = base->vis_t1;
     }
-    vis_t1.assign(data + offset, data + offset + GRID_CELLS);
-    offset += GRID_CELLS;
 
     // Parse creep data (optional, for backwards compatibility)
     creeps.clear();
-    if (offset + 1 <= len) {
+    if (!(delta_flags & DELTA_CREEPS)) {
+        creeps = base->creeps;
+    } else if (offset + 1 <= len) {
         uint8_t num_creeps = data[offset++];
         if (num_creeps > MAX_CREEPS) num_creeps = MAX_CREEPS;
         size_t creeps_size = num_creeps * sizeof(CreepState);
@@ -120,6 +272,28 @@ bool parse_packet(const uint8_t* data, size_t len,
         }
     }
 
+    // ACTION acknowledgement (compact ACTION clients)
+    ActionAck ack;
+    if (grid_flags & STATE_ACTION_ACK) {
+        if (offset + sizeof(uint32_t) > len) {
+            std::cerr << "[state_encoder] Packet truncated at acked_action_tick" << std::endl;
+            return false;
+        }
+        ack.compact = true;
+        std::memcpy(&ack.tick, data + offset, sizeof(ack.tick));
+        offset += sizeof(ack.tick);
+    }
+    if (action_ack) *action_ack = ack;
+
+    // Full STATE: remember it as a keyframe for later deltas
+    if (!is_delta && keyframes) {
+        StateKeyframe& kf = keyframes->push(header.tick);
+        std::memcpy(kf.block, block, STATE_BLOCK_SIZE);
+        kf.vis_t0 = vis_t0;
+        kf.vis_t1 = vis_t1;
+        kf.creeps = creeps;
+    }
+
     return true;
 }
 
@@ -411,33 +585,6 @@ static void encode_global(const GlobalState& g, int my_team, float* out) {
     out[idx++] = 0.0f;  // padding
 }
 
-// ============================================================
-// Portal definitions (entrance <-> exit, bidirectional)
-// ============================================================
-struct PortalDef {
-    float x, y;     // center of entrance rect
-    float ex, ey;   // center of exit rect
-};
-static const PortalDef PORTALS[] = {
-    // Fuyuki <-> Ryudou Temple
-    {-7328.f, 2128.f,  -2048.f, 7296.f},
-    // Fuyuki <-> Tohsaka Mansion
-    {-2288.f, -512.f,  -8000.f, -5376.f},
-    // Fuyuki <-> Matou Mansion
-    {-2800.f, -208.f,  -3328.f, -8256.f},
-    // Fuyuki <-> Einzbern Castle
-    {-6816.f, -1568.f,  6288.f, -6208.f},
-    // Fuyuki <-> Emiya Mansion
-    {-5920.f, 4800.f,  -6912.f, 7488.f},
-    // Fuyuki <-> School
-    {-3856.f, 1152.f,   3072.f, 7360.f},
-    // Fuyuki <-> Church
-    { 6816.f,  -80.f,   7232.f, 9984.f},
-    // Internal warp
-    { 2576.f, 5031.f,   2125.f, 5155.f},
-};
-static constexpr int NUM_PORTALS = sizeof(PORTALS) / sizeof(PORTALS[0]);
-
 // ============================================================
 // Encode grid -> (6, GRID_H, GRID_W) float
 // ch0: pathability, ch1: ally, ch2: visible enemy,
@@ -447,8 +594,8 @@ static void encode_grid(int my_team,
                         int observer_pid,
                         const UnitState units[MAX_UNITS],
                         const std::vector<uint8_t>& pathability,
-                        const std::vector<uint8_t>& vis_t0,
-                        const std::vector<uint8_t>& vis_t1,
+                        const VisGrid& vis_t0,
+                        const VisGrid& vis_t1,
                         const std::vector<CreepState>& creeps,
                         float* out)
 {
@@ -498,6 +645,7 @@ static void encode_grid(int my_team,
 
     // Use observer's team visibility grid to check creep visibility
     const auto& vis_grid = (my_team == 0) ? vis_t0 : vis_t1;
+    VisGrid occupied;  // cells holding a creep HP
 
     for (size_t c = 0; c < creeps.size(); ++c) {
         if (creeps[c].max_hp <= 0.0f) continue;  // skip invalid
@@ -507,12 +655,19 @@ static void encode_grid(int my_team,
         auto [gx, gy] = world_to_grid(creeps[c].x, creeps[c].y);
         int cell = gy * OBS_GRID_W + gx;
 
-        // Always mark position
+        // Always mark position; HP is masked by visibility below
         ch4[cell] = 1.0f;
+        ch5[cell] = hp_ratio;
+        occupied.words[cell >> 6] |= 1ULL << (cell & 63);
+    }
 
-        // HP only if observer's team has visibility of that cell
-        if (!vis_grid.empty() && vis_grid[cell]) {
-            ch5[cell] = hp_ratio;
+    // HP only if observer's team has visibility of that cell: clear the
+    // occupied cells the team cannot see, a word at a time
+    for (int w = 0; w < VisGrid::WORDS; ++w) {
+        uint64_t hidden = occupied.words[w] & ~vis_grid.words[w];
+        while (hidden) {
+            ch5[w * 64 + lowest_bit(hidden)] = 0.0f;
+            hidden &= hidden - 1;
         }
     }
 }
@@ -524,8 +679,8 @@ static void encode_grid(int my_team,
 EncodedObs encode(const UnitState units[MAX_UNITS],
                   const GlobalState& global,
                   const std::vector<uint8_t>& pathability,
-                  const std::vector<uint8_t>& vis_t0,
-                  const std::vector<uint8_t>& vis_t1,
+                  const VisGrid& vis_t0,
+                  const VisGrid& vis_t1,
                   const std::vector<CreepState>& creeps)
 {
     EncodedObs obs;
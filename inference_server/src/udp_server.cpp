@@ -1,10 +1,35 @@
 #include "udp_server.h"
+#include "protocol.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
 #include <cstring>
 #include <stdexcept>
 #include <iostream>
 #include <sstream>
 
+#ifdef __linux__
+#include <linux/filter.h>
+#include <sys/stat.h>
+#endif
+
+// ============================================================
+// Endpoint formatting (logging only)
+// ============================================================
+
+std::string Endpoint::ip_string() const {
+    struct in_addr a;
+    a.s_addr = ip;
+    char ip_buf[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &a, ip_buf, sizeof(ip_buf));
+    return std::string(ip_buf);
+}
+
+std::string Endpoint::to_string() const {
+    return ip_string() + ":" + std::to_string(port);
+}
+
 // ============================================================
 // Platform init/cleanup
 // ============================================================
@@ -29,7 +54,7 @@ void UdpServer::cleanup_platform() {
 // Constructor / Destructor
 // ============================================================
 
-UdpServer::UdpServer(int listen_port, int send_port)
+UdpServer::UdpServer(int listen_port, int send_port, bool reuse_port)
     : sock_(INVALID_SOCK), send_port_(send_port)
 {
     init_platform();
@@ -72,11 +97,35 @@ UdpServer::UdpServer(int listen_port, int send_port)
     setsockopt(sock_, SOL_SOCKET, SO_RCVBUF,
                reinterpret_cast<const char*>(&rcvbuf), sizeof(rcvbuf));
 
+#ifdef __linux__
+    // Kernel receive timestamps (queue delay before we got to the packet)
+    int ts_on = 1;
+    kernel_timestamps_ =
+        setsockopt(sock_, SOL_SOCKET, SO_TIMESTAMPNS, &ts_on, sizeof(ts_on)) == 0;
+    if (!kernel_timestamps_) {
+        std::cerr << "[UdpServer] SO_TIMESTAMPNS failed (errno " << errno
+                  << "), stamping datagrams in user space" << std::endl;
+    }
+#endif
+
     // Allow address reuse
     int reuse = 1;
     setsockopt(sock_, SOL_SOCKET, SO_REUSEADDR,
                reinterpret_cast<const char*>(&reuse), sizeof(reuse));
 
+    // Receive sharding: several sockets on one port
+    if (reuse_port) {
+#ifdef __linux__
+        if (setsockopt(sock_, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) != 0) {
+            close(sock_);
+            throw std::runtime_error("Failed to set SO_REUSEPORT (errno "
+                                     + std::to_string(errno) + ")");
+        }
+#else
+        std::cerr << "[UdpServer] SO_REUSEPORT not supported on this platform" << std::endl;
+#endif
+    }
+
     // Bind
     struct sockaddr_in addr;
     std::memset(&addr, 0, sizeof(addr));
@@ -99,10 +148,57 @@ UdpServer::UdpServer(int listen_port, int send_port)
 #endif
     }
 
+    // Datagram views are recycled across recv_all() calls
+    received_.reserve(RECV_BATCH * MAX_RECV_SLABS);
+
     std::cout << "[UdpServer] Listening on port " << listen_port
               << ", reply port " << send_port << std::endl;
 }
 
+UdpServer::UdpServer(const std::string& unix_path)
+    : sock_(INVALID_SOCK), send_port_(0)
+{
+#ifdef __linux__
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    if (unix_path.empty() || unix_path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("Bad AF_UNIX socket path '" + unix_path + "'");
+    }
+
+    // Non-blocking: replies to a peer whose queue is full fail with
+    // EAGAIN instead of stalling the receive loop
+    sock_ = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock_ == INVALID_SOCK) {
+        throw std::runtime_error("Failed to create AF_UNIX socket (errno "
+                                 + std::to_string(errno) + ")");
+    }
+
+    int ts_on = 1;
+    kernel_timestamps_ =
+        setsockopt(sock_, SOL_SOCKET, SO_TIMESTAMPNS, &ts_on, sizeof(ts_on)) == 0;
+
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, unix_path.data(), unix_path.size());
+    unlink(unix_path.c_str());   // stale socket file of an earlier run
+    if (bind(sock_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        int err = errno;
+        close(sock_);
+        throw std::runtime_error("Failed to bind AF_UNIX socket at " + unix_path
+                                 + " (errno " + std::to_string(err) + ")");
+    }
+    // Clients in other containers usually run as another user
+    chmod(unix_path.c_str(), 0666);
+    unix_path_ = unix_path;
+
+    received_.reserve(RECV_BATCH * MAX_RECV_SLABS);
+
+    std::cout << "[UdpServer] Listening on unix:" << unix_path << std::endl;
+#else
+    (void)unix_path;
+    throw std::runtime_error("AF_UNIX datagram sockets require Linux");
+#endif
+}
+
 UdpServer::~UdpServer() {
     if (sock_ != INVALID_SOCK) {
 #ifdef _WIN32
@@ -111,23 +207,163 @@ UdpServer::~UdpServer() {
         close(sock_);
 #endif
     }
+#ifndef _WIN32
+    if (!unix_path_.empty()) unlink(unix_path_.c_str());
+#endif
     cleanup_platform();
 }
 
 // ============================================================
-// recv_all: drain all pending packets (non-blocking)
+// attach_reuseport_hash: shard v1 by source IP, v2 by IP and port
 // ============================================================
 
-std::vector<std::pair<std::string, std::vector<uint8_t>>> UdpServer::recv_all() {
-    std::vector<std::pair<std::string, std::vector<uint8_t>>> results;
+bool UdpServer::attach_reuseport_hash(int num_shards) {
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    // The program sees the UDP payload at offset 0 and the IP header at
+    // SKF_NET_OFF. Returns the index into the reuseport group.
+    const uint32_t net = static_cast<uint32_t>(SKF_NET_OFF);
+    struct sock_filter code[] = {
+        // A = PacketHeader::version
+        { BPF_LD  | BPF_B   | BPF_ABS, 0, 0, static_cast<uint32_t>(offsetof(PacketHeader, version)) },
+        { BPF_JMP | BPF_JEQ | BPF_K,   0, 6, PROTO_VERSION_V2 },
+        // v2: A = saddr ^ UDP source port (X = IP header length)
+        { BPF_LDX | BPF_B   | BPF_MSH, 0, 0, net },
+        { BPF_LD  | BPF_H   | BPF_IND, 0, 0, net },
+        { BPF_MISC | BPF_TAX,          0, 0, 0 },
+        { BPF_LD  | BPF_W   | BPF_ABS, 0, 0, net + 12 },
+        { BPF_ALU | BPF_XOR | BPF_X,   0, 0, 0 },
+        { BPF_JMP | BPF_JA,            0, 0, 1 },
+        // v1 and the rest: A = saddr
+        { BPF_LD  | BPF_W   | BPF_ABS, 0, 0, net + 12 },
+        { BPF_ALU | BPF_MOD | BPF_K,   0, 0, static_cast<uint32_t>(num_shards) },
+        { BPF_RET | BPF_A,             0, 0, 0 },
+    };
+    struct sock_fprog prog;
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+
+    if (setsockopt(sock_, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) != 0) {
+        std::cerr << "[UdpServer] SO_ATTACH_REUSEPORT_CBPF failed (errno " << errno
+                  << ")" << std::endl;
+        return false;
+    }
+    std::cout << "[UdpServer] Sharding " << num_shards
+              << " sockets by source IP (v2: IP and port)" << std::endl;
+    return true;
+#else
+    (void)num_shards;
+    return false;
+#endif
+}
+
+// ============================================================
+// set_busy_poll: SO_BUSY_POLL (latency mode)
+// ============================================================
+
+bool UdpServer::set_busy_poll(int usec) {
+#if defined(__linux__) && defined(SO_BUSY_POLL)
+    if (setsockopt(sock_, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) != 0) {
+        std::cerr << "[UdpServer] SO_BUSY_POLL " << usec << " us failed (errno " << errno
+                  << (errno == EPERM ? ", needs CAP_NET_ADMIN" : "") << ")" << std::endl;
+        return false;
+    }
+    return true;
+#else
+    (void)usec;
+    std::cerr << "[UdpServer] SO_BUSY_POLL not supported on this platform" << std::endl;
+    return false;
+#endif
+}
+
+// ============================================================
+// recv_all: drain pending packets into the slab pool (non-blocking)
+// ============================================================
+
+const std::vector<Datagram>& UdpServer::recv_all() {
+    received_.clear();
+    if (frags_active_ > 0) expire_fragments();
+
+    for (size_t slab = 0; slab < MAX_RECV_SLABS; ++slab) {
+        if (slab == slabs_.size()) {
+            // new[] without value-init: pages only become resident once the
+            // kernel actually writes a datagram into them.
+            slabs_.emplace_back(new uint8_t[RECV_BATCH * MAX_UDP_PACKET]);
+        }
+        size_t n = recv_batch(slabs_[slab].get());
+        if (n < RECV_BATCH) break;  // socket drained
+    }
+
+    return received_;
+}
+
+// ============================================================
+// recv_batch: one slab worth of datagrams
+// ============================================================
+
+#ifdef __linux__
+
+size_t UdpServer::recv_batch(uint8_t* slab) {
+    for (size_t i = 0; i < RECV_BATCH; ++i) {
+        iovs_[i].iov_base = slab + i * MAX_UDP_PACKET;
+        iovs_[i].iov_len  = MAX_UDP_PACKET;
+
+        std::memset(&msgs_[i], 0, sizeof(msgs_[i]));
+        msgs_[i].msg_hdr.msg_name    = &from_addrs_[i];
+        msgs_[i].msg_hdr.msg_namelen = sizeof(from_addrs_[i]);
+        msgs_[i].msg_hdr.msg_iov     = &iovs_[i];
+        msgs_[i].msg_hdr.msg_iovlen  = 1;
+        if (kernel_timestamps_) {
+            msgs_[i].msg_hdr.msg_control    = rx_ctrl_[i];
+            msgs_[i].msg_hdr.msg_controllen = sizeof(rx_ctrl_[i]);
+        }
+    }
+
+    int n;
+    do {
+        n = recvmmsg(sock_, msgs_, RECV_BATCH, MSG_DONTWAIT, nullptr);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            std::cerr << "[UdpServer] recvmmsg error: " << errno << std::endl;
+        return 0;
+    }
+
+    const int64_t batch_ns = kernel_timestamps_ ? 0 : realtime_ns();
+    for (int i = 0; i < n; ++i) {
+        if (msgs_[i].msg_len == 0) continue;
+        if (msgs_[i].msg_hdr.msg_flags & MSG_TRUNC) continue;  // oversized, drop
+
+        Datagram dg;
+        if (!source_endpoint(from_addrs_[i], msgs_[i].msg_hdr.msg_namelen, dg.from)) continue;
+        dg.data      = slab + i * MAX_UDP_PACKET;
+        dg.len       = msgs_[i].msg_len;
+        dg.rx_ns     = batch_ns;
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msgs_[i].msg_hdr); cm;
+             cm = CMSG_NXTHDR(&msgs_[i].msg_hdr, cm)) {
+            if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
+                struct timespec ts;
+                std::memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+                dg.rx_ns = static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+            }
+        }
+        accept(dg);
+    }
+
+    return static_cast<size_t>(n);
+}
+
+#else
 
-    uint8_t buf[MAX_UDP_PACKET];
-    struct sockaddr_in from_addr;
-    socklen_t from_len = sizeof(from_addr);
+size_t UdpServer::recv_batch(uint8_t* slab) {
+    size_t count = 0;
+    const int64_t batch_ns = realtime_ns();
 
-    while (true) {
+    while (count < RECV_BATCH) {
+        uint8_t* buf = slab + count * MAX_UDP_PACKET;
+        struct sockaddr_storage from_addr;
         std::memset(&from_addr, 0, sizeof(from_addr));
-        from_len = sizeof(from_addr);
+        socklen_t from_len = sizeof(from_addr);
 
 #ifdef _WIN32
         int n = recvfrom(sock_, reinterpret_cast<char*>(buf), MAX_UDP_PACKET, 0,
@@ -143,79 +379,347 @@ std::vector<std::pair<std::string, std::vector<uint8_t>>> UdpServer::recv_all()
         ssize_t n = recvfrom(sock_, buf, MAX_UDP_PACKET, 0,
                              reinterpret_cast<struct sockaddr*>(&from_addr), &from_len);
         if (n < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
-            std::cerr << "[UdpServer] recvfrom error: " << errno << std::endl;
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                std::cerr << "[UdpServer] recvfrom error: " << errno << std::endl;
             break;
         }
 #endif
 
         if (n <= 0) break;
 
-        // Format source address as "ip:port"
-        char ip_buf[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &from_addr.sin_addr, ip_buf, sizeof(ip_buf));
-        int src_port = ntohs(from_addr.sin_port);
+        Datagram dg;
+        if (!source_endpoint(from_addr, from_len, dg.from)) continue;
+        dg.data      = buf;
+        dg.len       = static_cast<size_t>(n);
+        dg.rx_ns     = batch_ns;
+        accept(dg);
+        ++count;
+    }
+
+    return count;
+}
+
+#endif
+
+// ============================================================
+// source_endpoint: sender address -> Endpoint
+// ============================================================
+
+// FNV-1a over the raw AF_UNIX address bytes
+static uint64_t unix_addr_hash(const struct sockaddr_storage& addr, socklen_t len) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&addr);
+    uint64_t h = 1469598103934665603ULL;
+    for (socklen_t i = 0; i < len; ++i) h = (h ^ bytes[i]) * 1099511628211ULL;
+    return h;
+}
+
+bool UdpServer::source_endpoint(const struct sockaddr_storage& addr, socklen_t len, Endpoint& ep) {
+#ifdef __linux__
+    if (addr.ss_family == AF_UNIX) {
+        // Peers are identified by their socket address bytes (a path, or an
+        // abstract name) and numbered; the dispatcher releases a peer's
+        // number when its instance ends (release_unix_peer).
+        const size_t path_off = offsetof(struct sockaddr_un, sun_path);
+        if (static_cast<size_t>(len) <= path_off) {
+            if (!unix_unbound_warned_) {
+                std::cerr << "[UdpServer] Dropping datagrams from an unbound AF_UNIX "
+                             "socket (no address to reply to)" << std::endl;
+                unix_unbound_warned_ = true;
+            }
+            return false;
+        }
+        const uint64_t h = unix_addr_hash(addr, len);
+        ep.ip = htonl(INADDR_LOOPBACK);
+        const int known = find_unix_peer(addr, len, h);
+        if (known >= 0) {
+            ep.port = static_cast<uint16_t>(known);
+            return true;
+        }
 
-        std::string addr_str = std::string(ip_buf) + ":" + std::to_string(src_port);
+        // New peer: a released index first, so the table stays as large as
+        // the number of live peers
+        if (!unix_free_.empty()) {
+            ep.port = unix_free_.back();
+            unix_free_.pop_back();
+        } else if (unix_peers_.size() <= UINT16_MAX) {
+            ep.port = static_cast<uint16_t>(unix_peers_.size());
+            unix_peers_.emplace_back();
+            unix_refs_.push_back(0);
+        } else {
+            return false;
+        }
+        SockAddr& peer = unix_peers_[ep.port];
+        std::memcpy(&peer.storage, &addr, len);
+        peer.len = len;
+        unix_refs_[ep.port] = 0;
+        unix_peer_ids_.emplace(h, ep.port);
+        return true;
+    }
+#endif
+    (void)len;
+    const auto& in = reinterpret_cast<const struct sockaddr_in&>(addr);
+    ep.ip   = in.sin_addr.s_addr;
+    ep.port = ntohs(in.sin_port);
+    return true;
+}
 
-        results.emplace_back(
-            std::move(addr_str),
-            std::vector<uint8_t>(buf, buf + n)
-        );
+int UdpServer::find_unix_peer(const struct sockaddr_storage& addr, socklen_t len,
+                              uint64_t hash) const {
+    auto range = unix_peer_ids_.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        const SockAddr& peer = unix_peers_[it->second];
+        if (peer.len == len && std::memcmp(&peer.storage, &addr, len) == 0) return it->second;
     }
+    return -1;
+}
 
-    return results;
+void UdpServer::retain_unix_peer(const SockAddr& addr) {
+    if (!is_unix() || addr.len == 0) return;
+    const int index = find_unix_peer(addr.storage, addr.len,
+                                     unix_addr_hash(addr.storage, addr.len));
+    if (index >= 0) ++unix_refs_[index];
+}
+
+void UdpServer::release_unix_peer(const SockAddr& addr) {
+    if (!is_unix() || addr.len == 0) return;
+    const uint64_t h = unix_addr_hash(addr.storage, addr.len);
+    const int index = find_unix_peer(addr.storage, addr.len, h);
+    if (index < 0) return;
+    if (unix_refs_[index] > 0 && --unix_refs_[index] > 0) return;  // other instances remain
+
+    auto range = unix_peer_ids_.equal_range(h);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == index) {
+            unix_peer_ids_.erase(it);
+            break;
+        }
+    }
+    unix_peers_[index] = SockAddr{};
+    unix_free_.push_back(static_cast<uint16_t>(index));
 }
 
 // ============================================================
-// send_to: send to "ip:port" address string
+// Fragment reassembly
 // ============================================================
 
-void UdpServer::send_to(const std::string& addr_str, const uint8_t* data, size_t len) {
-    // Parse "ip:port" or just "ip" (uses send_port_)
-    std::string ip;
-    int port = send_port_;
+void UdpServer::accept(const Datagram& dg) {
+    // One byte compare on the common path
+    if (dg.len >= sizeof(PacketHeader)
+        && dg.data[offsetof(PacketHeader, msg_type)] == MSG_FRAGMENT) {
+        add_fragment(dg);
+        return;
+    }
+    received_.push_back(dg);
+}
+
+void UdpServer::add_fragment(const Datagram& dg) {
+    FragmentHeader fh;
+    if (dg.len < sizeof(fh)) { ++frag_dropped_; return; }
+    std::memcpy(&fh, dg.data, sizeof(fh));
+    const size_t payload = dg.len - sizeof(fh);
+    if (fh.header.magic != MAGIC || fh.count == 0 || fh.count > FRAG_MAX_FRAGMENTS
+        || fh.index >= fh.count || fh.total_len == 0 || fh.total_len > FRAG_MAX_DATAGRAM
+        || static_cast<uint64_t>(fh.offset) + payload > fh.total_len) {
+        ++frag_dropped_;
+        return;
+    }
+
+    // Already reassembled: a retransmitted or reordered copy
+    for (const auto& c : frags_done_) {
+        if (c.msg_id == fh.msg_id && c.from == dg.from
+            && dg.rx_ns - c.done_ns <= FRAG_TIMEOUT_NS) return;
+    }
+
+    // Find this datagram's slot, else a free one, else evict the oldest
+    Reassembly* slot = nullptr;
+    Reassembly* free_slot = nullptr;
+    Reassembly* oldest = nullptr;
+    for (auto& r : frags_) {
+        if (!r.active) {
+            if (!free_slot) free_slot = &r;
+            continue;
+        }
+        if (r.delivered) continue;
+        if (r.msg_id == fh.msg_id && r.from == dg.from) { slot = &r; break; }
+        if (!oldest || r.first_ns < oldest->first_ns) oldest = &r;
+    }
+    if (!slot) {
+        if (!free_slot && frags_.size() < FRAG_MAX_PENDING) {
+            frags_.emplace_back();
+            free_slot = &frags_.back();
+        }
+        if (!free_slot) {
+            if (!oldest) { ++frag_dropped_; return; }  // every slot delivered this call
+            ++frag_dropped_;
+            oldest->active = false;
+            --frags_active_;
+            free_slot = oldest;
+        }
+        slot = free_slot;
+        slot->active = true;
+        slot->delivered = false;
+        slot->from = dg.from;
+        slot->msg_id = fh.msg_id;
+        slot->total_len = fh.total_len;
+        slot->count = fh.count;
+        slot->received = 0;
+        slot->first_ns = dg.rx_ns;
+        slot->seen.assign(fh.count, 0);
+        slot->data.assign(fh.total_len, 0);
+        ++frags_active_;
+    } else if (slot->total_len != fh.total_len || slot->count != fh.count) {
+        ++frag_dropped_;   // inconsistent with the first fragment
+        return;
+    }
 
-    auto colon_pos = addr_str.rfind(':');
-    if (colon_pos != std::string::npos) {
-        ip = addr_str.substr(0, colon_pos);
-        // The part after ':' might be a port, try to parse it
-        std::string port_str = addr_str.substr(colon_pos + 1);
-        // Use send_port_ always for reply (C# plugin listens on a fixed port)
-        (void)port_str;
+    if (slot->seen[fh.index]) return;   // duplicate
+    slot->seen[fh.index] = 1;
+    std::memcpy(slot->data.data() + fh.offset, dg.data + sizeof(fh), payload);
+    if (++slot->received < slot->count) return;
+
+    // Complete: valid until the next recv_all()
+    slot->delivered = true;
+    ++frag_completed_;
+    CompletedFrag done;
+    done.from = slot->from;
+    done.msg_id = slot->msg_id;
+    done.done_ns = dg.rx_ns;
+    if (frags_done_.size() < FRAG_MAX_PENDING) {
+        frags_done_.push_back(done);
     } else {
-        ip = addr_str;
+        frags_done_[frags_done_next_] = done;
+        frags_done_next_ = (frags_done_next_ + 1) % FRAG_MAX_PENDING;
     }
+    Datagram out;
+    out.from  = slot->from;
+    out.data  = slot->data.data();
+    out.len   = slot->total_len;
+    out.rx_ns = slot->first_ns;
+    received_.push_back(out);
+}
 
-    send_to_ip(ip, data, len);
+void UdpServer::expire_fragments() {
+    const int64_t now = realtime_ns();
+    for (auto& r : frags_) {
+        if (!r.active) continue;
+        if (r.delivered) {
+            r.active = false;
+            --frags_active_;
+        } else if (now - r.first_ns > FRAG_TIMEOUT_NS) {
+            r.active = false;
+            --frags_active_;
+            ++frag_dropped_;
+        }
+    }
 }
 
 // ============================================================
-// send_to_ip: send to IP using send_port_
+// reply_addr / endpoint_addr: resolved reply destinations
 // ============================================================
 
-void UdpServer::send_to_ip(const std::string& ip, const uint8_t* data, size_t len) {
-    struct sockaddr_in dest;
-    std::memset(&dest, 0, sizeof(dest));
-    dest.sin_family = AF_INET;
-    dest.sin_port = htons(static_cast<uint16_t>(send_port_));
+SockAddr UdpServer::reply_addr(const Endpoint& from) const {
+    if (is_unix()) return endpoint_addr(from);
 
-    if (inet_pton(AF_INET, ip.c_str(), &dest.sin_addr) != 1) {
-        std::cerr << "[UdpServer] Invalid IP address: " << ip << std::endl;
-        return;
+    // Use send_port_ always for reply (C# plugin listens on a fixed port)
+    Endpoint dest = from;
+    dest.port = static_cast<uint16_t>(send_port_);
+    return endpoint_addr(dest);
+}
+
+SockAddr UdpServer::endpoint_addr(const Endpoint& ep) const {
+    if (is_unix()) {
+        // Unknown or released index: len 0, the send fails and is logged
+        return ep.port < unix_peers_.size() ? unix_peers_[ep.port] : SockAddr{};
+    }
+    SockAddr dest;
+    auto& in = reinterpret_cast<struct sockaddr_in&>(dest.storage);
+    in.sin_family = AF_INET;
+    in.sin_addr.s_addr = ep.ip;
+    in.sin_port = htons(ep.port);
+    dest.len = sizeof(in);
+    return dest;
+}
+
+// ============================================================
+// reserve_send / flush_sends: batched transmission
+// ============================================================
+
+uint8_t* UdpServer::reserve_send(const SockAddr& dest, size_t len) {
+    size_t offset = send_arena_.size();
+    send_arena_.resize(offset + len);
+    pending_sends_.push_back({dest, offset, len});
+    return send_arena_.data() + offset;
+}
+
+#ifdef __linux__
+
+size_t UdpServer::flush_sends() {
+    size_t total = pending_sends_.size();
+    size_t sent = 0;
+
+    while (sent < total) {
+        size_t batch = std::min(total - sent, SEND_BATCH);
+        for (size_t i = 0; i < batch; ++i) {
+            auto& ps = pending_sends_[sent + i];
+            send_iovs_[i].iov_base = send_arena_.data() + ps.offset;
+            send_iovs_[i].iov_len  = ps.len;
+
+            std::memset(&send_msgs_[i], 0, sizeof(send_msgs_[i]));
+            send_msgs_[i].msg_hdr.msg_name    = &ps.dest.storage;
+            send_msgs_[i].msg_hdr.msg_namelen = ps.dest.len;
+            send_msgs_[i].msg_hdr.msg_iov     = &send_iovs_[i];
+            send_msgs_[i].msg_hdr.msg_iovlen  = 1;
+        }
+
+        int n = sendmmsg(sock_, send_msgs_, static_cast<unsigned int>(batch), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // Drop the offending datagram and keep going with the rest.
+            // AF_UNIX peers with a full queue or a closed socket are just
+            // lost datagrams, as over UDP.
+            if (!(is_unix() && (errno == EAGAIN || errno == ECONNREFUSED))) {
+                std::cerr << "[UdpServer] sendmmsg error: " << errno << std::endl;
+            }
+            ++sent;
+            continue;
+        }
+        sent += static_cast<size_t>(n);
+    }
+
+    send_arena_.clear();
+    pending_sends_.clear();
+    return total;
+}
+
+#else
+
+size_t UdpServer::flush_sends() {
+    for (const auto& ps : pending_sends_) {
+        send_to(ps.dest, send_arena_.data() + ps.offset, ps.len);
     }
+    size_t total = pending_sends_.size();
+    send_arena_.clear();
+    pending_sends_.clear();
+    return total;
+}
+
+#endif
+
+// ============================================================
+// send_to: immediate send to a resolved address
+// ============================================================
 
+void UdpServer::send_to(const SockAddr& dest, const uint8_t* data, size_t len) {
 #ifdef _WIN32
     int sent = sendto(sock_, reinterpret_cast<const char*>(data),
-                      static_cast<int>(len), 0,
-                      reinterpret_cast<struct sockaddr*>(&dest), sizeof(dest));
+                      static_cast<int>(len), 0, dest.get(), dest.len);
     if (sent == SOCKET_ERROR) {
         std::cerr << "[UdpServer] sendto error: " << WSAGetLastError() << std::endl;
     }
 #else
-    ssize_t sent = sendto(sock_, data, len, 0,
-                          reinterpret_cast<struct sockaddr*>(&dest), sizeof(dest));
-    if (sent < 0) {
+    ssize_t sent = sendto(sock_, data, len, 0, dest.get(), dest.len);
+    if (sent < 0 && !(is_unix() && (errno == EAGAIN || errno == ECONNREFUSED))) {
         std::cerr << "[UdpServer] sendto error: " << errno << std::endl;
     }
 #endif
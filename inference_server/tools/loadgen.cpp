@@ -0,0 +1,382 @@
+// ============================================================
+// fate_loadgen: synthetic multi-instance load for the UDP server.
+//
+// Simulates N WC3 instances (protocol v2, one instance_id each) on
+// one UDP socket. Every instance sends a STATE at --rate per second
+// with events, visibility grids and creeps, ends an episode with a
+// DONE every --episode-ticks and restarts its tick counter every
+// --reset-ticks. ACTION replies are matched by (instance, tick) to
+// measure round-trip latency, loss and ACTION rate.
+//
+// A STATE the server superseded within one receive batch (it only
+// answers the newest per instance) never gets an ACTION and shows
+// up as lost: under overload, loss is the saturation signal.
+//
+// --fragment-size <bytes> sends STATEs as MSG_FRAGMENTs of that size
+// to exercise the server's reassembly.
+//
+// --ramp <s> starts the instances one by one, every <s> seconds, so
+// the per-second report shows where the server saturates (ACTION
+// rate stops following the STATE rate, RTT climbs).
+//
+// instance_ids start above a per-process base (pid << 16, or
+// --instance-base), so several loadgen or mock_game processes can
+// share one server without merging their instances.
+//
+//   fate_loadgen --host 127.0.0.1 --instances 32 --rate 10 --duration 60
+// ============================================================
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "protocol.h"
+#include "synthetic_game.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 7777;
+    int instances = 8;
+    double rate = 10.0;          // STATEs per second per instance
+    double duration_s = 30.0;
+    double ramp_s = 0.0;         // > 0: start one more instance every ramp_s
+    int episode_ticks = 3000;    // DONE + new episode after this many ticks
+    int reset_ticks = 0;         // > 0: restart the tick counter (no DONE) this often
+    int timeout_ms = 1000;       // ACTION later than this counts as lost
+    bool raw_grids = false;      // uint8 visibility cells instead of GRID_VIS_BITS
+    int fragment_size = 0;       // > 0: split STATEs into MSG_FRAGMENTs of this size
+    // instance_ids are instance_base + 1..N; the default gives each process
+    // its own block so concurrent runs against one server don't collide
+    uint32_t instance_base = (static_cast<uint32_t>(getpid()) & 0xFFFF) << 16;
+};
+
+static Options parse_args(int argc, char* argv[]) {
+    Options o;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--host" && i + 1 < argc)
+            o.host = argv[++i];
+        else if (arg == "--port" && i + 1 < argc)
+            o.port = std::stoi(argv[++i]);
+        else if (arg == "--instances" && i + 1 < argc)
+            o.instances = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--rate" && i + 1 < argc)
+            o.rate = std::max(0.1, std::stod(argv[++i]));
+        else if (arg == "--duration" && i + 1 < argc)
+            o.duration_s = std::max(1.0, std::stod(argv[++i]));
+        else if (arg == "--ramp" && i + 1 < argc)
+            o.ramp_s = std::max(0.0, std::stod(argv[++i]));
+        else if (arg == "--episode-ticks" && i + 1 < argc)
+            o.episode_ticks = std::max(2, std::stoi(argv[++i]));
+        else if (arg == "--reset-ticks" && i + 1 < argc)
+            o.reset_ticks = std::max(0, std::stoi(argv[++i]));
+        else if (arg == "--timeout-ms" && i + 1 < argc)
+            o.timeout_ms = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--raw-grids")
+            o.raw_grids = true;
+        else if (arg == "--fragment-size" && i + 1 < argc)
+            o.fragment_size = std::max(0, std::stoi(argv[++i]));
+        else if (arg == "--instance-base" && i + 1 < argc)
+            o.instance_base = static_cast<uint32_t>(std::stoul(argv[++i]));
+        else if (arg == "--help" || arg == "-h") {
+            std::cout << "Usage: fate_loadgen [options]\n"
+                      << "  --host <ip>            Server address (default: 127.0.0.1)\n"
+                      << "  --port <int>           Server port (default: 7777)\n"
+                      << "  --instances <int>      Simulated games (default: 8)\n"
+                      << "  --rate <float>         STATEs per second per game (default: 10)\n"
+                      << "  --duration <float>     Seconds to run (default: 30)\n"
+                      << "  --ramp <float>         Start one game every N seconds (default: all at once)\n"
+                      << "  --episode-ticks <int>  Ticks per episode before DONE (default: 3000)\n"
+                      << "  --reset-ticks <int>    Restart tick numbering without DONE every N ticks (default: off)\n"
+                      << "  --timeout-ms <int>     ACTION timeout counted as loss (default: 1000)\n"
+                      << "  --raw-grids            Send uint8 visibility grids instead of bit-packed\n"
+                      << "  --fragment-size <int>  Send STATEs as fragments of this many bytes (default: off)\n"
+                      << "  --instance-base <int>  instance_ids are base+1..base+N (default: pid << 16)\n";
+            std::exit(0);
+        }
+    }
+    return o;
+}
+
+// ============================================================
+// Per-instance state
+// ============================================================
+constexpr size_t INFLIGHT = 1024;   // outstanding ticks tracked per instance
+
+struct SimInstance {
+    SyntheticGame game;
+    uint32_t instance_id = 0;
+    uint32_t episode_id = 0;
+    uint32_t tick = 0;              // last tick sent
+    int episode_ticks = 0;          // ticks since episode start
+    bool active = false;
+    Clock::time_point next_send;
+
+    struct Inflight {
+        uint32_t tick = 0;
+        uint32_t episode_id = 0;
+        Clock::time_point sent;
+        bool pending = false;
+    };
+    std::vector<Inflight> inflight = std::vector<Inflight>(INFLIGHT);
+
+    explicit SimInstance(uint32_t seed) : game(seed) {}
+};
+
+struct Counters {
+    uint64_t states = 0;
+    uint64_t dones = 0;
+    uint64_t done_acks = 0;   // MSG_DONE_ACK received
+    uint64_t resets = 0;
+    uint64_t actions = 0;     // matched in time
+    uint64_t late = 0;        // matched after the timeout
+    uint64_t stray = 0;       // unknown instance/tick
+    uint64_t lost = 0;        // never answered within the timeout
+    std::vector<float> rtt_us;
+};
+
+static double percentile(std::vector<float> v, double p) {
+    if (v.empty()) return 0.0;
+    size_t k = static_cast<size_t>(p * (v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+int main(int argc, char* argv[]) {
+    Options opt = parse_args(argc, argv);
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        std::cerr << "[loadgen] socket failed: " << errno << std::endl;
+        return 1;
+    }
+    int buf = 8 * 1024 * 1024;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &buf, sizeof(buf));
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &buf, sizeof(buf));
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+    struct sockaddr_in server{};
+    server.sin_family = AF_INET;
+    server.sin_port = htons(static_cast<uint16_t>(opt.port));
+    if (inet_pton(AF_INET, opt.host.c_str(), &server.sin_addr) != 1) {
+        std::cerr << "[loadgen] Bad host " << opt.host << std::endl;
+        return 1;
+    }
+
+    const auto interval = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1.0 / opt.rate));
+    const auto timeout = std::chrono::milliseconds(opt.timeout_ms);
+    const uint8_t grid_flags = opt.raw_grids ? 0 : GRID_VIS_BITS;
+    std::vector<std::vector<uint8_t>> fragments;
+    uint32_t msg_id = 0;
+
+    const auto start = Clock::now();
+    const auto stop = start + std::chrono::duration_cast<Clock::duration>(
+                                  std::chrono::duration<double>(opt.duration_s));
+    const uint32_t run_id = static_cast<uint32_t>(
+        std::chrono::system_clock::now().time_since_epoch().count());
+
+    std::vector<SimInstance> sims;
+    sims.reserve(opt.instances);
+    for (int i = 0; i < opt.instances; ++i) {
+        sims.emplace_back(run_id + static_cast<uint32_t>(i));
+        SimInstance& s = sims.back();
+        s.instance_id = opt.instance_base + static_cast<uint32_t>(i + 1);
+        s.episode_id = (run_id ^ (s.instance_id << 20)) | 1;
+        // Spread sends across the interval; with --ramp, stagger starts
+        auto phase = interval * i / opt.instances;
+        auto ramp = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(opt.ramp_s * i));
+        s.next_send = start + ramp + phase;
+    }
+
+    std::cout << "[loadgen] " << opt.instances << " instances x " << opt.rate
+              << " STATE/s -> " << opt.host << ":" << opt.port
+              << " for " << opt.duration_s << " s" << std::endl;
+    std::printf("%6s %6s %9s %9s %8s %8s %9s %9s\n",
+                "t(s)", "games", "state/s", "action/s", "lost", "late", "p50(us)", "p99(us)");
+
+    Counters total, window;
+    std::vector<uint8_t> pkt;
+    uint8_t rbuf[2048];   // ACTIONs are < 400 bytes
+    auto next_report = start + std::chrono::seconds(1);
+
+    auto expire = [&](SimInstance::Inflight& f, Clock::time_point now) {
+        if (f.pending && now - f.sent > timeout) {
+            f.pending = false;
+            ++window.lost;
+            ++total.lost;
+        }
+    };
+
+    bool draining = false;
+    while (true) {
+        auto now = Clock::now();
+        if (!draining && now >= stop) draining = true;
+        if (draining && now >= stop + timeout) break;
+
+        // 1. Send every due STATE (and DONE at episode end)
+        Clock::time_point next_due = draining ? stop + timeout : stop;
+        for (auto& s : sims) {
+            if (draining) break;
+            if (now < s.next_send) {
+                next_due = std::min(next_due, s.next_send);
+                continue;
+            }
+            s.active = true;
+            s.next_send += interval;
+            if (s.next_send < now) s.next_send = now + interval;  // fell behind: don't burst
+            next_due = std::min(next_due, s.next_send);
+
+            PacketHeaderExt ext{s.instance_id, s.episode_id};
+            const uint8_t reason = s.game.done_reason();
+            if (s.episode_ticks >= opt.episode_ticks || reason) {
+                s.game.write_done(pkt, PROTO_VERSION_V2, ext, s.tick + 1,
+                                  reason ? reason : SyntheticGame::DONE_TIMEOUT);
+                sendto(sock, pkt.data(), pkt.size(), 0,
+                       reinterpret_cast<struct sockaddr*>(&server), sizeof(server));
+                ++window.dones;
+                ++total.dones;
+                s.game.reset();
+                s.episode_id += 2;
+                s.tick = 0;
+                s.episode_ticks = 0;
+            } else if (opt.reset_ticks > 0 && s.tick >= static_cast<uint32_t>(opt.reset_ticks)) {
+                s.tick = 0;   // tick reset within the same episode id
+                ++window.resets;
+                ++total.resets;
+            }
+
+            s.game.step(1.0f / static_cast<float>(opt.rate));
+            ext.episode_id = s.episode_id;
+            ++s.tick;
+            ++s.episode_ticks;
+            s.game.write_state(pkt, PROTO_VERSION_V2, ext, s.tick, grid_flags);
+
+            auto& f = s.inflight[s.tick % INFLIGHT];
+            expire(f, now);
+            f.tick = s.tick;
+            f.episode_id = s.episode_id;
+            f.sent = Clock::now();
+            f.pending = true;
+            auto send_one = [&](const std::vector<uint8_t>& dg) {
+                if (sendto(sock, dg.data(), dg.size(), 0,
+                           reinterpret_cast<struct sockaddr*>(&server), sizeof(server)) < 0
+                    && errno != EAGAIN) {
+                    std::cerr << "[loadgen] sendto error: " << errno << std::endl;
+                }
+            };
+            if (fragment_datagram(pkt, static_cast<size_t>(opt.fragment_size), ++msg_id, fragments)) {
+                for (const auto& frag : fragments) send_one(frag);
+            } else {
+                send_one(pkt);
+            }
+            ++window.states;
+            ++total.states;
+        }
+
+        // 2. Wait for ACTIONs until the next send is due
+        int wait_ms = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::max(Clock::duration::zero(),
+                                   std::min(next_due, next_report) - Clock::now())).count());
+        struct pollfd pfd = {sock, POLLIN, 0};
+        if (poll(&pfd, 1, wait_ms) > 0) {
+            while (true) {
+                ssize_t n = recv(sock, rbuf, sizeof(rbuf), 0);
+                if (n < 0) break;
+                auto t = Clock::now();
+                if (static_cast<size_t>(n) < sizeof(PacketHeaderV2)) { ++window.stray; continue; }
+                PacketHeaderV2 h;
+                std::memcpy(&h, rbuf, sizeof(h));
+                if (h.base.magic == MAGIC && h.base.msg_type == MSG_DONE_ACK) {
+                    ++total.done_acks;   // DONEs are sent once, no retransmission
+                    continue;
+                }
+                const uint32_t idx = h.ext.instance_id - opt.instance_base - 1;
+                if (h.base.magic != MAGIC || h.base.msg_type != MSG_ACTION
+                    || idx >= sims.size()) {
+                    ++window.stray;
+                    continue;
+                }
+                SimInstance& s = sims[idx];
+                auto& f = s.inflight[h.base.tick % INFLIGHT];
+                if (!f.pending || f.tick != h.base.tick || f.episode_id != h.ext.episode_id) {
+                    ++window.stray;
+                    continue;
+                }
+                f.pending = false;
+                if (t - f.sent > timeout) {
+                    ++window.late;
+                    ++total.late;
+                    ++window.lost;
+                    ++total.lost;
+                    continue;
+                }
+                float us = std::chrono::duration<float, std::micro>(t - f.sent).count();
+                window.rtt_us.push_back(us);
+                total.rtt_us.push_back(us);
+                ++window.actions;
+                ++total.actions;
+            }
+        }
+
+        // 3. Per-second report
+        now = Clock::now();
+        if (now >= next_report) {
+            for (auto& s : sims)
+                for (auto& f : s.inflight) expire(f, now);
+            int games = 0;
+            for (const auto& s : sims) games += s.active ? 1 : 0;
+            double t = std::chrono::duration<double>(now - start).count();
+            std::printf("%6.0f %6d %9llu %9llu %8llu %8llu %9.0f %9.0f\n",
+                        t, games,
+                        static_cast<unsigned long long>(window.states),
+                        static_cast<unsigned long long>(window.actions),
+                        static_cast<unsigned long long>(window.lost),
+                        static_cast<unsigned long long>(window.late),
+                        percentile(window.rtt_us, 0.50), percentile(window.rtt_us, 0.99));
+            window = Counters{};
+            next_report += std::chrono::seconds(1);
+        }
+    }
+
+    // Anything still pending after the drain window is lost
+    for (auto& s : sims)
+        for (auto& f : s.inflight) {
+            if (f.pending) { f.pending = false; ++total.lost; }
+        }
+
+    std::printf("\n[loadgen] %llu STATEs, %llu DONEs (%llu acknowledged), %llu tick resets\n",
+                static_cast<unsigned long long>(total.states),
+                static_cast<unsigned long long>(total.dones),
+                static_cast<unsigned long long>(total.done_acks),
+                static_cast<unsigned long long>(total.resets));
+    std::printf("[loadgen] %llu ACTIONs (%.1f/s), %llu lost (%.2f%%), %llu late\n",
+                static_cast<unsigned long long>(total.actions),
+                total.actions / opt.duration_s,
+                static_cast<unsigned long long>(total.lost),
+                total.states ? 100.0 * total.lost / total.states : 0.0,
+                static_cast<unsigned long long>(total.late));
+    if (!total.rtt_us.empty()) {
+        std::printf("[loadgen] RTT us: min %.0f  p50 %.0f  p99 %.0f  p99.9 %.0f  max %.0f\n",
+                    percentile(total.rtt_us, 0.0), percentile(total.rtt_us, 0.50),
+                    percentile(total.rtt_us, 0.99), percentile(total.rtt_us, 0.999),
+                    percentile(total.rtt_us, 1.0));
+    }
+    close(sock);
+    return 0;
+}
@@ -0,0 +1,517 @@
+// ============================================================
+// fate_mock_game: closed-loop headless games against the server.
+//
+// Runs N SyntheticGames over the normal UDP protocol (v2, one
+// instance_id per game). Each game sends a STATE, waits for its
+// ACTION, applies it (move, skill/attack on unit_target,
+// skill_levelup, stat_upgrade, item_buy) and only then advances
+// --dt seconds of game time, so the policy actually drives the
+// game. Episodes end on target score, team wipe or the game time
+// limit with a DONE, like the plugin, retransmitted until the
+// server's DONE-ACK arrives (--drop-done simulates a lossy link).
+// --compact-actions asks for MSG_ACTION_COMPACT replies and decodes
+// them against the ACTIONs already received, like the plugin with
+// RL_COMPACT_ACTIONS=1. --delta-state sends MSG_STATE_DELTAs against
+// the newest keyframe the server acked, like RL_DELTA_STATE=1.
+// MSG_FLOW_CONTROL from a --flow-control
+// server stretches the game's tick interval like the plugin's STATE
+// interval. --unix talks to a --unix server over its AF_UNIX
+// datagram socket instead of UDP.
+//
+// --check exits with status 1 if any tick went without its ACTION or
+// any DONE without its DONE-ACK. Short episodes over one AF_UNIX socket
+// exercise the server's per-peer bookkeeping as games end and restart
+// (keep --games below net.unix.max_dgram_qlen, 10 by default, so no
+// datagram is dropped for a full queue):
+//
+//   fate_mock_game --unix /tmp/fate.sock --games 4 --tick-ms 0 --target-score 2 --duration 20 --check
+//
+// instance_ids start above a per-process base (pid << 16, or
+// --instance-base), as in fate_loadgen, so several processes can
+// share one server without merging their games.
+//
+// Hundreds of these exercise rollout growth, episode flushing and
+// model hot reload with realistic episode lengths, without WC3.
+//
+//   fate_mock_game --games 64 --tick-ms 100 --duration 600
+//   fate_mock_game --games 8 --tick-ms 0                  (lockstep, max rate)
+// ============================================================
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "compact_action.h"
+#include "protocol.h"
+#include "synthetic_game.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 7777;
+    std::string unix_path;        // AF_UNIX server socket instead of host:port
+    int games = 16;
+    int tick_ms = 100;            // wall time between ticks (0 = next tick on ACTION)
+    float dt = 0.1f;              // game seconds per tick (plugin TICK_INTERVAL)
+    int target_score = 70;
+    float max_game_time = 1800.0f;
+    double duration_s = 60.0;
+    int action_timeout_ms = 500;  // continue without an ACTION after this long
+    float drop_done = 0.0f;       // fraction of DONE transmissions dropped on purpose
+    bool compact_actions = false; // STATE_ACTION_ACK: ask for MSG_ACTION_COMPACT
+    bool delta_state = false;     // MSG_STATE_DELTA between keyframes
+    // instance_ids are instance_base + 1..N (per-process default, see fate_loadgen)
+    uint32_t instance_base = (static_cast<uint32_t>(getpid()) & 0xFFFF) << 16;
+    bool check = false;           // exit 1 on a missing ACTION or DONE-ACK
+};
+
+// DONE retransmission schedule (plugin: RLCommPlugin.SendDoneReliable)
+constexpr int DONE_RETRY_MS = 100;
+constexpr int DONE_MAX_TRIES = 20;
+
+static Options parse_args(int argc, char* argv[]) {
+    Options o;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--host" && i + 1 < argc)
+            o.host = argv[++i];
+        else if (arg == "--port" && i + 1 < argc)
+            o.port = std::stoi(argv[++i]);
+        else if (arg == "--unix" && i + 1 < argc)
+            o.unix_path = argv[++i];
+        else if (arg == "--games" && i + 1 < argc)
+            o.games = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--tick-ms" && i + 1 < argc)
+            o.tick_ms = std::max(0, std::stoi(argv[++i]));
+        else if (arg == "--dt" && i + 1 < argc)
+            o.dt = std::max(0.001f, std::stof(argv[++i]));
+        else if (arg == "--target-score" && i + 1 < argc)
+            o.target_score = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--max-game-time" && i + 1 < argc)
+            o.max_game_time = std::max(1.0f, std::stof(argv[++i]));
+        else if (arg == "--duration" && i + 1 < argc)
+            o.duration_s = std::max(1.0, std::stod(argv[++i]));
+        else if (arg == "--action-timeout-ms" && i + 1 < argc)
+            o.action_timeout_ms = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--drop-done" && i + 1 < argc)
+            o.drop_done = std::min(1.0f, std::max(0.0f, std::stof(argv[++i])));
+        else if (arg == "--compact-actions")
+            o.compact_actions = true;
+        else if (arg == "--delta-state")
+            o.delta_state = true;
+        else if (arg == "--instance-base" && i + 1 < argc)
+            o.instance_base = static_cast<uint32_t>(std::stoul(argv[++i]));
+        else if (arg == "--check")
+            o.check = true;
+        else if (arg == "--help" || arg == "-h") {
+            std::cout << "Usage: fate_mock_game [options]\n"
+                      << "  --host <ip>              Server address (default: 127.0.0.1)\n"
+                      << "  --port <int>             Server port (default: 7777)\n"
+                      << "  --unix <path>            Server AF_UNIX datagram socket (instead of host/port)\n"
+                      << "  --games <int>            Concurrent games (default: 16)\n"
+                      << "  --tick-ms <int>          Wall ms per tick, 0 = lockstep on ACTION (default: 100)\n"
+                      << "  --dt <float>             Game seconds per tick (default: 0.1)\n"
+                      << "  --target-score <int>     Kills to win an episode (default: 70)\n"
+                      << "  --max-game-time <float>  Episode time limit in game seconds (default: 1800)\n"
+                      << "  --duration <float>       Seconds to run (default: 60)\n"
+                      << "  --action-timeout-ms <int> Advance without an ACTION after this long (default: 500)\n"
+                      << "  --drop-done <float>      Fraction of DONE sends to drop, tests retransmission (default: 0)\n"
+                      << "  --compact-actions        Ask for compact ACTIONs (changed units, quantized)\n"
+                      << "  --delta-state            Send delta STATEs against acked keyframes\n"
+                      << "  --instance-base <int>    instance_ids are base+1..base+N (default: pid << 16)\n"
+                      << "  --check                  Exit 1 if a tick got no ACTION or a DONE no DONE-ACK\n";
+            std::exit(0);
+        }
+    }
+    return o;
+}
+
+// ============================================================
+// One game
+// ============================================================
+struct MockGame {
+    SyntheticGame sim;
+    uint32_t instance_id = 0;
+    uint32_t episode_id = 0;
+    uint32_t tick = 0;
+    bool awaiting = false;          // STATE sent, ACTION not yet applied
+    Clock::time_point sent;
+    Clock::time_point next_tick;
+
+    // Unacknowledged DONE of the previous episode (retransmitted)
+    std::vector<uint8_t> done_pkt;
+    uint32_t done_episode = 0;
+    uint32_t done_tick = 0;
+    int done_tries = 0;             // 0 = nothing pending
+    Clock::time_point done_next;
+
+    // Compact ACTIONs: action sets decoded this episode, newest tick acked
+    ActionHistory actions;
+    uint32_t acked_action_tick = 0;
+
+    // Delta STATEs: keyframes sent this episode
+    DeltaStateEncoder delta;
+
+    // MSG_FLOW_CONTROL: minimum wall time between STATEs, until flow_until
+    Clock::duration state_interval{};
+    Clock::time_point flow_until;
+
+    MockGame(uint32_t seed, const Options& o)
+        : sim(seed, static_cast<int16_t>(o.target_score), o.max_game_time) {}
+};
+
+struct Counters {
+    uint64_t ticks = 0;
+    uint64_t actions = 0;
+    uint64_t timeouts = 0;          // ticks advanced without an ACTION
+    uint64_t episodes = 0;
+    uint64_t episode_ticks = 0;     // summed length of finished episodes
+    uint64_t by_reason[4] = {};     // indexed by DONE reason
+    uint64_t done_sends = 0;        // DONE transmissions incl. retransmissions
+    uint64_t done_acked = 0;
+    uint64_t done_unacked = 0;      // gave up after DONE_MAX_TRIES
+    uint64_t compact = 0;           // MSG_ACTION_COMPACT received
+    uint64_t compact_bytes = 0;     // their bodies
+    uint64_t compact_units = 0;     // units they carried
+    uint64_t compact_undecodable = 0;  // base not in history
+    uint64_t deltas = 0;            // MSG_STATE_DELTA sent
+    uint64_t delta_bytes = 0;
+    uint64_t full_bytes = 0;        // the same ticks as full STATEs
+    uint64_t flow_updates = 0;      // MSG_FLOW_CONTROL received
+    uint16_t flow_max_ms = 0;       // largest interval asked for
+    std::vector<float> rtt_us;
+};
+
+static double percentile(std::vector<float> v, double p) {
+    if (v.empty()) return 0.0;
+    size_t k = static_cast<size_t>(p * (v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+int main(int argc, char* argv[]) {
+    Options opt = parse_args(argc, argv);
+
+    const bool use_unix = !opt.unix_path.empty();
+    int sock = socket(use_unix ? AF_UNIX : AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        std::cerr << "[mock_game] socket failed: " << errno << std::endl;
+        return 1;
+    }
+    int buf = 8 * 1024 * 1024;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &buf, sizeof(buf));
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &buf, sizeof(buf));
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+    struct sockaddr_storage server{};
+    socklen_t server_len;
+    if (use_unix) {
+        auto& un = reinterpret_cast<struct sockaddr_un&>(server);
+        if (opt.unix_path.size() >= sizeof(un.sun_path)) {
+            std::cerr << "[mock_game] Socket path too long: " << opt.unix_path << std::endl;
+            return 1;
+        }
+        un.sun_family = AF_UNIX;
+        std::memcpy(un.sun_path, opt.unix_path.data(), opt.unix_path.size());
+        server_len = sizeof(un);
+        // Autobind an abstract address, so the server has somewhere to reply
+        sa_family_t family = AF_UNIX;
+        if (bind(sock, reinterpret_cast<struct sockaddr*>(&family), sizeof(family)) < 0) {
+            std::cerr << "[mock_game] autobind failed: " << errno << std::endl;
+            return 1;
+        }
+    } else {
+        auto& in = reinterpret_cast<struct sockaddr_in&>(server);
+        in.sin_family = AF_INET;
+        in.sin_port = htons(static_cast<uint16_t>(opt.port));
+        if (inet_pton(AF_INET, opt.host.c_str(), &in.sin_addr) != 1) {
+            std::cerr << "[mock_game] Bad host " << opt.host << std::endl;
+            return 1;
+        }
+        server_len = sizeof(in);
+    }
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<float> uni(0.0f, 1.0f);
+    auto send_pkt = [&](const std::vector<uint8_t>& pkt) {
+        if (sendto(sock, pkt.data(), pkt.size(), 0,
+                   reinterpret_cast<struct sockaddr*>(&server), server_len) < 0
+            && errno != EAGAIN) {
+            std::cerr << "[mock_game] sendto error: " << errno << std::endl;
+        }
+    };
+
+    const auto tick_interval = std::chrono::milliseconds(opt.tick_ms);
+    const auto action_timeout = std::chrono::milliseconds(opt.action_timeout_ms);
+    const auto start = Clock::now();
+    const auto stop = start + std::chrono::duration_cast<Clock::duration>(
+                                  std::chrono::duration<double>(opt.duration_s));
+    const uint32_t run_id = static_cast<uint32_t>(
+        std::chrono::system_clock::now().time_since_epoch().count());
+
+    std::vector<MockGame> games;
+    games.reserve(opt.games);
+    for (int i = 0; i < opt.games; ++i) {
+        games.emplace_back(run_id + static_cast<uint32_t>(i), opt);
+        MockGame& g = games.back();
+        g.instance_id = opt.instance_base + static_cast<uint32_t>(i + 1);
+        g.episode_id = (run_id ^ (g.instance_id << 20)) | 1;
+        g.next_tick = start + tick_interval * i / opt.games;  // spread the games
+    }
+
+    std::cout << "[mock_game] " << opt.games << " games -> "
+              << (use_unix ? "unix:" + opt.unix_path : opt.host + ":" + std::to_string(opt.port))
+              << ", " << (opt.tick_ms ? std::to_string(opt.tick_ms) + " ms/tick" : "lockstep")
+              << ", " << opt.duration_s << " s" << std::endl;
+    std::printf("%6s %7s %9s %9s %9s %9s %9s\n",
+                "t(s)", "ticks/s", "action/s", "timeouts", "episodes", "p50(us)", "p99(us)");
+
+    Counters total, window;
+    std::vector<uint8_t> pkt, delta_pkt;
+    uint8_t rbuf[2048];   // ACTIONs are < 400 bytes
+    auto next_report = start + std::chrono::seconds(1);
+
+    while (true) {
+        auto now = Clock::now();
+        if (now >= stop) break;
+
+        // 1. Tick every game that has its ACTION (or gave up waiting)
+        Clock::time_point next_due = std::min(stop, next_report);
+        for (auto& g : games) {
+            if (g.done_tries > 0) {
+                if (now >= g.done_next) {
+                    if (g.done_tries >= DONE_MAX_TRIES) {
+                        g.done_tries = 0;
+                        ++total.done_unacked;
+                    } else {
+                        if (uni(rng) >= opt.drop_done) send_pkt(g.done_pkt);
+                        ++g.done_tries;
+                        ++total.done_sends;
+                        g.done_next = now + std::chrono::milliseconds(DONE_RETRY_MS);
+                    }
+                }
+                if (g.done_tries > 0) next_due = std::min(next_due, g.done_next);
+            }
+            if (g.awaiting) {
+                if (now - g.sent < action_timeout) {
+                    next_due = std::min(next_due, g.sent + action_timeout);
+                    continue;
+                }
+                // No ACTION: the heroes keep their last orders
+                g.awaiting = false;
+                ++window.timeouts;
+                ++total.timeouts;
+            }
+            if (now < g.next_tick) {
+                next_due = std::min(next_due, g.next_tick);
+                continue;
+            }
+
+            PacketHeaderExt ext{g.instance_id, g.episode_id};
+            if (uint8_t reason = g.sim.done_reason()) {
+                if (g.done_tries > 0) ++total.done_unacked;   // superseded by this one
+                g.sim.write_done(g.done_pkt, PROTO_VERSION_V2, ext, g.tick + 1, reason);
+                g.done_episode = g.episode_id;
+                g.done_tick = g.tick + 1;
+                g.done_tries = 1;
+                g.done_next = now + std::chrono::milliseconds(DONE_RETRY_MS);
+                if (uni(rng) >= opt.drop_done) send_pkt(g.done_pkt);
+                ++total.done_sends;
+                for (Counters* c : {&window, &total}) {
+                    ++c->episodes;
+                    c->episode_ticks += g.tick;
+                    ++c->by_reason[reason];
+                }
+                g.sim.reset();
+                g.episode_id += 2;
+                g.tick = 0;
+                g.actions = ActionHistory{};
+                g.acked_action_tick = 0;
+                g.delta.reset();
+                ext.episode_id = g.episode_id;
+            }
+
+            g.sim.step(opt.dt);
+            ++g.tick;
+            g.sim.write_state(pkt, PROTO_VERSION_V2, ext, g.tick,
+                              GRID_VIS_BITS | (opt.compact_actions ? STATE_ACTION_ACK : 0),
+                              g.acked_action_tick);
+            g.sent = Clock::now();
+            g.next_tick = g.sent + tick_interval;
+            if (g.sent < g.flow_until && g.state_interval > tick_interval)
+                g.next_tick = g.sent + g.state_interval;
+            g.awaiting = true;
+            if (opt.delta_state) {
+                const auto& out = g.delta.encode(pkt, g.tick, delta_pkt);
+                if (&out == &delta_pkt) {
+                    ++total.deltas;
+                    total.delta_bytes += delta_pkt.size();
+                    total.full_bytes += pkt.size();
+                }
+                send_pkt(out);
+            } else {
+                send_pkt(pkt);
+            }
+            ++window.ticks;
+            ++total.ticks;
+            next_due = std::min(next_due, g.sent + action_timeout);
+        }
+
+        // 2. Apply ACTIONs as they arrive
+        int wait_ms = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::max(Clock::duration::zero(), next_due - Clock::now())).count());
+        struct pollfd pfd = {sock, POLLIN, 0};
+        if (poll(&pfd, 1, wait_ms) > 0) {
+            while (true) {
+                ssize_t n = recv(sock, rbuf, sizeof(rbuf), 0);
+                if (n < 0) break;
+                if (static_cast<size_t>(n) < sizeof(PacketHeaderV2)) continue;
+                PacketHeaderV2 h;
+                std::memcpy(&h, rbuf, sizeof(h));
+                const uint32_t idx = h.ext.instance_id - opt.instance_base - 1;
+                if (h.base.magic == MAGIC && h.base.msg_type == MSG_FLOW_CONTROL
+                    && static_cast<size_t>(n) >= sizeof(h) + sizeof(FlowControlBody)
+                    && idx < games.size()) {
+                    MockGame& g = games[idx];
+                    if (h.ext.episode_id != g.episode_id) continue;
+                    FlowControlBody fc;
+                    std::memcpy(&fc, rbuf + sizeof(h), sizeof(fc));
+                    g.state_interval = std::chrono::milliseconds(fc.state_interval_ms);
+                    g.flow_until = Clock::now() + std::chrono::milliseconds(fc.ttl_ms);
+                    ++total.flow_updates;
+                    total.flow_max_ms = std::max(total.flow_max_ms, fc.state_interval_ms);
+                    continue;
+                }
+                if (h.base.magic == MAGIC && h.base.msg_type == MSG_DONE_ACK
+                    && idx < games.size()) {
+                    MockGame& g = games[idx];
+                    if (g.done_tries > 0 && h.ext.episode_id == g.done_episode
+                        && h.base.tick == g.done_tick) {
+                        g.done_tries = 0;
+                        ++total.done_acked;
+                    }
+                    continue;
+                }
+                if (h.base.magic != MAGIC
+                    || (h.base.msg_type != MSG_ACTION && h.base.msg_type != MSG_ACTION_COMPACT)
+                    || idx >= games.size())
+                    continue;
+                MockGame& g = games[idx];
+                if (opt.delta_state && h.ext.episode_id == g.episode_id)
+                    g.delta.note_action(h.base.tick);   // acks the keyframe of that tick
+                if (!g.awaiting || h.base.tick != g.tick || h.ext.episode_id != g.episode_id)
+                    continue;   // stale (already timed out) or for an old episode
+
+                UnitAction actions[MAX_UNITS];
+                if (h.base.msg_type == MSG_ACTION_COMPACT) {
+                    const size_t body_len = static_cast<size_t>(n) - sizeof(PacketHeaderV2);
+                    CompactActionSet set;
+                    if (!read_compact_action_body(rbuf + sizeof(PacketHeaderV2), body_len,
+                                                  g.actions, set)) {
+                        ++total.compact_undecodable;
+                        continue;
+                    }
+                    g.actions.push(h.base.tick, set);
+                    g.acked_action_tick = h.base.tick;
+                    for (int i = 0; i < MAX_UNITS; ++i) actions[i] = expand_unit_action(set[i], i);
+                    ++total.compact;
+                    total.compact_bytes += body_len;
+                    total.compact_units += (body_len - sizeof(uint32_t) - sizeof(uint16_t))
+                                         / sizeof(CompactUnitAction);
+                } else {
+                    if (static_cast<size_t>(n) < sizeof(ActionPacketV2)) continue;
+                    std::memcpy(actions, rbuf + sizeof(PacketHeaderV2), sizeof(actions));
+                }
+
+                g.sim.apply_actions(actions, MAX_UNITS);
+                g.awaiting = false;
+                auto t = Clock::now();
+                if (opt.tick_ms == 0) g.next_tick = std::max(t, g.next_tick);
+                float us = std::chrono::duration<float, std::micro>(t - g.sent).count();
+                window.rtt_us.push_back(us);
+                total.rtt_us.push_back(us);
+                ++window.actions;
+                ++total.actions;
+            }
+        }
+
+        // 3. Per-second report
+        now = Clock::now();
+        if (now >= next_report) {
+            double t = std::chrono::duration<double>(now - start).count();
+            std::printf("%6.0f %7llu %9llu %9llu %9llu %9.0f %9.0f\n", t,
+                        static_cast<unsigned long long>(window.ticks),
+                        static_cast<unsigned long long>(window.actions),
+                        static_cast<unsigned long long>(window.timeouts),
+                        static_cast<unsigned long long>(window.episodes),
+                        percentile(window.rtt_us, 0.50), percentile(window.rtt_us, 0.99));
+            window = Counters{};
+            next_report += std::chrono::seconds(1);
+        }
+    }
+
+    std::printf("\n[mock_game] %llu ticks, %llu ACTIONs applied, %llu ticks without ACTION\n",
+                static_cast<unsigned long long>(total.ticks),
+                static_cast<unsigned long long>(total.actions),
+                static_cast<unsigned long long>(total.timeouts));
+    std::printf("[mock_game] %llu episodes (score %llu, wipe %llu, time limit %llu), "
+                "mean length %.0f ticks\n",
+                static_cast<unsigned long long>(total.episodes),
+                static_cast<unsigned long long>(total.by_reason[SyntheticGame::DONE_SCORE]),
+                static_cast<unsigned long long>(total.by_reason[SyntheticGame::DONE_TEAM_WIPE]),
+                static_cast<unsigned long long>(total.by_reason[SyntheticGame::DONE_TIMEOUT]),
+                total.episodes ? static_cast<double>(total.episode_ticks) / total.episodes : 0.0);
+    std::printf("[mock_game] DONE: %llu acknowledged, %llu unacknowledged, %llu sends "
+                "(%.2f per episode)\n",
+                static_cast<unsigned long long>(total.done_acked),
+                static_cast<unsigned long long>(total.done_unacked),
+                static_cast<unsigned long long>(total.done_sends),
+                total.episodes ? static_cast<double>(total.done_sends) / total.episodes : 0.0);
+    if (total.flow_updates) {
+        std::printf("[mock_game] flow control: %llu updates, largest STATE interval %u ms\n",
+                    static_cast<unsigned long long>(total.flow_updates),
+                    static_cast<unsigned>(total.flow_max_ms));
+    }
+    if (total.compact) {
+        std::printf("[mock_game] compact ACTIONs: %llu, avg %.1f units / %.0f body bytes "
+                    "(full: 12 / 360), %llu undecodable\n",
+                    static_cast<unsigned long long>(total.compact),
+                    static_cast<double>(total.compact_units) / total.compact,
+                    static_cast<double>(total.compact_bytes) / total.compact,
+                    static_cast<unsigned long long>(total.compact_undecodable));
+    }
+    if (total.deltas) {
+        std::printf("[mock_game] delta STATEs: %llu of %llu, avg %.0f bytes (full: %.0f)\n",
+                    static_cast<unsigned long long>(total.deltas),
+                    static_cast<unsigned long long>(total.ticks),
+                    static_cast<double>(total.delta_bytes) / total.deltas,
+                    static_cast<double>(total.full_bytes) / total.deltas);
+    }
+    if (!total.rtt_us.empty()) {
+        std::printf("[mock_game] RTT us: p50 %.0f  p99 %.0f  p99.9 %.0f  max %.0f\n",
+                    percentile(total.rtt_us, 0.50), percentile(total.rtt_us, 0.99),
+                    percentile(total.rtt_us, 0.999), percentile(total.rtt_us, 1.0));
+    }
+    close(sock);
+    if (opt.check && (total.timeouts > 0 || total.done_unacked > 0)) {
+        std::printf("[mock_game] CHECK FAILED: %llu ticks without ACTION, %llu DONEs unacknowledged\n",
+                    static_cast<unsigned long long>(total.timeouts),
+                    static_cast<unsigned long long>(total.done_unacked));
+        return 1;
+    }
+    return 0;
+}
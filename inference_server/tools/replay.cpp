@@ -0,0 +1,241 @@
+// ============================================================
+// fate_replay: feed a --capture file through the server pipeline.
+//
+// Reads recorded STATE/DONE datagrams (packet_capture.h format),
+// regroups them into the batches they were received in and hands
+// each batch to Dispatcher::process(): parse_packet, encode,
+// encode_masks, RewardCalc::compute, infer_batch, RolloutWriter.
+// No sockets are opened; ACTIONs are built and discarded.
+//
+//   fate_replay capture.bin --model-dir ./models            (as fast as possible)
+//   fate_replay capture.bin --model-dir ./models --paced    (original timing)
+// ============================================================
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <torch/torch.h>
+
+#include "dispatcher.h"
+#include "inference_engine.h"
+#include "packet_capture.h"
+#include "rollout_writer.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string capture_path;
+    std::string device_str = "cpu";
+    std::string model_dir = "./models";
+    std::string rollout_dir = "./replay_rollouts";
+    int rollout_size = 4096;
+    bool paced = false;      // false: as fast as possible
+    double speed = 1.0;      // paced mode time scale (2.0 = twice as fast)
+    bool grouped_heroes = false;  // server --grouped-heroes
+};
+
+static Options parse_args(int argc, char* argv[]) {
+    Options o;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--device" && i + 1 < argc)
+            o.device_str = argv[++i];
+        else if (arg == "--model-dir" && i + 1 < argc)
+            o.model_dir = argv[++i];
+        else if (arg == "--rollout-dir" && i + 1 < argc)
+            o.rollout_dir = argv[++i];
+        else if (arg == "--rollout-size" && i + 1 < argc)
+            o.rollout_size = std::stoi(argv[++i]);
+        else if (arg == "--paced")
+            o.paced = true;
+        else if (arg == "--speed" && i + 1 < argc)
+            o.speed = std::max(0.01, std::stod(argv[++i]));
+        else if (arg == "--grouped-heroes")
+            o.grouped_heroes = true;
+        else if (arg == "--help" || arg == "-h") {
+            std::cout << "Usage: fate_replay <capture-file> [options]\n"
+                      << "  --device <str>         Torch device (default: cpu)\n"
+                      << "  --model-dir <path>     Model directory (default: ./models)\n"
+                      << "  --rollout-dir <path>   Rollout output dir (default: ./replay_rollouts)\n"
+                      << "  --rollout-size <int>   Min transitions before dump (default: 4096)\n"
+                      << "  --paced                Replay with the original inter-batch timing\n"
+                      << "                         (default: as fast as possible)\n"
+                      << "  --speed <float>        Paced mode time scale (default: 1.0)\n"
+                      << "  --grouped-heroes       Grouped 12-hero forward, as the server option\n";
+            std::exit(0);
+        } else if (o.capture_path.empty() && arg.rfind("--", 0) != 0) {
+            o.capture_path = arg;
+        }
+    }
+    return o;
+}
+
+// ============================================================
+// Capture loading: whole file in memory, batches as received
+// ============================================================
+struct ReplayBatch {
+    uint64_t timestamp_ns;
+    std::vector<Datagram> packets;   // views into the loaded file
+};
+
+static bool load_capture(const std::string& path, std::vector<uint8_t>& bytes,
+                         std::vector<ReplayBatch>& batches) {
+    std::ifstream f(path, std::ios::binary | std::ios::ate);
+    if (!f) {
+        std::cerr << "[replay] Cannot open " << path << std::endl;
+        return false;
+    }
+    bytes.resize(static_cast<size_t>(f.tellg()));
+    f.seekg(0);
+    f.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+
+    CaptureFileHeader hdr;
+    if (bytes.size() < sizeof(hdr)) {
+        std::cerr << "[replay] " << path << " is too short" << std::endl;
+        return false;
+    }
+    std::memcpy(&hdr, bytes.data(), sizeof(hdr));
+    if (hdr.magic != CAPTURE_MAGIC || hdr.version != CAPTURE_VERSION
+        || hdr.record_header_size != sizeof(CaptureRecordHeader)) {
+        std::cerr << "[replay] " << path << " is not a v" << CAPTURE_VERSION
+                  << " capture file" << std::endl;
+        return false;
+    }
+
+    size_t off = sizeof(hdr);
+    while (off + sizeof(CaptureRecordHeader) <= bytes.size()) {
+        CaptureRecordHeader rec;
+        std::memcpy(&rec, bytes.data() + off, sizeof(rec));
+        off += sizeof(rec);
+        if (off + rec.len > bytes.size()) {
+            std::cerr << "[replay] Truncated record at offset " << off << ", stopping" << std::endl;
+            break;
+        }
+
+        // Records of one receive batch share a timestamp
+        if (batches.empty() || batches.back().timestamp_ns != rec.timestamp_ns) {
+            batches.push_back({rec.timestamp_ns, {}});
+        }
+        Datagram dg;
+        dg.from.ip = rec.ip;
+        dg.from.port = rec.port;
+        dg.data = bytes.data() + off;
+        dg.len = rec.len;
+        dg.shm_slot = rec.shm_slot;
+        batches.back().packets.push_back(dg);
+        off += rec.len;
+    }
+    return true;
+}
+
+// ============================================================
+// Reporting
+// ============================================================
+static void print_latency_row(const char* name, std::vector<float> v) {
+    if (v.empty()) return;
+    std::sort(v.begin(), v.end());
+    double sum = 0.0;
+    for (float x : v) sum += x;
+    auto pct = [&](double p) { return v[static_cast<size_t>(p * (v.size() - 1))]; };
+    std::printf("  %-8s %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                name, sum / v.size(), pct(0.50), pct(0.99), pct(0.999), v.back());
+}
+
+int main(int argc, char* argv[]) {
+    Options opt = parse_args(argc, argv);
+    if (opt.capture_path.empty()) {
+        std::cerr << "[replay] No capture file given (see --help)" << std::endl;
+        return 1;
+    }
+
+    std::vector<uint8_t> bytes;
+    std::vector<ReplayBatch> batches;
+    if (!load_capture(opt.capture_path, bytes, batches)) return 1;
+
+    size_t num_records = 0;
+    for (const auto& b : batches) num_records += b.packets.size();
+    std::cout << "[replay] Loaded " << num_records << " datagrams in " << batches.size()
+              << " batches (" << (bytes.size() >> 10) << " KB)" << std::endl;
+    if (batches.empty()) return 0;
+
+    torch::Device device(torch::kCPU);
+    if (opt.device_str == "cuda" && torch::cuda::is_available()) {
+        device = torch::Device(torch::kCUDA);
+    }
+    std::cout << "[replay] Using " << (device.is_cuda() ? "CUDA" : "CPU")
+              << ", " << (opt.paced ? "paced" : "as fast as possible") << std::endl;
+
+    InferenceEngine engine(opt.model_dir, device, opt.grouped_heroes);
+    RolloutWriter writer(opt.rollout_dir);
+    Dispatcher dispatcher(0, nullptr, engine, writer, device);
+
+    StageTimings timings;
+    for (auto& v : timings.us) v.reserve(num_records);
+    dispatcher.set_stage_timings(&timings);
+
+    std::vector<float> batch_us;
+    std::vector<float> lag_us;   // paced: how late each batch started
+    batch_us.reserve(batches.size());
+    double busy_s = 0.0;
+
+    const uint64_t t0_ns = batches.front().timestamp_ns;
+    const auto start = Clock::now();
+    auto next_dump = start + std::chrono::seconds(1);
+
+    for (const auto& batch : batches) {
+        if (opt.paced) {
+            // Shards interleave in the capture: never schedule before t0
+            int64_t offset_ns = std::max<int64_t>(
+                0, static_cast<int64_t>(batch.timestamp_ns - t0_ns));
+            auto due = start + std::chrono::nanoseconds(
+                           static_cast<int64_t>(offset_ns / opt.speed));
+            std::this_thread::sleep_until(due);
+            lag_us.push_back(std::chrono::duration<float, std::micro>(Clock::now() - due).count());
+        }
+
+        auto b0 = Clock::now();
+        dispatcher.process(batch.packets);
+        auto b1 = Clock::now();
+        batch_us.push_back(std::chrono::duration<float, std::micro>(b1 - b0).count());
+        busy_s += std::chrono::duration<double>(b1 - b0).count();
+
+        // Same cadence as the server's dump timer
+        if (b1 >= next_dump) {
+            writer.maybe_dump(opt.rollout_size);
+            next_dump = b1 + std::chrono::seconds(1);
+        }
+    }
+    writer.maybe_dump(opt.rollout_size);
+
+    const double elapsed_s = std::chrono::duration<double>(Clock::now() - start).count();
+    const uint64_t ticks = dispatcher.total_packets;
+    const double capture_s = std::max<int64_t>(
+        0, static_cast<int64_t>(batches.back().timestamp_ns - t0_ns)) * 1e-9;
+
+    std::printf("\n[replay] %llu STATE ticks processed, %llu superseded, %llu inferences"
+                " in %llu forwards\n",
+                static_cast<unsigned long long>(ticks),
+                static_cast<unsigned long long>(dispatcher.total_skipped.load()),
+                static_cast<unsigned long long>(dispatcher.total_inferences.load()),
+                static_cast<unsigned long long>(dispatcher.total_forwards.load()));
+    std::printf("[replay] Wall %.2f s (capture spans %.2f s), busy %.2f s\n",
+                elapsed_s, capture_s, busy_s);
+    std::printf("[replay] Throughput: %.1f ticks/s wall, %.1f ticks/s busy\n",
+                ticks / elapsed_s, busy_s > 0 ? ticks / busy_s : 0.0);
+
+    std::printf("\n  %-8s %10s %10s %10s %10s %10s   (us)\n",
+                "stage", "mean", "p50", "p99", "p99.9", "max");
+    for (int s = 0; s < NUM_PIPELINE_STAGES; ++s) {
+        print_latency_row(pipeline_stage_name(s), timings.us[s]);
+    }
+    print_latency_row("batch", batch_us);
+    if (opt.paced) print_latency_row("lag", lag_us);
+    return 0;
+}
@@ -0,0 +1,239 @@
+// ============================================================
+// fate_shm_client: reference client for the shared-memory transport.
+//
+// Attaches to a running server (--shm <path>), then drives its slot's
+// rings with synthetic STATE packets and waits for each ACTION,
+// reporting round-trip latency. Lets the transport be exercised on
+// Linux without WC3.
+//
+//   fate_shm_client --shm /tmp/fate_rl.sock --ticks 1000 --spin-us 50
+// ============================================================
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "protocol.h"
+#include "shm_ring.h"
+#include "synthetic_game.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string shm_socket = "/tmp/fate_rl.sock";
+    int ticks = 1000;
+    int interval_us = 0;     // pause between ticks (0 = back-to-back)
+    int spin_us = 50;        // spin on the ring before sleeping on the doorbell
+    int timeout_ms = 1000;   // give up on an ACTION after this long
+};
+
+static Options parse_args(int argc, char* argv[]) {
+    Options o;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--shm" && i + 1 < argc)
+            o.shm_socket = argv[++i];
+        else if (arg == "--ticks" && i + 1 < argc)
+            o.ticks = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--interval-us" && i + 1 < argc)
+            o.interval_us = std::max(0, std::stoi(argv[++i]));
+        else if (arg == "--spin-us" && i + 1 < argc)
+            o.spin_us = std::max(0, std::stoi(argv[++i]));
+        else if (arg == "--timeout-ms" && i + 1 < argc)
+            o.timeout_ms = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--help" || arg == "-h") {
+            std::cout << "Usage: fate_shm_client [options]\n"
+                      << "  --shm <path>           Server handshake socket (default: /tmp/fate_rl.sock)\n"
+                      << "  --ticks <int>          STATE packets to send (default: 1000)\n"
+                      << "  --interval-us <int>    Pause between ticks (default: 0)\n"
+                      << "  --spin-us <int>        Spin before sleeping on the doorbell (default: 50)\n"
+                      << "  --timeout-ms <int>     ACTION timeout (default: 1000)\n";
+            std::exit(0);
+        }
+    }
+    return o;
+}
+
+// ============================================================
+// Handshake: ShmHello + [memfd, server doorbell, client doorbell]
+// ============================================================
+static bool attach(const std::string& path, ShmHello& hello, int fds[3]) {
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if (sock < 0 || connect(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        std::cerr << "[shm_client] connect " << path << " failed: " << errno << std::endl;
+        return false;
+    }
+
+    struct iovec iov;
+    iov.iov_base = &hello;
+    iov.iov_len = sizeof(hello);
+    alignas(struct cmsghdr) char ctrl[CMSG_SPACE(3 * sizeof(int))];
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (n != static_cast<ssize_t>(sizeof(hello)) || hello.magic != SHM_MAGIC
+        || hello.version != SHM_VERSION) {
+        std::cerr << "[shm_client] Bad handshake" << std::endl;
+        return false;
+    }
+    if (hello.slot == SHM_NO_SLOT) {
+        std::cerr << "[shm_client] Server has no free slot" << std::endl;
+        return false;
+    }
+    struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+    if (!cm || cm->cmsg_type != SCM_RIGHTS || cm->cmsg_len != CMSG_LEN(3 * sizeof(int))) {
+        std::cerr << "[shm_client] Handshake carried no fds" << std::endl;
+        return false;
+    }
+    std::memcpy(fds, CMSG_DATA(cm), 3 * sizeof(int));
+
+    // Keep the connection open: the server detaches the slot on EOF
+    return true;
+}
+
+static double percentile(std::vector<double>& v, double p) {
+    if (v.empty()) return 0.0;
+    size_t k = static_cast<size_t>(p * (v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+int main(int argc, char* argv[]) {
+    Options opt = parse_args(argc, argv);
+
+    ShmHello hello;
+    int fds[3];
+    if (!attach(opt.shm_socket, hello, fds)) return 1;
+    const int memfd = fds[0], server_bell = fds[1], client_bell = fds[2];
+
+    void* base = mmap(nullptr, hello.segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (base == MAP_FAILED) {
+        std::cerr << "[shm_client] mmap failed: " << errno << std::endl;
+        return 1;
+    }
+    ShmSlot* slot = shm_slot(base, hello.slot);
+    ShmProducer out(&slot->to_server);
+    ShmConsumer in(&slot->to_client);
+
+    std::cout << "[shm_client] Attached to slot " << hello.slot
+              << " of " << hello.num_slots << std::endl;
+
+    const uint32_t episode_id = static_cast<uint32_t>(
+        std::chrono::system_clock::now().time_since_epoch().count()) | 1;
+    const PacketHeaderExt ext{hello.slot + 1, episode_id};
+    SyntheticGame game(episode_id);
+    std::vector<uint8_t> state;
+
+    std::vector<double> rtt_us;
+    rtt_us.reserve(opt.ticks);
+    int lost = 0;
+    uint64_t doorbells = 0;
+    auto start = Clock::now();
+
+    for (uint32_t tick = 1; tick <= static_cast<uint32_t>(opt.ticks); ++tick) {
+        game.step(0.1f);
+        game.write_state(state, PROTO_VERSION_V2, ext, tick);
+        auto t0 = Clock::now();
+
+        uint8_t* p;
+        while (!(p = out.reserve(state.size()))) {}  // server releases every batch
+        std::memcpy(p, state.data(), state.size());
+        if (out.commit()) {
+            uint64_t one = 1;
+            if (write(server_bell, &one, sizeof(one)) == sizeof(one)) ++doorbells;
+        }
+
+        // Wait for the ACTION of this tick
+        bool got = false;
+        auto spin_until = t0 + std::chrono::microseconds(opt.spin_us);
+        auto give_up = t0 + std::chrono::milliseconds(opt.timeout_ms);
+        while (!got) {
+            size_t len;
+            while (const uint8_t* a = in.peek(len)) {
+                PacketHeader h;
+                std::memcpy(&h, a, sizeof(h));
+                if (len >= sizeof(h) && h.msg_type == MSG_ACTION && h.tick == tick) got = true;
+            }
+            in.release();
+            if (got) break;
+
+            auto now = Clock::now();
+            if (now >= give_up) break;
+            if (now < spin_until) continue;
+
+            // Sleep on the doorbell
+            if (in.prepare_wait()) {
+                in.end_wait();
+                continue;
+            }
+            struct pollfd pfd = {client_bell, POLLIN, 0};
+            int ms = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                         give_up - now).count()) + 1;
+            if (poll(&pfd, 1, ms) > 0) {
+                uint64_t count;
+                while (read(client_bell, &count, sizeof(count)) == sizeof(count)) {}
+            }
+            in.end_wait();
+        }
+
+        if (got) {
+            rtt_us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - t0).count());
+        } else {
+            ++lost;
+        }
+
+        if (opt.interval_us > 0)
+            usleep(static_cast<useconds_t>(opt.interval_us));
+    }
+
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    // End the episode so the server flushes its rollout buffer
+    std::vector<uint8_t> done;
+    game.write_done(done, PROTO_VERSION_V2, ext, static_cast<uint32_t>(opt.ticks) + 1, 2);
+    if (uint8_t* p = out.reserve(done.size())) {
+        std::memcpy(p, done.data(), done.size());
+        if (out.commit()) {
+            uint64_t one = 1;
+            if (write(server_bell, &one, sizeof(one)) < 0) {}
+        }
+    }
+
+    std::printf("[shm_client] %d ticks in %.2f s (%.0f ticks/s), %d lost, %llu doorbells\n",
+                opt.ticks, elapsed, opt.ticks / elapsed, lost,
+                static_cast<unsigned long long>(doorbells));
+    if (!rtt_us.empty()) {
+        double mn = *std::min_element(rtt_us.begin(), rtt_us.end());
+        double mx = *std::max_element(rtt_us.begin(), rtt_us.end());
+        double p50 = percentile(rtt_us, 0.50);
+        double p99 = percentile(rtt_us, 0.99);
+        std::printf("[shm_client] RTT us: min %.1f  p50 %.1f  p99 %.1f  max %.1f\n",
+                    mn, p50, p99, mx);
+    }
+
+    munmap(base, hello.segment_size);
+    close(memfd);
+    close(server_bell);
+    close(client_bell);
+    return 0;
+}
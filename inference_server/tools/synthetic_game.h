@@ -0,0 +1,682 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "constants.h"
+#include "protocol.h"
+
+// ============================================================
+// SyntheticGame: plausible 12-hero game state for the tools
+// (load generator, shm client, mock game) without WC3.
+//
+// Heroes wander the map, trade damage, die and revive, level up,
+// use portals and score kills; creeps and per-team visibility
+// follow. With apply_actions() (closed loop) heroes obey the ACTION
+// heads instead: move, skill/attack on unit_target, skill_levelup,
+// stat_upgrade and item_buy, and the action masks track cooldowns,
+// mana, skill/stat points and gold like the plugin's.
+//
+// write_state() produces a wire-format STATE exactly as the
+// plugin would (header, fixed block, events, grids, creeps).
+// ============================================================
+class SyntheticGame {
+public:
+    // DONE reasons (DoneBody::reason)
+    static constexpr uint8_t DONE_TEAM_WIPE = 1;
+    static constexpr uint8_t DONE_TIMEOUT   = 2;
+    static constexpr uint8_t DONE_SCORE     = 3;
+
+    explicit SyntheticGame(uint32_t seed = 1, int16_t target_score = 70,
+                           float max_game_time = 1800.0f)
+        : rng_(seed), target_score_(target_score), max_game_time_(max_game_time) {
+        reset();
+    }
+
+    /// Start a new episode: fresh heroes, creeps, score and clock.
+    void reset() {
+        std::memset(&global_, 0, sizeof(global_));
+        global_.target_score = target_score_;
+        global_.time_of_day = 6.0f;
+        global_.next_point_time = 60.0f;
+
+        const auto& ids = hero_ids();
+        for (int i = 0; i < MAX_UNITS; ++i) {
+            UnitState& u = units_[i];
+            std::memset(&u, 0, sizeof(u));
+            u.idx = static_cast<uint8_t>(i);
+            std::memcpy(u.hero_id, ids[i].data(), 4);
+            u.team = i < MAX_UNITS / 2 ? 0 : 1;
+            u.max_hp = 1500.0f + uniform(0.0f, 500.0f);
+            u.hp = u.max_hp;
+            u.max_mp = 600.0f + uniform(0.0f, 200.0f);
+            u.mp = u.max_mp;
+            u.x = uniform(MAP_MIN_X, MAP_MAX_X);
+            u.y = uniform(MAP_MIN_Y, MAP_MAX_Y);
+            u.alive = 1;
+            u.str = u.agi = u.int_ = 20;
+            u.atk = 120.0f;
+            u.def_ = 5.0f;
+            u.move_spd = 300.0f;
+            u.atk_range = 150.0f;
+            u.atk_spd = 1.0f;
+            u.level = 1;
+            u.skill_points = 1;
+            for (int s = 0; s < 6; ++s) {
+                u.skills[s].abil_id = 0x41303030 + s;  // "A000".."A005"
+                u.skills[s].exists = 1;
+                u.skills[s].level = s < 4 ? 1 : 0;
+                u.skills[s].cd_max = 10.0f + 5.0f * s;
+            }
+            u.seal_charges = 3;
+            u.faire = 500;
+            u.faire_cap = 16000;
+            u.visible_mask = 0x0FFF;
+            target_x_[i] = u.x;
+            target_y_[i] = u.y;
+            orders_[i] = Order{};
+            portal_cd_[i] = 0.0f;
+        }
+
+        creeps_.resize(40);
+        for (auto& c : creeps_) {
+            c.x = uniform(MAP_MIN_X, MAP_MAX_X);
+            c.y = uniform(MAP_MIN_Y, MAP_MAX_Y);
+            c.max_hp = 500.0f;
+            c.hp = c.max_hp;
+        }
+        events_.clear();
+        update_visibility();
+        update_masks();
+    }
+
+    /// Queue the orders of an ACTION (closed loop); step() carries them
+    /// out. Without this, heroes pick random waypoints.
+    void apply_actions(const UnitAction* actions, int count) {
+        for (int k = 0; k < count; ++k) {
+            const UnitAction& a = actions[k];
+            if (a.idx >= MAX_UNITS) continue;
+            const UnitState& u = units_[a.idx];
+            target_x_[a.idx] = clampf(u.x + a.move_x * 1000.0f, MAP_MIN_X, MAP_MAX_X);
+            target_y_[a.idx] = clampf(u.y + a.move_y * 1000.0f, MAP_MIN_Y, MAP_MAX_Y);
+
+            Order& o = orders_[a.idx];
+            o.steered = true;
+            o.skill = a.skill;
+            o.unit_target = a.unit_target;
+            o.skill_levelup = a.skill_levelup;
+            o.stat_upgrade = a.stat_upgrade;
+            o.item_buy = a.item_buy;
+        }
+    }
+
+    /// Advance the simulation by dt seconds of game time.
+    void step(float dt) {
+        events_.clear();
+        global_.game_time += dt;
+        global_.time_of_day = std::fmod(global_.time_of_day + dt * 0.05f, 24.0f);
+        global_.is_night = (global_.time_of_day < 6.0f || global_.time_of_day >= 18.0f) ? 1 : 0;
+
+        for (int i = 0; i < MAX_UNITS; ++i) {
+            UnitState& u = units_[i];
+            Order& o = orders_[i];
+            if (!u.alive) {
+                u.revive_remain = std::max(0.0f, u.revive_remain - dt);
+                if (u.revive_remain <= 0.0f) {
+                    u.alive = 1;
+                    u.hp = u.max_hp;
+                    u.x = u.team == 0 ? MAP_MIN_X + 500.0f : MAP_MAX_X - 500.0f;
+                    u.y = (MAP_MIN_Y + MAP_MAX_Y) * 0.5f;
+                }
+                o = Order{};
+                continue;
+            }
+
+            // Move toward the current waypoint
+            float dx = target_x_[i] - u.x, dy = target_y_[i] - u.y;
+            float dist = std::sqrt(dx * dx + dy * dy);
+            if (dist < 50.0f && !o.steered) {
+                // Wander around the middle of the map, where fights happen
+                target_x_[i] = uniform(MAP_MIN_X * 0.5f, MAP_MAX_X * 0.5f);
+                target_y_[i] = uniform(MAP_MIN_Y * 0.5f, MAP_MAX_Y * 0.5f);
+            }
+            float stepd = std::min(dist, u.move_spd * dt);
+            u.vel_x = dist > 0.0f ? dx / dist * u.move_spd : 0.0f;
+            u.vel_y = dist > 0.0f ? dy / dist * u.move_spd : 0.0f;
+            if (dist > 0.0f) {
+                u.x += dx / dist * stepd;
+                u.y += dy / dist * stepd;
+            }
+            use_portal(i, dt);
+
+            u.mp = std::min(u.max_mp, u.mp + 2.0f * dt);
+            u.hp = std::min(u.max_hp, u.hp + 1.0f * dt);
+            u.faire = std::min<int32_t>(u.faire_cap, u.faire + static_cast<int32_t>(20.0f * dt + 0.5f));
+            for (auto& s : u.skills) s.cd_remain = std::max(0.0f, s.cd_remain - dt);
+            gain_xp(i, 1);
+
+            carry_out_orders(i);
+        }
+
+        // Auto-attacks: an alive enemy within range takes damage
+        for (int i = 0; i < MAX_UNITS; ++i) {
+            const UnitState& a = units_[i];
+            if (!a.alive) continue;
+            for (int j = 0; j < MAX_UNITS; ++j) {
+                const UnitState& b = units_[j];
+                if (!b.alive || a.team == b.team) continue;
+                float dx = a.x - b.x, dy = a.y - b.y;
+                if (dx * dx + dy * dy > 1000.0f * 1000.0f) continue;
+                damage(i, j, a.atk * dt * uniform(0.5f, 1.5f));
+            }
+        }
+
+        // Creeps: heroes chip at nearby creeps; dead creeps respawn elsewhere
+        for (auto& c : creeps_) {
+            for (int i = 0; i < MAX_UNITS; ++i) {
+                const UnitState& u = units_[i];
+                if (!u.alive) continue;
+                float dx = u.x - c.x, dy = u.y - c.y;
+                if (dx * dx + dy * dy > 600.0f * 600.0f) continue;
+                c.hp -= u.atk * dt;
+                if (c.hp <= 0.0f) {
+                    push_event(EVT_CREEP_KILL, static_cast<uint8_t>(i), 0);
+                    units_[i].faire += 50;
+                    gain_xp(i, 30);
+                    c.x = uniform(MAP_MIN_X, MAP_MAX_X);
+                    c.y = uniform(MAP_MIN_Y, MAP_MAX_Y);
+                    c.hp = c.max_hp;
+                    break;
+                }
+            }
+        }
+
+        update_visibility();
+        update_masks();
+    }
+
+    /// DONE reason once the episode is over (score, team wipe or time
+    /// limit), 0 while it is still running.
+    uint8_t done_reason() const {
+        if (global_.score_team0 >= global_.target_score
+            || global_.score_team1 >= global_.target_score) return DONE_SCORE;
+        bool alive[2] = {false, false};
+        for (const auto& u : units_) alive[u.team] = alive[u.team] || u.alive;
+        if (!alive[0] || !alive[1]) return DONE_TEAM_WIPE;
+        if (global_.game_time >= max_game_time_) return DONE_TIMEOUT;
+        return 0;
+    }
+
+    bool finished() const { return done_reason() != 0; }
+
+    /// Append a STATE for this tick to out (cleared first).
+    /// version: PROTO_VERSION or PROTO_VERSION_V2 (ext used for v2).
+    /// grid_flags: visibility encoding (0 = raw, GRID_VIS_BITS), plus
+    ///             STATE_ACTION_ACK to ask for compact ACTIONs (acked_action_tick
+    ///             is then appended); pathability is added on tick 1 like the plugin.
+    void write_state(std::vector<uint8_t>& out, uint8_t version, const PacketHeaderExt& ext,
+                     uint32_t tick, uint8_t grid_flags = GRID_VIS_BITS,
+                     uint32_t acked_action_tick = 0) const {
+        out.clear();
+        write_header(out, version, MSG_STATE, ext, tick);
+        append(out, &global_, sizeof(global_));
+        append(out, units_, sizeof(units_));
+
+        out.push_back(static_cast<uint8_t>(events_.size()));
+        for (Event e : events_) {
+            e.tick = tick;
+            append(out, &e, sizeof(e));
+        }
+
+        const bool with_path = tick == 1;
+        out.push_back(static_cast<uint8_t>((grid_flags & (GRID_VIS_BITS | STATE_ACTION_ACK))
+                                           | (with_path ? GRID_HAS_PATHABILITY : 0)));
+        if (with_path) out.insert(out.end(), GRID_CELLS, 1);
+        for (const auto& vis : {vis_t0_, vis_t1_}) {
+            if (grid_flags & GRID_VIS_BITS) {
+                uint8_t bits[VIS_PACKED_BYTES] = {};
+                for (int c = 0; c < GRID_CELLS; ++c)
+                    if (vis[c]) bits[c >> 3] |= static_cast<uint8_t>(1u << (c & 7));
+                append(out, bits, sizeof(bits));
+            } else {
+                out.insert(out.end(), vis.begin(), vis.end());
+            }
+        }
+
+        const size_t n = std::min<size_t>(creeps_.size(), MAX_CREEPS);
+        out.push_back(static_cast<uint8_t>(n));
+        append(out, creeps_.data(), n * sizeof(CreepState));
+        if (grid_flags & STATE_ACTION_ACK)
+            append(out, &acked_action_tick, sizeof(acked_action_tick));
+    }
+
+    /// Append a DONE for the current score to out (cleared first).
+    void write_done(std::vector<uint8_t>& out, uint8_t version, const PacketHeaderExt& ext,
+                    uint32_t tick, uint8_t reason) const {
+        out.clear();
+        write_header(out, version, MSG_DONE, ext, tick);
+        DoneBody body{};
+        body.winner = global_.score_team0 > global_.score_team1 ? 0
+                    : global_.score_team1 > global_.score_team0 ? 1 : 2;
+        body.reason = reason;
+        body.score_team0 = global_.score_team0;
+        body.score_team1 = global_.score_team1;
+        append(out, &body, sizeof(body));
+    }
+
+    const UnitState* units() const { return units_; }
+    const GlobalState& global() const { return global_; }
+
+private:
+    // Orders from the last ACTION (indices as in UnitAction)
+    struct Order {
+        bool    steered = false;    // move came from an ACTION (no wandering)
+        uint8_t skill = 0;          // 0 none, 1 attack, 2-7 skill slot 0-5
+        uint8_t unit_target = 0;    // 0-5 allies, 6-7 special, 8-13 enemies
+        uint8_t skill_levelup = 0;  // 1-5: level skill slot 0-4
+        uint8_t stat_upgrade = 0;   // 1-9: spend a stat point
+        uint8_t item_buy = 0;       // 7-17: gold shop items
+    };
+
+    static constexpr float SKILL_MANA = 50.0f;
+    static constexpr float CAST_RANGE = 1200.0f;
+
+    /// Gold shop prices by item_buy index (0-6: none / faire options)
+    static int32_t item_cost(int idx) {
+        static const int32_t cost[18] = {
+            0, 0, 0, 0, 0, 0, 0, 100, 250, 300, 400, 500, 700, 750, 800, 1500, 1500, 150};
+        return cost[idx];
+    }
+
+    static void write_header(std::vector<uint8_t>& out, uint8_t version, uint8_t msg_type,
+                             const PacketHeaderExt& ext, uint32_t tick) {
+        PacketHeader h;
+        h.magic = MAGIC;
+        h.version = version;
+        h.msg_type = msg_type;
+        h.tick = tick;
+        append(out, &h, sizeof(h));
+        if (version == PROTO_VERSION_V2) append(out, &ext, sizeof(ext));
+    }
+
+    static void append(std::vector<uint8_t>& out, const void* p, size_t n) {
+        const uint8_t* b = static_cast<const uint8_t*>(p);
+        out.insert(out.end(), b, b + n);
+    }
+
+    static float clampf(float v, float lo, float hi) { return std::max(lo, std::min(hi, v)); }
+
+    float uniform(float lo, float hi) {
+        return std::uniform_real_distribution<float>(lo, hi)(rng_);
+    }
+
+    void push_event(uint8_t type, uint8_t a, uint8_t b) {
+        if (events_.size() >= static_cast<size_t>(MAX_EVENTS)) return;
+        Event e{};
+        e.type = type;
+        e.killer_idx = a;
+        e.victim_idx = b;
+        events_.push_back(e);
+    }
+
+    float distance(int i, int j) const {
+        return std::hypot(units_[i].x - units_[j].x, units_[i].y - units_[j].y);
+    }
+
+    /// unit_target 8-13 -> enemy unit index (-1 if not an enemy slot)
+    int enemy_index(int i, uint8_t unit_target) const {
+        if (unit_target < 8 || unit_target > 13) return -1;
+        int base = units_[i].team == 0 ? MAX_UNITS / 2 : 0;
+        return base + (unit_target - 8);
+    }
+
+    void gain_xp(int i, int32_t xp) {
+        UnitState& u = units_[i];
+        u.xp += xp;
+        while (u.xp >= 100 * u.level && u.level < 25) {
+            ++u.level;
+            ++u.skill_points;
+            u.stat_points += 3;
+            u.max_hp += 80.0f;
+            push_event(EVT_LEVEL_UP, static_cast<uint8_t>(i), u.level);
+        }
+    }
+
+    void damage(int attacker, int victim, float amount) {
+        UnitState& b = units_[victim];
+        if (!b.alive) return;
+        b.hp -= std::max(0.0f, amount - b.def_ * 0.1f);
+        if (b.hp > 0.0f) return;
+        b.hp = 0.0f;
+        b.alive = 0;
+        b.revive_remain = 10.0f;
+        if (units_[attacker].team == 0) global_.score_team0 += 1;
+        else global_.score_team1 += 1;
+        units_[attacker].faire += 300;
+        gain_xp(attacker, 200);
+        push_event(EVT_KILL, static_cast<uint8_t>(attacker), static_cast<uint8_t>(victim));
+    }
+
+    /// Entering a portal's entrance (or exit) moves the hero to the
+    /// other end; a short cooldown avoids bouncing straight back.
+    void use_portal(int i, float dt) {
+        UnitState& u = units_[i];
+        portal_cd_[i] = std::max(0.0f, portal_cd_[i] - dt);
+        if (portal_cd_[i] > 0.0f) return;
+        for (int p = 0; p < NUM_PORTALS; ++p) {
+            const PortalDef& pd = PORTALS[p];
+            const bool at_entrance = std::hypot(u.x - pd.x, u.y - pd.y) <= 200.0f;
+            const bool at_exit = std::hypot(u.x - pd.ex, u.y - pd.ey) <= 200.0f;
+            if (!at_entrance && !at_exit) continue;
+            u.x = at_entrance ? pd.ex : pd.x;
+            u.y = at_entrance ? pd.ey : pd.y;
+            target_x_[i] = u.x;
+            target_y_[i] = u.y;
+            portal_cd_[i] = 5.0f;
+            push_event(EVT_PORTAL, static_cast<uint8_t>(i), static_cast<uint8_t>(p));
+            return;
+        }
+    }
+
+    /// Skill / attack, skill level-up, stat upgrade and item purchase.
+    /// Orders the masks forbid are ignored, as the game would.
+    void carry_out_orders(int i) {
+        UnitState& u = units_[i];
+        Order& o = orders_[i];
+
+        if (o.skill >= 1 && o.skill <= 7 && mask_bit(u.mask_skill, o.skill)) {
+            int victim = enemy_index(i, o.unit_target);
+            if (o.skill == 1) {
+                if (victim >= 0 && units_[victim].alive && distance(i, victim) <= 1000.0f)
+                    damage(i, victim, u.atk * 2.0f);
+            } else {
+                SkillSlot& s = u.skills[o.skill - 2];
+                s.cd_remain = s.cd_max;
+                u.mp -= SKILL_MANA;
+                if (victim >= 0 && units_[victim].alive && distance(i, victim) <= CAST_RANGE)
+                    damage(i, victim, 150.0f * s.level + 5.0f * u.int_);
+            }
+        }
+
+        if (o.skill_levelup >= 1 && o.skill_levelup <= 5 && u.skill_points > 0) {
+            SkillSlot& s = u.skills[o.skill_levelup - 1];
+            if (s.level < 5) {
+                ++s.level;
+                --u.skill_points;
+            }
+        }
+
+        if (o.stat_upgrade >= 1 && o.stat_upgrade <= 9 && u.stat_points > 0) {
+            --u.stat_points;
+            switch (o.stat_upgrade % 3) {
+            case 0: u.str += 1; u.max_hp += 20.0f; u.atk += 2.0f; break;
+            case 1: u.agi += 1; u.atk_spd += 0.02f; break;
+            default: u.int_ += 1; u.max_mp += 15.0f; break;
+            }
+        }
+
+        if (o.item_buy >= 7 && o.item_buy <= 17 && u.faire >= item_cost(o.item_buy)) {
+            for (auto& it : u.items) {
+                if (it.type_id != 0) continue;
+                it.type_id = static_cast<int16_t>(o.item_buy);
+                it.charges = 1;
+                u.faire -= item_cost(o.item_buy);
+                break;
+            }
+        }
+
+        // Orders are one-shot; the move waypoint stays until the next ACTION
+        o = Order{};
+    }
+
+    /// Action masks in the server's layout (bit 0 = "none", always set).
+    void update_masks() {
+        for (int i = 0; i < MAX_UNITS; ++i) {
+            UnitState& u = units_[i];
+            u.mask_skill = 0x01;
+            u.mask_unit_target = 0x00C0;       // no_target, attack_point
+            u.mask_skill_levelup = 0x01;
+            u.mask_stat_upgrade = 0x0001;
+            u.mask_attribute = 0x01;
+            u.mask_item_buy = 0x1;
+            u.mask_item_use = 0x01;
+            u.mask_seal_use = 0x01;
+            u.mask_faire_send = 0x01;
+            u.mask_faire_request = 0x01;
+            u.mask_faire_respond = 0x01;
+            if (!u.alive) continue;
+
+            u.mask_skill |= 0x02;              // attack
+            for (int s = 0; s < 6; ++s) {
+                const SkillSlot& sk = u.skills[s];
+                if (sk.level > 0 && sk.cd_remain <= 0.0f && u.mp >= SKILL_MANA)
+                    u.mask_skill |= static_cast<uint8_t>(1u << (s + 2));
+            }
+
+            const int ally_base = u.team == 0 ? 0 : MAX_UNITS / 2;
+            const int enemy_base = u.team == 0 ? MAX_UNITS / 2 : 0;
+            for (int k = 0; k < MAX_UNITS / 2; ++k) {
+                if (units_[ally_base + k].alive)
+                    u.mask_unit_target |= static_cast<uint16_t>(1u << k);
+                if (units_[enemy_base + k].alive)
+                    u.mask_unit_target |= static_cast<uint16_t>(1u << (8 + k));
+            }
+
+            if (u.skill_points > 0) {
+                for (int s = 0; s < 5; ++s)
+                    if (u.skills[s].level < 5)
+                        u.mask_skill_levelup |= static_cast<uint8_t>(1u << (s + 1));
+            }
+            if (u.stat_points > 0) u.mask_stat_upgrade |= 0x03FE;
+
+            bool free_slot = false;
+            for (const auto& it : u.items) free_slot = free_slot || it.type_id == 0;
+            if (free_slot) {
+                for (int k = 7; k <= 17; ++k)
+                    if (u.faire >= item_cost(k)) u.mask_item_buy |= 1u << k;
+            }
+        }
+    }
+
+    /// Each team sees cells within 3 cells of its alive heroes.
+    void update_visibility() {
+        vis_t0_.assign(GRID_CELLS, 0);
+        vis_t1_.assign(GRID_CELLS, 0);
+        for (const auto& u : units_) {
+            if (!u.alive) continue;
+            auto& vis = u.team == 0 ? vis_t0_ : vis_t1_;
+            int gx = static_cast<int>((u.x - MAP_MIN_X) / CELL_SIZE);
+            int gy = static_cast<int>((u.y - MAP_MIN_Y) / CELL_SIZE);
+            for (int y = std::max(0, gy - 3); y <= std::min(GRID_H - 1, gy + 3); ++y)
+                for (int x = std::max(0, gx - 3); x <= std::min(GRID_W - 1, gx + 3); ++x)
+                    vis[y * GRID_W + x] = 1;
+        }
+    }
+
+    std::mt19937 rng_;
+    int16_t target_score_;
+    float max_game_time_;
+    GlobalState global_;
+    UnitState units_[MAX_UNITS];
+    float target_x_[MAX_UNITS];
+    float target_y_[MAX_UNITS];
+    Order orders_[MAX_UNITS];
+    float portal_cd_[MAX_UNITS];
+    std::vector<CreepState> creeps_;
+    std::vector<Event> events_;
+    std::vector<uint8_t> vis_t0_, vis_t1_;
+};
+
+// ============================================================
+// fragment_datagram: split pkt into MSG_FRAGMENTs of at most
+// frag_size bytes each (header included), like the plugin with
+// RL_FRAGMENT_SIZE. Returns false and leaves out empty when pkt
+// already fits.
+// ============================================================
+inline bool fragment_datagram(const std::vector<uint8_t>& pkt, size_t frag_size, uint32_t msg_id,
+                              std::vector<std::vector<uint8_t>>& out) {
+    out.clear();
+    if (frag_size <= sizeof(FragmentHeader) || pkt.size() <= frag_size
+        || pkt.size() < sizeof(PacketHeader))
+        return false;
+
+    const size_t chunk = frag_size - sizeof(FragmentHeader);
+    const size_t count = (pkt.size() + chunk - 1) / chunk;
+    PacketHeader orig;
+    std::memcpy(&orig, pkt.data(), sizeof(orig));
+
+    for (size_t i = 0; i < count; ++i) {
+        const size_t off = i * chunk;
+        const size_t n = std::min(chunk, pkt.size() - off);
+        FragmentHeader fh;
+        fh.header = orig;
+        fh.header.msg_type = MSG_FRAGMENT;
+        fh.msg_id = msg_id;
+        fh.total_len = static_cast<uint32_t>(pkt.size());
+        fh.offset = static_cast<uint32_t>(off);
+        fh.index = static_cast<uint16_t>(i);
+        fh.count = static_cast<uint16_t>(count);
+
+        out.emplace_back(sizeof(fh) + n);
+        std::memcpy(out.back().data(), &fh, sizeof(fh));
+        std::memcpy(out.back().data() + sizeof(fh), pkt.data() + off, n);
+    }
+    return true;
+}
+
+// ============================================================
+// DeltaStateEncoder: MSG_STATE_DELTA against the newest keyframe
+// the server answered with an ACTION, like the plugin with
+// RL_DELTA_STATE=1 (RLCommPlugin.EncodeStateForSend). A full STATE
+// is sent, and recorded as a keyframe, when none is acked yet or
+// the acked one is KEYFRAME_INTERVAL ticks old.
+// ============================================================
+class DeltaStateEncoder {
+public:
+    static constexpr uint32_t KEYFRAME_INTERVAL = 20;  // ticks before a fresh keyframe is due
+    static constexpr uint32_t KEYFRAME_RETRY = 4;      // min ticks between keyframes while unacked
+
+    /// full: a STATE from SyntheticGame::write_state. Returns full itself
+    /// (a keyframe) or the delta built in out.
+    const std::vector<uint8_t>& encode(const std::vector<uint8_t>& full, uint32_t tick,
+                                       std::vector<uint8_t>& out) {
+        const bool key_due = acked_ < 0 || tick - frames_[acked_].tick >= KEYFRAME_INTERVAL;
+        const bool can_resend = last_key_tick_ == 0 || tick - last_key_tick_ >= KEYFRAME_RETRY;
+        if (acked_ < 0 || (key_due && can_resend)) {
+            if (acked_ == next_) acked_ = -1;   // slot about to be overwritten
+            frames_[next_].tick = tick;
+            frames_[next_].packet = full;
+            next_ = (next_ + 1) % KEYFRAME_HISTORY;
+            last_key_tick_ = tick;
+            return full;
+        }
+
+        const std::vector<uint8_t>& base = frames_[acked_].packet;
+        const size_t hs = header_size(full);
+        Sections f = sections(full, hs), b = sections(base, hs);
+
+        out.clear();
+        out.insert(out.end(), full.begin(), full.begin() + hs);
+        out[offsetof(PacketHeader, msg_type)] = MSG_STATE_DELTA;
+        const uint32_t base_tick = frames_[acked_].tick;
+        const uint8_t* bt = reinterpret_cast<const uint8_t*>(&base_tick);
+        out.insert(out.end(), bt, bt + sizeof(base_tick));
+
+        // Changed chunks of GlobalState + UnitState[12]
+        const size_t mask_pos = out.size();
+        out.insert(out.end(), DELTA_MASK_BYTES, 0);
+        for (size_t c = 0; c < DELTA_NUM_CHUNKS; ++c) {
+            const size_t pos = hs + c * DELTA_CHUNK;
+            const size_t n = std::min(DELTA_CHUNK, STATE_BLOCK_SIZE - c * DELTA_CHUNK);
+            if (std::memcmp(&full[pos], &base[pos], n) == 0) continue;
+            out[mask_pos + (c >> 3)] |= static_cast<uint8_t>(1u << (c & 7));
+            out.insert(out.end(), full.begin() + pos, full.begin() + pos + n);
+        }
+
+        // Events, grid flags, pathability: copied as-is
+        out.insert(out.end(), full.begin() + hs + STATE_BLOCK_SIZE, full.begin() + f.vis0);
+
+        // Grids and creeps only when they differ from the keyframe
+        uint8_t flags = 0;
+        if (!same(full, f.vis0, f.vis1, base, b.vis0, b.vis1)) flags |= DELTA_VIS_T0;
+        if (!same(full, f.vis1, f.creeps, base, b.vis1, b.creeps)) flags |= DELTA_VIS_T1;
+        if (!same(full, f.creeps, f.end, base, b.creeps, b.end)) flags |= DELTA_CREEPS;
+        out.push_back(flags);
+        if (flags & DELTA_VIS_T0) out.insert(out.end(), full.begin() + f.vis0, full.begin() + f.vis1);
+        if (flags & DELTA_VIS_T1) out.insert(out.end(), full.begin() + f.vis1, full.begin() + f.creeps);
+        if (flags & DELTA_CREEPS) out.insert(out.end(), full.begin() + f.creeps, full.begin() + f.end);
+
+        // STATE_ACTION_ACK trailer
+        out.insert(out.end(), full.begin() + f.end, full.end());
+        return out;
+    }
+
+    /// An ACTION for tick means the server holds the STATE of that tick.
+    void note_action(uint32_t tick) {
+        for (int i = 0; i < KEYFRAME_HISTORY; ++i) {
+            if (frames_[i].packet.empty() || frames_[i].tick != tick) continue;
+            if (acked_ < 0 || tick > frames_[acked_].tick) acked_ = i;
+            return;
+        }
+    }
+
+    /// New episode: the server starts without keyframes.
+    void reset() {
+        for (auto& f : frames_) f.packet.clear();
+        acked_ = -1;
+        next_ = 0;
+        last_key_tick_ = 0;
+    }
+
+private:
+    struct Frame {
+        uint32_t tick = 0;
+        std::vector<uint8_t> packet;
+    };
+    struct Sections {
+        size_t vis0, vis1, creeps, end;   // end: after the creeps
+    };
+
+    static size_t header_size(const std::vector<uint8_t>& pkt) {
+        return pkt[offsetof(PacketHeader, version)] == PROTO_VERSION_V2
+            ? sizeof(PacketHeaderV2) : sizeof(PacketHeader);
+    }
+
+    static size_t vis_length(const std::vector<uint8_t>& pkt, size_t o, uint8_t grid_flags) {
+        if (grid_flags & GRID_VIS_BITS) return VIS_PACKED_BYTES;
+        if (grid_flags & GRID_VIS_RLE) {
+            uint16_t n;
+            std::memcpy(&n, &pkt[o], sizeof(n));
+            return sizeof(n) + n;
+        }
+        return GRID_CELLS;
+    }
+
+    static Sections sections(const std::vector<uint8_t>& pkt, size_t hs) {
+        size_t o = hs + STATE_BLOCK_SIZE;
+        o += 1 + pkt[o] * sizeof(Event);
+        const uint8_t grid_flags = pkt[o++];
+        if (grid_flags & GRID_HAS_PATHABILITY) o += GRID_CELLS;
+        Sections s;
+        s.vis0 = o;
+        s.vis1 = s.vis0 + vis_length(pkt, s.vis0, grid_flags);
+        s.creeps = s.vis1 + vis_length(pkt, s.vis1, grid_flags);
+        s.end = s.creeps + 1 + pkt[s.creeps] * sizeof(CreepState);
+        return s;
+    }
+
+    static bool same(const std::vector<uint8_t>& a, size_t a0, size_t a1,
+                     const std::vector<uint8_t>& b, size_t b0, size_t b1) {
+        return a1 - a0 == b1 - b0 && std::memcmp(&a[a0], &b[b0], a1 - a0) == 0;
+    }
+
+    Frame frames_[KEYFRAME_HISTORY];
+    int acked_ = -1;          // slot of the newest acked keyframe
+    int next_ = 0;
+    uint32_t last_key_tick_ = 0;
+};
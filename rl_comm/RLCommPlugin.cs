@@ -60,6 +60,63 @@ namespace RLComm
         private static int recvPort = 7778;  // Our receive port for ACTION packets
         private static volatile bool running;
 
+        // Protocol v2 (RL_PROTO_VERSION=2): header carries instance_id/episode_id
+        // so several games can share one host; ACTIONs come back to udpSend.
+        private static byte protoVersion = 1;
+        private static uint protoInstanceId;   // RL_INSTANCE_ID (default: recv port)
+        private static uint protoEpisodeId;    // new per game load
+
+        // Delta STATE (RL_DELTA_STATE=1): send MSG_STATE_DELTA against the newest
+        // keyframe the server answered with an ACTION; full keyframe periodically.
+        private const int UNIT_STATE_SIZE = 231;                                // sizeof(UnitState)
+        private const int STATE_BLOCK_SIZE = 28 + UNIT_STATE_SIZE * MAX_PLAYERS; // GlobalState + units
+        private const int DELTA_CHUNK = 16;
+        private const int DELTA_NUM_CHUNKS = (STATE_BLOCK_SIZE + DELTA_CHUNK - 1) / DELTA_CHUNK;
+        private const int DELTA_MASK_BYTES = (DELTA_NUM_CHUNKS + 7) / 8;
+        private const int KEYFRAME_HISTORY = 8;    // matches server history
+        private const int KEYFRAME_INTERVAL = 20;  // ticks before a fresh keyframe is due
+        private const int KEYFRAME_RETRY = 4;      // min ticks between keyframes while unacked
+        private static bool deltaEnabled;
+
+        // Visibility grid encoding (RL_VIS_ENCODING=bits|rle, default raw bytes)
+        private const byte GRID_HAS_PATHABILITY = 1, GRID_VIS_BITS = 2, GRID_VIS_RLE = 4;
+        private static byte visEncoding;           // 0, GRID_VIS_BITS or GRID_VIS_RLE
+
+        // Fragmentation (RL_FRAGMENT_SIZE=<bytes>): longer datagrams go out as
+        // MSG_FRAGMENTs of at most that size, reassembled by the server (0 = off)
+        private const int FRAGMENT_HEADER_SIZE = 24;   // sizeof(FragmentHeader)
+        private static int fragmentSize;
+        private static uint fragmentMsgId;
+        private static byte[] _fragBuf;
+        private static readonly uint[] _kfTick = new uint[KEYFRAME_HISTORY];
+        private static readonly byte[][] _kfPacket = new byte[KEYFRAME_HISTORY][];
+        private static int _kfNext;
+        private static int _kfAcked = -1;          // slot of newest acked keyframe
+        private static uint _kfLastSentTick;
+        private static readonly byte[] _deltaMask = new byte[DELTA_MASK_BYTES];
+        private static MemoryStream _deltaMs = new MemoryStream(8192);
+        private static BinaryWriter _deltaWriter = new BinaryWriter(_deltaMs);
+
+        // Compact ACTIONs (RL_COMPACT_ACTIONS=1): STATEs carry STATE_ACTION_ACK and the
+        // tick of the newest ACTION decoded; the server then sends MSG_ACTION_COMPACT
+        // with int8/int16 continuous heads and only the units that changed since it.
+        private const byte STATE_ACTION_ACK = 0x80;
+        private const int COMPACT_UNIT_SIZE = 17;  // sizeof(CompactUnitAction)
+        private const int ACTION_HISTORY = 8;      // matches server history
+        private static bool compactActions;
+        private static readonly uint[] _actTick = new uint[ACTION_HISTORY];
+        private static readonly bool[] _actValid = new bool[ACTION_HISTORY];
+        private static readonly byte[][] _actSet = NewActionSets();
+        private static readonly byte[] _actDecode = new byte[COMPACT_UNIT_SIZE * MAX_PLAYERS];
+        private static int _actNext;
+        private static uint _actAckedTick;
+
+        // Flow control (MSG_FLOW_CONTROL): the server asks for at most one STATE per
+        // interval while it is behind on ours; ticks in between only drain ACTIONs.
+        private static int _stateIntervalMs;       // 0 = every tick
+        private static uint _stateIntervalUntil;   // RealGetTickCount() expiry
+        private static uint _lastStateWallMs;
+
         // ============================================================
         // Hero State
         // ============================================================
@@ -3666,11 +3723,8 @@ namespace RLComm
             _stateMs.Position = 0;
             var w = _stateWriter;
             {
-                // ---- PacketHeader (8 bytes) ----
-                w.Write((ushort)0xFA7E);       // magic
-                w.Write((byte)1);              // version
-                w.Write((byte)1);              // msg_type = MSG_STATE
-                w.Write((uint)tickCount);      // tick
+                // ---- PacketHeader (8 bytes, +8 ext in v2) ----
+                WritePacketHeader(w, 1);       // msg_type = MSG_STATE
 
                 // ---- GlobalState (28 bytes) ----
                 w.Write(gameTime);                                          // game_time (float)
@@ -3945,7 +3999,8 @@ namespace RLComm
                 }
 
                 bool sendPath = (tickCount == 1 && _pathabilityGrid != null);
-                w.Write(sendPath ? (byte)1 : (byte)0);                     // has_pathability
+                w.Write((byte)((sendPath ? GRID_HAS_PATHABILITY : 0) | visEncoding
+                               | (compactActions ? STATE_ACTION_ACK : 0)));        // grid_flags
                 if (sendPath)
                 {
                     for (int c = 0; c < GRID_W * GRID_H; c++)
@@ -3971,17 +4026,17 @@ namespace RLComm
                         ComputeVisibilityGridInPlace(0, _visGridTeam0);
                         ComputeVisibilityGridInPlace(6, _visGridTeam1);
                     }
-                    for (int c = 0; c < GRID_W * GRID_H; c++)
-                        w.Write((byte)_visGridTeam0[c]);
-                    for (int c = 0; c < GRID_W * GRID_H; c++)
-                        w.Write((byte)_visGridTeam1[c]);
+                    WriteVisGrid(w, _visGridTeam0);
+                    WriteVisGrid(w, _visGridTeam1);
                 }
                 catch (Exception ex)
                 {
                     Log($"[RLComm] Visibility grid error: {ex.Message}");
                     // Write zeros
-                    for (int c = 0; c < GRID_W * GRID_H * 2; c++)
-                        w.Write((byte)0);
+                    Array.Clear(_visGridTeam0, 0, GRID_W * GRID_H);
+                    Array.Clear(_visGridTeam1, 0, GRID_W * GRID_H);
+                    WriteVisGrid(w, _visGridTeam0);
+                    WriteVisGrid(w, _visGridTeam1);
                 }
 
                 // ---- Creep data ----
@@ -4057,6 +4112,49 @@ namespace RLComm
             }
         }
 
+        /// <summary>Write one visibility grid in the configured encoding (see protocol.h).</summary>
+        private static void WriteVisGrid(BinaryWriter w, int[] grid)
+        {
+            const int CELLS = GRID_W * GRID_H;
+            if (visEncoding == GRID_VIS_BITS)
+            {
+                // bit (c & 7) of byte (c >> 3)
+                for (int b = 0; b < CELLS / 8; b++)
+                {
+                    int v = 0;
+                    for (int k = 0; k < 8; k++)
+                        if (grid[b * 8 + k] != 0) v |= 1 << k;
+                    w.Write((byte)v);
+                }
+            }
+            else if (visEncoding == GRID_VIS_RLE)
+            {
+                // uint16 num_runs + runs of (value << 7) | (length - 1)
+                int numRuns = 0;
+                for (int c = 0; c < CELLS; c += VisRunLength(grid, c)) numRuns++;
+                w.Write((ushort)numRuns);
+                for (int c = 0; c < CELLS; )
+                {
+                    int len = VisRunLength(grid, c);
+                    w.Write((byte)((grid[c] != 0 ? 0x80 : 0) | (len - 1)));
+                    c += len;
+                }
+            }
+            else
+            {
+                for (int c = 0; c < CELLS; c++)
+                    w.Write((byte)grid[c]);
+            }
+        }
+
+        private static int VisRunLength(int[] grid, int c)
+        {
+            bool v = grid[c] != 0;
+            int len = 1;
+            while (len < 128 && c + len < GRID_W * GRID_H && (grid[c + len] != 0) == v) len++;
+            return len;
+        }
+
         /// <summary>Write an empty UnitState for unregistered hero slot</summary>
         private static void WriteEmptyUnitBinary(BinaryWriter w, int idx)
         {
@@ -4287,18 +4385,32 @@ namespace RLComm
         // ============================================================
 
         /// <summary>
-        /// Build binary DONE packet (16 bytes) matching protocol.h DonePacket.
+        /// PacketHeader (magic, version, msg_type, tick) followed by the
+        /// v2 PacketHeaderExt (instance_id, episode_id) when enabled.
+        /// </summary>
+        private static void WritePacketHeader(BinaryWriter w, byte msgType)
+        {
+            w.Write((ushort)0xFA7E);       // magic
+            w.Write(protoVersion);         // version
+            w.Write(msgType);              // msg_type
+            w.Write((uint)tickCount);      // tick
+            if (protoVersion == 2)
+            {
+                w.Write(protoInstanceId);  // instance_id
+                w.Write(protoEpisodeId);   // episode_id
+            }
+        }
+
+        /// <summary>
+        /// Build binary DONE packet (16 bytes, 24 in v2) matching protocol.h DonePacket.
         /// </summary>
         private static byte[] BuildDoneBinary()
         {
             using (var ms = new MemoryStream(16))
             using (var w = new BinaryWriter(ms))
             {
-                // PacketHeader (8 bytes)
-                w.Write((ushort)0xFA7E);       // magic
-                w.Write((byte)1);              // version
-                w.Write((byte)3);              // msg_type = MSG_DONE
-                w.Write((uint)tickCount);      // tick
+                // PacketHeader (8 bytes, +8 ext in v2)
+                WritePacketHeader(w, 3);       // msg_type = MSG_DONE
 
                 // Determine winner and reason
                 byte winner = 2; // draw
@@ -4329,6 +4441,170 @@ namespace RLComm
             }
         }
 
+        // ============================================================
+        // Delta STATE Encoder
+        // ============================================================
+
+        /// <summary>
+        /// Returns the full STATE (recorded as a keyframe) or a MSG_STATE_DELTA
+        /// against the newest acked keyframe (layout in protocol.h).
+        /// </summary>
+        private static byte[] EncodeStateForSend(byte[] full)
+        {
+            if (!deltaEnabled) return full;
+
+            uint tick = (uint)tickCount;
+            bool keyDue = _kfAcked < 0 || tick - _kfTick[_kfAcked] >= KEYFRAME_INTERVAL;
+            bool canResend = _kfLastSentTick == 0 || tick - _kfLastSentTick >= KEYFRAME_RETRY;
+            if (_kfAcked < 0 || (keyDue && canResend))
+            {
+                if (_kfAcked == _kfNext) _kfAcked = -1;  // slot about to be overwritten
+                _kfTick[_kfNext] = tick;
+                _kfPacket[_kfNext] = full;
+                _kfNext = (_kfNext + 1) % KEYFRAME_HISTORY;
+                _kfLastSentTick = tick;
+                return full;
+            }
+
+            byte[] basePkt = _kfPacket[_kfAcked];
+            int hs = protoVersion == 2 ? 16 : 8;
+            int fullVis = StateVisOffset(full, hs);
+            int baseVis = StateVisOffset(basePkt, hs);
+            int fullVis1 = fullVis + VisGridLength(full, fullVis);
+            int baseVis1 = baseVis + VisGridLength(basePkt, baseVis);
+            int fullCreeps = fullVis1 + VisGridLength(full, fullVis1);
+            int baseCreeps = baseVis1 + VisGridLength(basePkt, baseVis1);
+
+            _deltaMs.SetLength(0);
+            _deltaMs.Position = 0;
+            var w = _deltaWriter;
+            WritePacketHeader(w, 4);                   // msg_type = MSG_STATE_DELTA
+            w.Write(_kfTick[_kfAcked]);                // base_tick
+
+            // Changed chunks of GlobalState + UnitState[12]
+            Array.Clear(_deltaMask, 0, DELTA_MASK_BYTES);
+            for (int c = 0; c < DELTA_NUM_CHUNKS; c++)
+            {
+                int pos = c * DELTA_CHUNK;
+                int n = Math.Min(DELTA_CHUNK, STATE_BLOCK_SIZE - pos);
+                if (!BytesEqual(full, hs + pos, basePkt, hs + pos, n))
+                    _deltaMask[c >> 3] |= (byte)(1 << (c & 7));
+            }
+            w.Write(_deltaMask);
+            for (int c = 0; c < DELTA_NUM_CHUNKS; c++)
+            {
+                if ((_deltaMask[c >> 3] & (1 << (c & 7))) == 0) continue;
+                int pos = c * DELTA_CHUNK;
+                w.Write(full, hs + pos, Math.Min(DELTA_CHUNK, STATE_BLOCK_SIZE - pos));
+            }
+
+            // Events + pathability: copied as-is
+            int tailStart = hs + STATE_BLOCK_SIZE;
+            w.Write(full, tailStart, fullVis - tailStart);
+
+            // Grids and creeps only when they differ from the keyframe
+            int vis0Len = fullVis1 - fullVis, vis1Len = fullCreeps - fullVis1;
+            int fullCreepLen = full.Length - fullCreeps, baseCreepLen = basePkt.Length - baseCreeps;
+            byte flags = 0;
+            if (vis0Len != baseVis1 - baseVis || !BytesEqual(full, fullVis, basePkt, baseVis, vis0Len))
+                flags |= 1;                                                                    // DELTA_VIS_T0
+            if (vis1Len != baseCreeps - baseVis1 || !BytesEqual(full, fullVis1, basePkt, baseVis1, vis1Len))
+                flags |= 2;                                                                    // DELTA_VIS_T1
+            if (fullCreepLen != baseCreepLen || !BytesEqual(full, fullCreeps, basePkt, baseCreeps, fullCreepLen))
+                flags |= 4;                                                                    // DELTA_CREEPS
+            w.Write(flags);
+            if ((flags & 1) != 0) w.Write(full, fullVis, vis0Len);
+            if ((flags & 2) != 0) w.Write(full, fullVis1, vis1Len);
+            if ((flags & 4) != 0) w.Write(full, fullCreeps, fullCreepLen);
+
+            w.Flush();
+            return _deltaMs.ToArray();
+        }
+
+        /// <summary>Offset of visibility_t0 in a full STATE (after events and pathability).</summary>
+        private static int StateVisOffset(byte[] pkt, int hs)
+        {
+            int o = hs + STATE_BLOCK_SIZE;
+            int numEvents = pkt[o++];
+            o += numEvents * 8;
+            int gridFlags = pkt[o++];
+            if ((gridFlags & GRID_HAS_PATHABILITY) != 0) o += GRID_W * GRID_H;
+            return o;
+        }
+
+        /// <summary>Encoded size of the visibility grid at offset o (same encoding as sent).</summary>
+        private static int VisGridLength(byte[] pkt, int o)
+        {
+            if (visEncoding == GRID_VIS_BITS) return GRID_W * GRID_H / 8;
+            if (visEncoding == GRID_VIS_RLE) return 2 + BitConverter.ToUInt16(pkt, o);
+            return GRID_W * GRID_H;
+        }
+
+        private static bool BytesEqual(byte[] a, int ao, byte[] b, int bo, int n)
+        {
+            for (int i = 0; i < n; i++)
+                if (a[ao + i] != b[bo + i]) return false;
+            return true;
+        }
+
+        /// <summary>An ACTION for tick T means the server holds the STATE of tick T.</summary>
+        private static void NoteStateAck(byte[] action)
+        {
+            if (action.Length < 8 || action[0] != 0x7E || action[1] != 0xFA) return;
+            if (action[3] != 2 && action[3] != 7) return;  // MSG_ACTION, MSG_ACTION_COMPACT
+            uint tick = BitConverter.ToUInt32(action, 4);
+            for (int i = 0; i < KEYFRAME_HISTORY; i++)
+            {
+                if (_kfPacket[i] == null || _kfTick[i] != tick) continue;
+                if (_kfAcked < 0 || tick > _kfTick[_kfAcked]) _kfAcked = i;
+                return;
+            }
+        }
+
+        /// <summary>
+        /// STATE_ACTION_ACK trailer: acked_action_tick after the creeps, so it stays out
+        /// of the keyframe and delta encodings.
+        /// </summary>
+        private static byte[] AppendActionAck(byte[] pkt)
+        {
+            if (!compactActions) return pkt;
+            byte[] result = new byte[pkt.Length + 4];
+            Buffer.BlockCopy(pkt, 0, result, 0, pkt.Length);
+            PutUInt32(result, pkt.Length, _actAckedTick);
+            return result;
+        }
+
+        // ============================================================
+        // Flow control -- the server's desired STATE interval
+        // ============================================================
+
+        /// <summary>MSG_FLOW_CONTROL: header + uint16 state_interval_ms + uint16 ttl_ms.</summary>
+        private static void NoteFlowControl(byte[] pkt, uint wallNow)
+        {
+            int hs = protoVersion == 2 ? 16 : 8;
+            if (pkt.Length < hs + 4 || pkt[0] != 0x7E || pkt[1] != 0xFA) return;
+            if (protoVersion == 2 && (BitConverter.ToUInt32(pkt, 8) != protoInstanceId
+                                      || BitConverter.ToUInt32(pkt, 12) != protoEpisodeId)) return;
+            int interval = BitConverter.ToUInt16(pkt, hs);
+            int ttl = BitConverter.ToUInt16(pkt, hs + 2);
+            if (interval != _stateIntervalMs)
+                Log($"[RLComm] Server flow control: STATE every {interval} ms (tick={tickCount})");
+            _stateIntervalMs = interval;
+            _stateIntervalUntil = wallNow + (uint)ttl;
+        }
+
+        /// <summary>True when a STATE may be sent now (no interval, expired, or elapsed).</summary>
+        private static bool StateDue(uint wallNow)
+        {
+            if (_stateIntervalMs <= 0) return true;
+            if ((int)(wallNow - _stateIntervalUntil) >= 0)
+            {
+                _stateIntervalMs = 0;  // no refresh: back to one STATE per tick
+                return true;
+            }
+            return wallNow - _lastStateWallMs >= (uint)_stateIntervalMs;
+        }
+
         // ============================================================
         // Binary Action Processor
         // ============================================================
@@ -4348,8 +4624,33 @@ namespace RLComm
                     if (magic != 0xFA7E) return;
                     byte version = r.ReadByte();
                     byte msgType = r.ReadByte();
-                    if (msgType != 2) return; // MSG_ACTION
+                    if (msgType != 2 && msgType != 7) return; // MSG_ACTION, MSG_ACTION_COMPACT
                     uint tick = r.ReadUInt32();
+                    if (version == 2)
+                    {
+                        // PacketHeaderExt: drop ACTIONs meant for another game/episode
+                        uint instanceId = r.ReadUInt32();
+                        uint episodeId = r.ReadUInt32();
+                        if (instanceId != protoInstanceId || episodeId != protoEpisodeId) return;
+                    }
+
+                    if (msgType == 7)
+                    {
+                        byte[] set = DecodeCompactAction(data, (int)ms.Position, tick);
+                        if (set == null) return;
+                        for (int i = 0; i < MAX_PLAYERS; i++)
+                        {
+                            int o = i * COMPACT_UNIT_SIZE;
+                            ApplyUnitAction((byte)i,
+                                            (sbyte)set[o] / 127f, (sbyte)set[o + 1] / 127f,
+                                            BitConverter.ToInt16(set, o + 2) / 32767f,
+                                            BitConverter.ToInt16(set, o + 4) / 32767f,
+                                            set[o + 6], set[o + 7], set[o + 8], set[o + 9], set[o + 10],
+                                            set[o + 11], set[o + 12], set[o + 13], set[o + 14],
+                                            set[o + 15], set[o + 16]);
+                        }
+                        return;
+                    }
 
                     // Read 12 UnitAction (28 bytes each)
                     for (int i = 0; i < MAX_PLAYERS; i++)
@@ -4373,98 +4674,161 @@ namespace RLComm
                         byte faireRespond = r.ReadByte();
                         byte pad2 = r.ReadByte();
 
-                        // Validate and execute
-                        if (idx >= MAX_PLAYERS || !heroRegistered[idx]) continue;
-                        if (episodeState != 0) continue;
+                        ApplyUnitAction(idx, moveX, moveY, pointX, pointY, skill, unitTarget,
+                                        skillLevelup, statUpgrade, attribute, itemBuy, itemUse,
+                                        sealUse, faireSend, faireRequest, faireRespond);
+                    }
+                }
+            }
+            catch (Exception ex)
+            {
+                Log($"[RLComm] ProcessActionBinary error: {ex.Message}");
+            }
+        }
+
+        private static byte[][] NewActionSets()
+        {
+            var sets = new byte[ACTION_HISTORY][];
+            for (int i = 0; i < ACTION_HISTORY; i++)
+                sets[i] = new byte[COMPACT_UNIT_SIZE * MAX_PLAYERS];
+            return sets;
+        }
+
+        /// <summary>
+        /// Rebuild the full action set of a MSG_ACTION_COMPACT body (layout in protocol.h)
+        /// and record it for later bases. Returns 12 CompactUnitActions, or null when the
+        /// body is truncated or its base ACTION is no longer in history.
+        /// </summary>
+        private static byte[] DecodeCompactAction(byte[] data, int o, uint tick)
+        {
+            if (data.Length < o + 6) return null;
+            uint baseTick = BitConverter.ToUInt32(data, o);
+            int mask = BitConverter.ToUInt16(data, o + 4);
+            o += 6;
+
+            int baseSlot = -1;
+            if (baseTick != 0)
+            {
+                for (int i = 0; i < ACTION_HISTORY; i++)
+                    if (_actValid[i] && _actTick[i] == baseTick) baseSlot = i;
+                if (baseSlot < 0) return null;
+            }
+
+            for (int i = 0; i < MAX_PLAYERS; i++)
+            {
+                int dst = i * COMPACT_UNIT_SIZE;
+                if ((mask & (1 << i)) != 0)
+                {
+                    if (data.Length < o + COMPACT_UNIT_SIZE) return null;
+                    Buffer.BlockCopy(data, o, _actDecode, dst, COMPACT_UNIT_SIZE);
+                    o += COMPACT_UNIT_SIZE;
+                }
+                else if (baseSlot >= 0)
+                {
+                    Buffer.BlockCopy(_actSet[baseSlot], dst, _actDecode, dst, COMPACT_UNIT_SIZE);
+                }
+                else return null;  // no base: every unit must be present
+            }
 
-                        JassUnit u = heroes[idx];
-                        float gameTime = tickCount * TICK_INTERVAL;
+            byte[] set = _actSet[_actNext];
+            Buffer.BlockCopy(_actDecode, 0, set, 0, set.Length);
+            _actTick[_actNext] = tick;
+            _actValid[_actNext] = true;
+            _actNext = (_actNext + 1) % ACTION_HISTORY;
+            _actAckedTick = tick;
+            return set;
+        }
 
-                        // Check alive (except seal_use=5 revive)
-                        bool alive = IsUnitAlive(u);
+        /// <summary>Validate and execute one unit's action (UnitAction fields, see protocol.h).</summary>
+        private static void ApplyUnitAction(byte idx, float moveX, float moveY, float pointX, float pointY,
+                                            byte skill, byte unitTarget, byte skillLevelup, byte statUpgrade,
+                                            byte attribute, byte itemBuy, byte itemUse, byte sealUse,
+                                            byte faireSend, byte faireRequest, byte faireRespond)
+        {
+            if (idx >= MAX_PLAYERS || !heroRegistered[idx]) return;
+            if (episodeState != 0) return;
 
-                        // 9. Seal use (process first since revive can bring dead hero back)
-                        if (sealUse > 0)
-                            ExecuteSealUse(idx, u, sealUse, pointX, pointY);
+            JassUnit u = heroes[idx];
+            float gameTime = tickCount * TICK_INTERVAL;
 
-                        // 7a. Faire (기사회생) - can be used while dead (item_buy 1-6)
-                        if (itemBuy >= 1 && itemBuy <= 6)
-                            ExecuteItemBuy(idx, u, itemBuy);
+            // Check alive (except seal_use=5 revive)
+            bool alive = IsUnitAlive(u);
 
-                        // Re-check alive after potential revive
-                        alive = IsUnitAlive(u);
-                        if (!alive) continue;
+            // 9. Seal use (process first since revive can bring dead hero back)
+            if (sealUse > 0)
+                ExecuteSealUse(idx, u, sealUse, pointX, pointY);
 
-                        float cx = 0f, cy = 0f;
-                        try { cx = Natives.GetUnitX(u); } catch { }
-                        try { cy = Natives.GetUnitY(u); } catch { }
+            // 7a. Faire (기사회생) - can be used while dead (item_buy 1-6)
+            if (itemBuy >= 1 && itemBuy <= 6)
+                ExecuteItemBuy(idx, u, itemBuy);
 
-                        // 4. Skill levelup
-                        if (skillLevelup > 0)
-                            ExecuteSkillLevelup(idx, u, skillLevelup);
+            // Re-check alive after potential revive
+            alive = IsUnitAlive(u);
+            if (!alive) return;
 
-                        // 5. Stat upgrade
-                        if (statUpgrade > 0)
-                            ExecuteStatUpgrade(idx, u, statUpgrade);
+            float cx = 0f, cy = 0f;
+            try { cx = Natives.GetUnitX(u); } catch { }
+            try { cy = Natives.GetUnitY(u); } catch { }
 
-                        // 6. Attribute
-                        if (attribute > 0)
-                            ExecuteAttribute(idx, u, attribute);
+            // 4. Skill levelup
+            if (skillLevelup > 0)
+                ExecuteSkillLevelup(idx, u, skillLevelup);
 
-                        // 7. Item buy
-                        if (itemBuy > 0)
-                            ExecuteItemBuy(idx, u, itemBuy);
+            // 5. Stat upgrade
+            if (statUpgrade > 0)
+                ExecuteStatUpgrade(idx, u, statUpgrade);
 
-                        // 8. Item use
-                        if (itemUse > 0)
-                            ExecuteItemUse(idx, u, itemUse, unitTarget, pointX, pointY, cx, cy);
+            // 6. Attribute
+            if (attribute > 0)
+                ExecuteAttribute(idx, u, attribute);
 
-                        // 10. Faire send
-                        if (faireSend > 0)
-                            ExecuteFaireSend(idx, faireSend);
+            // 7. Item buy
+            if (itemBuy > 0)
+                ExecuteItemBuy(idx, u, itemBuy);
 
-                        // 11. Faire request
-                        if (faireRequest > 0)
-                            ExecuteFaireRequest(idx, faireRequest);
+            // 8. Item use
+            if (itemUse > 0)
+                ExecuteItemUse(idx, u, itemUse, unitTarget, pointX, pointY, cx, cy);
 
-                        // 12. Faire respond
-                        if (faireRespond > 0)
-                            ExecuteFaireRespond(idx, faireRespond);
+            // 10. Faire send
+            if (faireSend > 0)
+                ExecuteFaireSend(idx, faireSend);
 
-                        // 3. Skill (takes priority over move if skill is actually used)
-                        bool skillIssued = false;
-                        if (skill >= 1)
-                        {
-                            skillIssued = ExecuteSkill(idx, u, skill, unitTarget, pointX, pointY, cx, cy, gameTime);
-                        }
+            // 11. Faire request
+            if (faireRequest > 0)
+                ExecuteFaireRequest(idx, faireRequest);
 
-                        // 1. Move (only if no skill was issued AND move has meaningful direction)
-                        //    Skip if move is near-zero to avoid cancelling ongoing attacks/skills
-                        //    Also skip during targeting skill grace period to prevent cancellation
-                        if (!skillIssued)
-                        {
-                            bool inGracePeriod = (tickCount - _targetSkillGraceTick[idx]) < TARGETING_SKILL_GRACE
-                                                 && _targetSkillGraceTick[idx] > 0;
-                            if (inGracePeriod)
-                            {
-                                // Targeting skill in progress, suppress move to let it complete
-                            }
-                            else
-                            {
-                                float moveNorm = (float)Math.Sqrt(moveX * moveX + moveY * moveY);
-                                if (moveNorm >= 0.1f)
-                                {
-                                    ExecuteMove(idx, u, moveX, moveY, cx, cy);
-                                }
-                                // else: no-op, let unit continue current action
-                            }
-                        }
-                    }
-                }
+            // 12. Faire respond
+            if (faireRespond > 0)
+                ExecuteFaireRespond(idx, faireRespond);
+
+            // 3. Skill (takes priority over move if skill is actually used)
+            bool skillIssued = false;
+            if (skill >= 1)
+            {
+                skillIssued = ExecuteSkill(idx, u, skill, unitTarget, pointX, pointY, cx, cy, gameTime);
             }
-            catch (Exception ex)
+
+            // 1. Move (only if no skill was issued AND move has meaningful direction)
+            //    Skip if move is near-zero to avoid cancelling ongoing attacks/skills
+            //    Also skip during targeting skill grace period to prevent cancellation
+            if (!skillIssued)
             {
-                Log($"[RLComm] ProcessActionBinary error: {ex.Message}");
+                bool inGracePeriod = (tickCount - _targetSkillGraceTick[idx]) < TARGETING_SKILL_GRACE
+                                     && _targetSkillGraceTick[idx] > 0;
+                if (inGracePeriod)
+                {
+                    // Targeting skill in progress, suppress move to let it complete
+                }
+                else
+                {
+                    float moveNorm = (float)Math.Sqrt(moveX * moveX + moveY * moveY);
+                    if (moveNorm >= 0.1f)
+                    {
+                        ExecuteMove(idx, u, moveX, moveY, cx, cy);
+                    }
+                    // else: no-op, let unit continue current action
+                }
             }
         }
 
@@ -5615,13 +5979,7 @@ namespace RLComm
                 try
                 {
                     byte[] donePkt = BuildDoneBinary();
-                    // Send DONE multiple times to ensure delivery (UDP is unreliable)
-                    for (int i = 0; i < 3; i++)
-                    {
-                        udpSend.Send(donePkt, donePkt.Length, inferenceEndpoint);
-                        System.Threading.Thread.Sleep(50);
-                    }
-                    Log($"[RLComm] Episode done sent via UDP (3x), tick={tickCount}");
+                    SendDoneReliable(donePkt);
                 }
                 catch (Exception ex)
                 {
@@ -5633,20 +5991,33 @@ namespace RLComm
 
             try
             {
-                // 1. Build and send STATE (fire-and-forget, non-blocking)
-                byte[] statePkt = BuildStateBinary();
-                udpSend.Send(statePkt, statePkt.Length, inferenceEndpoint);
+                // 1. Build and send STATE (fire-and-forget, non-blocking),
+                //    at most one per flow-control interval
+                uint wallNow = RealGetTickCount();
+                if (StateDue(wallNow))
+                {
+                    byte[] statePkt = AppendActionAck(EncodeStateForSend(BuildStateBinary()));
+                    SendDatagram(statePkt);
+                    _lastStateWallMs = wallNow;
+                }
 
                 // 2. Non-blocking recv ACTION (drain all, use latest)
                 byte[] latestAction = null;
                 while (udpRecv.Available > 0)
                 {
                     IPEndPoint remoteEP = null;
-                    latestAction = udpRecv.Receive(ref remoteEP);
+                    byte[] pkt = udpRecv.Receive(ref remoteEP);
+                    if (pkt.Length >= 8 && pkt[3] == 8)  // MSG_FLOW_CONTROL
+                    {
+                        NoteFlowControl(pkt, wallNow);
+                        continue;
+                    }
+                    latestAction = pkt;
+                    if (deltaEnabled) NoteStateAck(latestAction);
                 }
 
                 // 3. Apply new ACTION if received (1 time only, no caching)
-                if (latestAction != null && latestAction.Length >= 8)
+                if (latestAction != null && latestAction.Length >= (protoVersion == 2 ? 16 : 8))
                     ProcessActionBinary(latestAction);
 
                 // Clear alarm states
@@ -5659,6 +6030,104 @@ namespace RLComm
             }
         }
 
+        // ============================================================
+        // SendDatagram -- one UDP send, or MSG_FRAGMENTs when too long
+        // ============================================================
+
+        /// <summary>
+        /// Fragments carry the packet's magic/version/tick with msg_type 6,
+        /// then msg_id, total_len, offset (uint32) and index, count (uint16),
+        /// matching protocol.h FragmentHeader.
+        /// </summary>
+        private static void SendDatagram(byte[] pkt)
+        {
+            if (fragmentSize == 0 || pkt.Length <= fragmentSize)
+            {
+                udpSend.Send(pkt, pkt.Length, inferenceEndpoint);
+                return;
+            }
+
+            int chunk = fragmentSize - FRAGMENT_HEADER_SIZE;
+            int count = (pkt.Length + chunk - 1) / chunk;
+            uint msgId = ++fragmentMsgId;
+            Buffer.BlockCopy(pkt, 0, _fragBuf, 0, 8);       // PacketHeader
+            _fragBuf[3] = 6;                                // msg_type = MSG_FRAGMENT
+            PutUInt32(_fragBuf, 8, msgId);
+            PutUInt32(_fragBuf, 12, (uint)pkt.Length);
+            for (int i = 0; i < count; i++)
+            {
+                int off = i * chunk;
+                int n = Math.Min(chunk, pkt.Length - off);
+                PutUInt32(_fragBuf, 16, (uint)off);
+                _fragBuf[20] = (byte)i; _fragBuf[21] = (byte)(i >> 8);
+                _fragBuf[22] = (byte)count; _fragBuf[23] = (byte)(count >> 8);
+                Buffer.BlockCopy(pkt, off, _fragBuf, FRAGMENT_HEADER_SIZE, n);
+                udpSend.Send(_fragBuf, FRAGMENT_HEADER_SIZE + n, inferenceEndpoint);
+            }
+        }
+
+        private static void PutUInt32(byte[] b, int off, uint v)
+        {
+            b[off] = (byte)v; b[off + 1] = (byte)(v >> 8);
+            b[off + 2] = (byte)(v >> 16); b[off + 3] = (byte)(v >> 24);
+        }
+
+        // ============================================================
+        // DONE delivery -- retransmit until the server's MSG_DONE_ACK
+        // ============================================================
+
+        private const int DONE_RETRY_MS = 100;      // first retransmission interval (doubles, max 1 s)
+        private const int DONE_MAX_WAIT_MS = 5000;  // then restart without an ACK
+
+        /// <summary>
+        /// Send DONE and wait for its DONE-ACK (same header, msg_type 5),
+        /// retransmitting with backoff. The server applies one DONE per
+        /// episode, so duplicates are harmless. A server without DONE-ACK
+        /// support never answers; the episode restarts after DONE_MAX_WAIT_MS.
+        /// </summary>
+        private static void SendDoneReliable(byte[] donePkt)
+        {
+            uint wallStart = RealGetTickCount();
+            int retryMs = DONE_RETRY_MS;
+            int sends = 0;
+            while (true)
+            {
+                udpSend.Send(donePkt, donePkt.Length, inferenceEndpoint);
+                sends++;
+                uint deadline = RealGetTickCount() + (uint)retryMs;
+                while ((int)(deadline - RealGetTickCount()) > 0)
+                {
+                    while (udpRecv.Available > 0)
+                    {
+                        IPEndPoint remoteEP = null;
+                        byte[] pkt = udpRecv.Receive(ref remoteEP);
+                        if (IsDoneAck(pkt, donePkt))
+                        {
+                            Log($"[RLComm] Episode DONE acknowledged, tick={tickCount}, sends={sends}");
+                            return;
+                        }
+                    }
+                    System.Threading.Thread.Sleep(5);
+                }
+                if (RealGetTickCount() - wallStart >= DONE_MAX_WAIT_MS)
+                {
+                    Log($"[RLComm] No DONE-ACK after {sends} sends, tick={tickCount}");
+                    return;
+                }
+                retryMs = Math.Min(retryMs * 2, 1000);
+            }
+        }
+
+        /// <summary>DONE-ACK: the DONE's header (incl. v2 ext) with msg_type = MSG_DONE_ACK.</summary>
+        private static bool IsDoneAck(byte[] pkt, byte[] donePkt)
+        {
+            int hdrLen = protoVersion == 2 ? 16 : 8;
+            if (pkt.Length < hdrLen || pkt[3] != 5) return false;
+            for (int i = 0; i < hdrLen; i++)
+                if (i != 3 && pkt[i] != donePkt[i]) return false;
+            return true;
+        }
+
         // ============================================================
         // Restart -- terminate war3.exe so Docker entrypoint restarts it
         // ============================================================
@@ -5777,12 +6246,44 @@ namespace RLComm
                 int udpPort = int.TryParse(Environment.GetEnvironmentVariable("INFERENCE_PORT"), out int p) ? p : sendPort;
                 int recvP = int.TryParse(Environment.GetEnvironmentVariable("RL_RECV_PORT"), out int rp) ? rp : recvPort;
 
-                inferenceEndpoint = new IPEndPoint(IPAddress.Parse(host), udpPort);
-                udpSend = new UdpClient();
-                udpRecv = new UdpClient(recvP);
-                udpRecv.Client.Blocking = false;
+                protoVersion = Environment.GetEnvironmentVariable("RL_PROTO_VERSION") == "2" ? (byte)2 : (byte)1;
+                protoInstanceId = uint.TryParse(Environment.GetEnvironmentVariable("RL_INSTANCE_ID"), out uint iid) && iid != 0
+                    ? iid : (uint)recvP;
+                protoEpisodeId = unchecked((uint)(DateTime.UtcNow.Ticks / TimeSpan.TicksPerMillisecond));
+                if (protoEpisodeId == 0) protoEpisodeId = 1;
+                deltaEnabled = Environment.GetEnvironmentVariable("RL_DELTA_STATE") == "1";
+                string visEnv = Environment.GetEnvironmentVariable("RL_VIS_ENCODING");
+                visEncoding = visEnv == "bits" ? GRID_VIS_BITS : visEnv == "rle" ? GRID_VIS_RLE : (byte)0;
+                fragmentSize = int.TryParse(Environment.GetEnvironmentVariable("RL_FRAGMENT_SIZE"), out int fs)
+                    && fs > FRAGMENT_HEADER_SIZE ? fs : 0;
+                _fragBuf = fragmentSize > 0 ? new byte[fragmentSize] : null;
+                _kfNext = 0;
+                _kfAcked = -1;
+                _kfLastSentTick = 0;
+                Array.Clear(_kfPacket, 0, KEYFRAME_HISTORY);
+                compactActions = Environment.GetEnvironmentVariable("RL_COMPACT_ACTIONS") == "1";
+                _actNext = 0;
+                _actAckedTick = 0;
+                Array.Clear(_actValid, 0, ACTION_HISTORY);
+                _stateIntervalMs = 0;
 
-                Log($"[RLComm] UDP initialized: send={host}:{udpPort}, recv=0.0.0.0:{recvP}");
+                inferenceEndpoint = new IPEndPoint(IPAddress.Parse(host), udpPort);
+                if (protoVersion == 2)
+                {
+                    // v2: server replies to the sender endpoint, so one ephemeral
+                    // socket serves both directions (no fixed recv port per host)
+                    udpSend = new UdpClient(0);
+                    udpSend.Client.Blocking = false;
+                    udpRecv = udpSend;
+                    Log($"[RLComm] UDP initialized (v2): send={host}:{udpPort}, instance={protoInstanceId}, episode={protoEpisodeId}");
+                }
+                else
+                {
+                    udpSend = new UdpClient();
+                    udpRecv = new UdpClient(recvP);
+                    udpRecv.Client.Blocking = false;
+                    Log($"[RLComm] UDP initialized: send={host}:{udpPort}, recv=0.0.0.0:{recvP}");
+                }
             }
             catch (Exception ex)
             {